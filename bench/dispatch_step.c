@@ -0,0 +1,38 @@
+/*
+	Step that only times its own dispatch, for the dispatch latency test (and make bench runs of it)
+	Run by cook --latency it appends how long ago its recipe was ready with a free cook (COOK_READY_NS, on
+	the same CLOCK_MONOTONIC) to the file, in ns on a line of its own; one write() with O_APPEND, so the
+	steps of every cook can share the file. It takes no time otherwise
+
+	usage: dispatch_step file
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "latency_histogram.h"
+
+int main(int argc, char *argv[]) {
+	long long now_ns = latency_now_ns(); // first: everything after this is the step, not its dispatch
+	const char *ready = getenv("COOK_READY_NS");
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: dispatch_step file\n");
+		return EXIT_FAILURE;
+	}
+	if (ready == NULL || atoll(ready) <= 0) {
+		fprintf(stderr, "ERROR: COOK_READY_NS is not set, the step must be run by cook --latency\n");
+		return EXIT_FAILURE;
+	}
+
+	char line[32];
+	int length = snprintf(line, sizeof(line), "%lld\n", now_ns - atoll(ready));
+	int fd = open(argv[1], O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0 || write(fd, line, length) != length) {
+		perror("dispatch_step");
+		return EXIT_FAILURE;
+	}
+	return close(fd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+/*
+	Generator of synthetic cookbooks for the scaling benchmark (make bench), written to stdout
+	Every recipe gets one task of steps that take no time (true, or a pipeline of them; step replaces true),
+	so a run of the cookbook measures what cook itself costs; the first recipe ("all") is the target and
+	needs every other recipe, directly or not. The shapes:
+		fanout     all depends on n leaves (everything is ready at once)
+		chain      n recipes each depending on the next (nothing runs in parallel, the deepest analysis)
+		lattice    layers of width recipes, each depending on the two below it (diamonds on diamonds)
+		layered    layers of width recipes, each depending on the one under it and up to 2 random others
+		pipeline   width chains of n / width recipes, every task a pipeline of width steps
+	The same shape, size, width and seed always give the same cookbook
+
+	usage: gen_cookbook fanout|chain|lattice|layered|pipeline recipes [width] [seed] [step]
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEFAULT_WIDTH 32
+#define MAX_LAYER_DEPENDENCIES 3
+
+static unsigned long long seed_state = 1;
+static const char *step = "true";
+
+// xorshift, so the random layers are the same on every machine
+static unsigned long next_random(void) {
+	seed_state ^= seed_state << 13;
+	seed_state ^= seed_state >> 7;
+	seed_state ^= seed_state << 17;
+	return (unsigned long)(seed_state >> 11);
+}
+
+// one task of steps steps that take no time
+static void print_task(int steps) {
+	printf("  %s", step);
+	for (int i = 1; i < steps; i++) printf(" | %s", step);
+	printf("\n\n");
+}
+
+// the target, depending on recipes first..last
+static void print_target(int first, int last) {
+	printf("all:");
+	for (int i = first; i <= last; i++) printf(" r%d", i);
+	printf("\n");
+	print_task(1);
+}
+
+static void fanout(int n) {
+	print_target(0, n - 1);
+	for (int i = 0; i < n; i++) {
+		printf("r%d:\n", i);
+		print_task(1);
+	}
+}
+
+static void chain(int n) {
+	print_target(0, 0);
+	for (int i = 0; i < n; i++) {
+		if (i + 1 < n) printf("r%d: r%d\n", i, i + 1);
+		else printf("r%d:\n", i);
+		print_task(1);
+	}
+}
+
+/*
+	Function to print layers of width recipes, recipe i of a layer is r(layer * width + i)
+	In a lattice recipe i depends on i and i + 1 of the layer below, in random layers on recipe i of it and
+	up to MAX_LAYER_DEPENDENCIES - 1 random others (so no recipe is left out); the last layer are the leaves
+*/
+static void layers(int n, int width, int random_edges) {
+	int layer_count = (n + width - 1) / width;
+	print_target(0, (n < width ? n : width) - 1);
+	for (int r = 0; r < n; r++) {
+		int layer = r / width, below = (layer + 1) * width;
+		int below_width = n - below < width ? n - below : width;
+		printf("r%d:", r);
+		if (layer + 1 < layer_count && below_width > 0) {
+			if (!random_edges) {
+				printf(" r%d", below + r % width % below_width);
+				if (below_width > 1) printf(" r%d", below + (r % width + 1) % below_width);
+			} else {
+				int picked[MAX_LAYER_DEPENDENCIES], count = 1 + next_random() % MAX_LAYER_DEPENDENCIES;
+				for (int d = 0; d < count; d++) {
+					picked[d] = d == 0 ? r % width % below_width : (int)(next_random() % below_width);
+					int seen = 0;
+					for (int e = 0; e < d; e++) seen |= picked[e] == picked[d];
+					if (!seen) printf(" r%d", below + picked[d]);
+				}
+			}
+		}
+		printf("\n");
+		print_task(1);
+	}
+}
+
+static void pipeline(int n, int width) {
+	int length = n / width > 0 ? n / width : 1;
+	print_target(0, width - 1);
+	for (int c = 0; c < width; c++) {
+		for (int i = 0; i < length; i++) {
+			int r = i == 0 ? c : width + c * length + i - 1; // the heads are r0..r(width - 1)
+			int next = width + c * length + i;
+			if (i + 1 < length) printf("r%d: r%d\n", r, next);
+			else printf("r%d:\n", r);
+			print_task(width);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3 || atoi(argv[2]) <= 0) {
+		fprintf(stderr, "usage: gen_cookbook fanout|chain|lattice|layered|pipeline recipes [width] [seed] [step]\n");
+		return EXIT_FAILURE;
+	}
+	const char *shape = argv[1];
+	int n = atoi(argv[2]);
+	int width = argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : DEFAULT_WIDTH;
+	seed_state = argc > 4 ? strtoull(argv[4], NULL, 10) * 2654435761ULL + 1 : 1;
+	if (argc > 5 && argv[5][0] != '\0') step = argv[5];
+
+	if (strcmp(shape, "fanout") == 0) fanout(n);
+	else if (strcmp(shape, "chain") == 0) chain(n);
+	else if (strcmp(shape, "lattice") == 0) layers(n, width, 0);
+	else if (strcmp(shape, "layered") == 0) layers(n, width, 1);
+	else if (strcmp(shape, "pipeline") == 0) pipeline(n, width < n ? width : n);
+	else {
+		fprintf(stderr, "ERROR: Unknown shape '%s' (fanout, chain, lattice, layered or pipeline)\n", shape);
+		return EXIT_FAILURE;
+	}
+	return fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,327 @@
+/*
+	Microbenchmarks of the scheduler data structures and the parser (make bench-micro, make bench-check)
+	Every benchmark runs on a generated cookbook (a lattice of recipes, each depending on the two below it,
+	or a chain) parsed once up front, a warm-up round and then reps timed rounds; a round is reported per
+	operation (per recipe, or per element pushed / queued) as min, median, mean, standard deviation and max
+		work_queue           enqueue every recipe, then dequeue them all (heap order)
+		dequeue_recipe       enqueue every recipe, then take them out by name in a shuffled order
+		stack                push every recipe, then pop them all
+		analysis             stack_analysis_traversal() from the target
+		cycle_check          check_circular_tree_cycle() from the target (lattice and chain)
+		update_work_queue    a whole run without cooks: every dequeued recipe completes and releases its dependents
+		parse_cookbook       parse_cookbook() of the cookbook text
+	With -c baseline the medians are compared to the ones stored there, a benchmark slower than its baseline
+	by more than the tolerance fails the run (exit 1); -w writes the medians of this run as the new baseline
+	Nanoseconds only compare on the same machine, so a baseline is taken where it is checked (make bench-baseline)
+
+	usage: cook_bench [-n recipes] [-r reps] [-c baseline | -w baseline] [-t tolerance_percent]
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "cookbook.h"
+#include "stack_queue_tree_traversal.h"
+#include "latency_histogram.h"
+
+#define DEFAULT_RECIPES 2000
+#define DEFAULT_REPS 15
+#define DEFAULT_TOLERANCE 30
+#define LATTICE_WIDTH 32
+#define MAX_BENCHMARKS 16
+
+typedef struct bench_result {
+	const char *name;
+	double min_ns, median_ns, mean_ns, stddev_ns, max_ns;   // per operation
+} BENCH_RESULT;
+
+typedef struct bench_graph {
+	char *text;                 // the cookbook, for parse_cookbook
+	size_t size;
+	COOKBOOK *cookbook;
+	RECIPE **recipes;           // in cookbook order, recipes[0] is the target
+	int count;
+} BENCH_GRAPH;
+
+static BENCH_RESULT results[MAX_BENCHMARKS];
+static int result_count = 0;
+
+static int compare_doubles(const void *a, const void *b) {
+	double first = *(const double *)a, second = *(const double *)b;
+	return first < second ? -1 : first > second;
+}
+
+// Function to keep the summary of reps rounds (ns per operation) under name
+static void summarize(const char *name, double *rounds, int reps) {
+	BENCH_RESULT *result = &results[result_count++];
+	double sum = 0, squares = 0;
+	qsort(rounds, reps, sizeof(double), compare_doubles);
+	for (int i = 0; i < reps; i++) sum += rounds[i];
+	result->name = name;
+	result->mean_ns = sum / reps;
+	for (int i = 0; i < reps; i++) squares += (rounds[i] - result->mean_ns) * (rounds[i] - result->mean_ns);
+	result->min_ns = rounds[0];
+	result->max_ns = rounds[reps - 1];
+	result->median_ns = reps % 2 ? rounds[reps / 2] : (rounds[reps / 2 - 1] + rounds[reps / 2]) / 2;
+	result->stddev_ns = reps > 1 ? sqrt(squares / (reps - 1)) : 0;
+}
+
+/*
+	Function to write a cookbook of n recipes below the target "all" and parse it
+	A lattice has layers of LATTICE_WIDTH recipes, recipe i of a layer depending on i and i + 1 of the one below;
+	a chain has every recipe depending on the next
+
+	Returns 0, or -1 if the cookbook could not be made
+*/
+static int make_graph(BENCH_GRAPH *graph, int n, int lattice) {
+	memset(graph, 0, sizeof(BENCH_GRAPH));
+	FILE *out = open_memstream(&graph->text, &graph->size);
+	if (out == NULL) return -1;
+
+	int width = lattice ? LATTICE_WIDTH : 1;
+	fprintf(out, "all:");
+	for (int i = 0; i < n && i < width; i++) fprintf(out, " r%d", i);
+	fprintf(out, "\n  true\n\n");
+	for (int r = 0; r < n; r++) {
+		int below = (r / width + 1) * width, below_width = n - below < width ? n - below : width;
+		fprintf(out, "r%d:", r);
+		if (below_width > 0) {
+			fprintf(out, " r%d", below + r % width % below_width);
+			if (lattice && below_width > 1) fprintf(out, " r%d", below + (r % width + 1) % below_width);
+		}
+		fprintf(out, "\n  true\n\n");
+	}
+	if (fclose(out) != 0) return -1;
+
+	FILE *in = fmemopen(graph->text, graph->size, "r");
+	int err = 0;
+	graph->cookbook = in != NULL ? parse_cookbook(in, &err) : NULL;
+	if (in != NULL) fclose(in);
+	if (graph->cookbook == NULL || err || initialize_cookbook_states(graph->cookbook) != 0) return -1;
+
+	graph->recipes = calloc(n + 1, sizeof(RECIPE *));
+	if (graph->recipes == NULL) return -1;
+	for (RECIPE *recipe = graph->cookbook->recipes; recipe != NULL; recipe = recipe->next) {
+		graph->recipes[graph->count++] = recipe;
+	}
+	return 0;
+}
+
+static void free_graph(BENCH_GRAPH *graph) {
+	free_cookbook(graph->cookbook);
+	free(graph->recipes);
+	free(graph->text);
+}
+
+static void shuffle(RECIPE **recipes, int count) {
+	for (int i = count - 1; i > 0; i--) {
+		int j = random() % (i + 1);
+		RECIPE *swap = recipes[i];
+		recipes[i] = recipes[j];
+		recipes[j] = swap;
+	}
+}
+
+/*
+	The rounds of every benchmark: each returns the ns per operation of one round
+	A benchmark leaves the recipe states as it found them (cleared)
+*/
+static WORK_QUEUE *new_queue(void) {
+	WORK_QUEUE *queue = init_work_queue();
+	if (queue == NULL) exit(EXIT_FAILURE); // the numbers of a round without its queue mean nothing
+	return queue;
+}
+
+static double round_work_queue(BENCH_GRAPH *graph) {
+	WORK_QUEUE *queue = new_queue();
+	for (int i = 0; i < graph->count; i++) RECIPE_STATE_OF(graph->recipes[i])->priority = (i * 7919) % 1000;
+	long long started = latency_now_ns();
+	for (int i = 0; i < graph->count; i++) enqueue(queue, graph->recipes[i]);
+	while (dequeue(queue) != NULL) continue;
+	long long ended = latency_now_ns();
+	free_work_queue(queue);
+	initialize_cookbook_states(graph->cookbook);
+	return (double)(ended - started) / (2 * graph->count);
+}
+
+static double round_dequeue_recipe(BENCH_GRAPH *graph) {
+	WORK_QUEUE *queue = new_queue();
+	RECIPE **order = malloc(graph->count * sizeof(RECIPE *));
+	memcpy(order, graph->recipes, graph->count * sizeof(RECIPE *));
+	shuffle(order, graph->count);
+	for (int i = 0; i < graph->count; i++) enqueue(queue, graph->recipes[i]);
+	long long started = latency_now_ns();
+	for (int i = 0; i < graph->count; i++) dequeue_recipe(queue, order[i]);
+	long long ended = latency_now_ns();
+	free(order);
+	free_work_queue(queue);
+	initialize_cookbook_states(graph->cookbook);
+	return (double)(ended - started) / graph->count;
+}
+
+static double round_stack(BENCH_GRAPH *graph) {
+	STACK stack = { NULL };
+	long long started = latency_now_ns();
+	for (int i = 0; i < graph->count; i++) push(&stack, graph->recipes[i]);
+	while (!is_stack_empty(&stack)) pop(&stack);
+	long long ended = latency_now_ns();
+	return (double)(ended - started) / (2 * graph->count);
+}
+
+static double round_analysis(BENCH_GRAPH *graph) {
+	WORK_QUEUE *queue = new_queue();
+	long long started = latency_now_ns();
+	stack_analysis_traversal(graph->recipes[0], queue);
+	long long ended = latency_now_ns();
+	free_work_queue(queue);
+	initialize_cookbook_states(graph->cookbook);
+	return (double)(ended - started) / graph->count;
+}
+
+static double round_cycle_check(BENCH_GRAPH *graph) {
+	long long started = latency_now_ns();
+	check_circular_tree_cycle(graph->recipes[0]);
+	long long ended = latency_now_ns();
+	initialize_cookbook_states(graph->cookbook);
+	return (double)(ended - started) / graph->count;
+}
+
+// like the main cook with unlimited cooks that finish at once: dequeue (start), complete, update
+static double round_update_work_queue(BENCH_GRAPH *graph) {
+	WORK_QUEUE *queue = new_queue(), *leaves = new_queue();
+	RECIPE **completed = calloc(graph->count, sizeof(RECIPE *));
+	stack_analysis_traversal(graph->recipes[0], leaves);
+	for (int i = 0; i < graph->count; i++) RECIPE_STATE_OF(graph->recipes[i])->required = 1;
+	RECIPE *leaf;
+	while ((leaf = dequeue(leaves)) != NULL) enqueue(queue, leaf);
+
+	int completed_count = 0;
+	long long started = latency_now_ns();
+	RECIPE *recipe;
+	while ((recipe = dequeue(queue)) != NULL) {
+		mark_visited(recipe);
+		completed[completed_count++] = recipe;
+		RECIPE_STATE_OF(recipe)->completed = 1;
+		update_work_queue(queue, completed, completed_count);
+	}
+	long long ended = latency_now_ns();
+	free(completed);
+	free_work_queue(queue);
+	free_work_queue(leaves);
+	initialize_cookbook_states(graph->cookbook);
+	return (double)(ended - started) / graph->count;
+}
+
+static double round_parse(BENCH_GRAPH *graph) {
+	int err = 0;
+	FILE *in = fmemopen(graph->text, graph->size, "r");
+	long long started = latency_now_ns();
+	COOKBOOK *cookbook = parse_cookbook(in, &err);
+	long long ended = latency_now_ns();
+	fclose(in);
+	free_cookbook(cookbook);
+	return (double)(ended - started) / graph->count;
+}
+
+static void run(const char *name, double (*round)(BENCH_GRAPH *), BENCH_GRAPH *graph, int reps, double *rounds) {
+	round(graph); // warm-up: caches, and the heap of the allocator
+	for (int i = 0; i < reps; i++) rounds[i] = round(graph);
+	summarize(name, rounds, reps);
+	printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, results[result_count - 1].min_ns,
+		results[result_count - 1].median_ns, results[result_count - 1].mean_ns, results[result_count - 1].stddev_ns,
+		results[result_count - 1].max_ns);
+	fflush(stdout);
+}
+
+/*
+	Function to compare the medians to the baseline file, a line "name median_ns" per benchmark
+	A benchmark the baseline does not have is only reported
+
+	Returns the number of benchmarks slower than their baseline by more than tolerance percent, -1 on error
+*/
+static int check_baseline(const char *path, double tolerance) {
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		fprintf(stderr, "ERROR: Can't open the baseline '%s', take one on this machine first (make bench-baseline)\n", path);
+		return -1;
+	}
+	char name[64];
+	double baseline_ns;
+	int regressed = 0;
+	printf("\n%-24s %10s %10s %8s\n", "BASELINE", "baseline", "median", "change");
+	while (fscanf(in, "%63s %lf", name, &baseline_ns) == 2) {
+		for (int i = 0; i < result_count; i++) {
+			if (strcmp(results[i].name, name) != 0) continue;
+			double change = (results[i].median_ns - baseline_ns) * 100.0 / baseline_ns;
+			int slower = change > tolerance;
+			printf("%-24s %10.1f %10.1f %+7.1f%%%s\n", name, baseline_ns, results[i].median_ns, change,
+				slower ? "  REGRESSED" : "");
+			regressed += slower;
+		}
+	}
+	fclose(in);
+	return regressed;
+}
+
+static int write_baseline(const char *path) {
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		fprintf(stderr, "ERROR: Can't write the baseline '%s'\n", path);
+		return -1;
+	}
+	for (int i = 0; i < result_count; i++) fprintf(out, "%s %.1f\n", results[i].name, results[i].median_ns);
+	return fclose(out);
+}
+
+int main(int argc, char *argv[]) {
+	int n = DEFAULT_RECIPES, reps = DEFAULT_REPS, opt;
+	double tolerance = DEFAULT_TOLERANCE;
+	const char *check = NULL, *write = NULL;
+
+	while ((opt = getopt(argc, argv, "n:r:c:w:t:")) != -1) {
+		if (opt == 'n' && atoi(optarg) > 0) n = atoi(optarg);
+		else if (opt == 'r' && atoi(optarg) > 0) reps = atoi(optarg);
+		else if (opt == 'c') check = optarg;
+		else if (opt == 'w') write = optarg;
+		else if (opt == 't' && atof(optarg) >= 0) tolerance = atof(optarg);
+		else {
+			fprintf(stderr, "usage: cook_bench [-n recipes] [-r reps] [-c baseline | -w baseline] [-t tolerance_percent]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	BENCH_GRAPH lattice, chain;
+	double *rounds = malloc(reps * sizeof(double));
+	if (rounds == NULL || make_graph(&lattice, n, 1) != 0 || make_graph(&chain, n, 0) != 0) {
+		fprintf(stderr, "ERROR: Failed to generate the benchmark cookbooks\n");
+		return EXIT_FAILURE;
+	}
+	srandom(1); // the same shuffles every run
+
+	printf("%d recipes, %d rounds, ns per operation\n", n, reps);
+	printf("%-24s %10s %10s %10s %10s %10s\n", "BENCHMARK", "min", "median", "mean", "stddev", "max");
+	run("work_queue", round_work_queue, &lattice, reps, rounds);
+	run("dequeue_recipe", round_dequeue_recipe, &lattice, reps, rounds);
+	run("stack", round_stack, &lattice, reps, rounds);
+	run("analysis", round_analysis, &lattice, reps, rounds);
+	run("cycle_check", round_cycle_check, &lattice, reps, rounds);
+	run("cycle_check_chain", round_cycle_check, &chain, reps, rounds);
+	run("update_work_queue", round_update_work_queue, &lattice, reps, rounds);
+	run("parse_cookbook", round_parse, &lattice, reps, rounds);
+
+	int status = EXIT_SUCCESS;
+	if (write != NULL && write_baseline(write) != 0) status = EXIT_FAILURE;
+	if (check != NULL) {
+		int regressed = check_baseline(check, tolerance);
+		if (regressed != 0) {
+			if (regressed > 0) fprintf(stderr, "ERROR: %d benchmarks regressed by more than %.0f%%\n", regressed, tolerance);
+			status = EXIT_FAILURE;
+		}
+	}
+	free(rounds);
+	free_graph(&lattice);
+	free_graph(&chain);
+	return status;
+}
@@ -0,0 +1,133 @@
+/*
+	Benchmark of the pipe throughput between two processes depending on where they run (make bench-pipe)
+	A writer pushes the same amount of data through a pipe to a reader, once for every pairing of cpus
+	the cpu domains of cook --placement make possible on this machine:
+		unpinned       both processes go wherever the scheduler puts them
+		same cpu       both pinned to one cpu (they take turns)
+		same domain    two cpus of one domain (the pipe buffer stays in their shared cache)
+		cross domain   one cpu in each of two domains (every buffer crosses between caches / sockets)
+	A pairing the machine does not have (one cpu, one domain) is reported as skipped
+
+	usage: pipe_throughput [socket|numa|llc] [megabytes] [rounds]
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "cpu_placement.h"
+
+#define CHUNK_SIZE (64 * 1024)
+
+static double now_seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// pins the calling process to one cpu, a negative cpu leaves it unpinned
+static void pin_to(int cpu) {
+	if (cpu >= 0 && pin_to_cpus(&cpu, 1) != 0) perror("sched_setaffinity");
+}
+
+/*
+	Function to time one transfer of total bytes from a writer on writer_cpu to a reader on reader_cpu
+
+	Returns the throughput in MB/s, or -1 if a process could not be started or the data did not arrive
+*/
+static double run_pair(int writer_cpu, int reader_cpu, long total) {
+	int fds[2];
+	if (pipe(fds) == -1) {
+		perror("pipe");
+		return -1;
+	}
+
+	double started = now_seconds();
+	pid_t writer = fork();
+	if (writer == 0) {
+		pin_to(writer_cpu);
+		close(fds[0]);
+		char *chunk = calloc(1, CHUNK_SIZE);
+		for (long sent = 0; chunk != NULL && sent < total; sent += CHUNK_SIZE) {
+			if (write(fds[1], chunk, CHUNK_SIZE) != CHUNK_SIZE) _exit(EXIT_FAILURE);
+		}
+		_exit(chunk != NULL ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	pid_t reader = fork();
+	if (reader == 0) {
+		pin_to(reader_cpu);
+		close(fds[1]);
+		char *chunk = malloc(CHUNK_SIZE);
+		long received = 0;
+		ssize_t n;
+		while (chunk != NULL && (n = read(fds[0], chunk, CHUNK_SIZE)) > 0) received += n;
+		_exit(received == total ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	int ok = writer > 0 && reader > 0;
+	int status;
+	if (writer > 0 && (waitpid(writer, &status, 0) != writer || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) ok = 0;
+	if (reader > 0 && (waitpid(reader, &status, 0) != reader || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) ok = 0;
+	double seconds = now_seconds() - started;
+
+	return ok && seconds > 0 ? total / (1024.0 * 1024.0) / seconds : -1;
+}
+
+// best of rounds transfers (the least disturbed one), printed as one line of the table
+static void bench_pair(const char *name, int writer_cpu, int reader_cpu, long total, int rounds, int available) {
+	if (!available) {
+		printf("%-14s %9s %9s   skipped (not on this machine)\n", name, "-", "-");
+		return;
+	}
+	double best = -1;
+	for (int i = 0; i < rounds; i++) {
+		double mbps = run_pair(writer_cpu, reader_cpu, total);
+		if (mbps > best) best = mbps;
+	}
+	char writer[16] = "any", reader[16] = "any";
+	if (writer_cpu >= 0) snprintf(writer, sizeof(writer), "cpu %d", writer_cpu);
+	if (reader_cpu >= 0) snprintf(reader, sizeof(reader), "cpu %d", reader_cpu);
+	if (best < 0) printf("%-14s %9s %9s   failed\n", name, writer, reader);
+	else printf("%-14s %9s %9s   %10.1f MB/s\n", name, writer, reader, best);
+}
+
+int main(int argc, char **argv) {
+	int mode = argc > 1 ? parse_placement_mode(argv[1]) : PLACEMENT_LLC;
+	long megabytes = argc > 2 ? atol(argv[2]) : 256;
+	int rounds = argc > 3 ? atoi(argv[3]) : 3;
+	if (mode <= PLACEMENT_NONE || megabytes <= 0 || rounds <= 0) {
+		fprintf(stderr, "usage: %s [socket|numa|llc] [megabytes] [rounds]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	CPU_PLACEMENT placement;
+	if (init_cpu_placement(&placement, mode) != 0) return EXIT_FAILURE;
+
+	long total = megabytes * 1024 * 1024 / CHUNK_SIZE * CHUNK_SIZE;
+	printf("pipe throughput, %ld MB per transfer, best of %d, %s domains: %d over %d cpus\n",
+		total / (1024 * 1024), rounds, placement_mode_name(mode), placement.domain_count, placement.cpu_count);
+	for (int d = 0; d < placement.domain_count; d++) {
+		printf("  domain %d:", d);
+		for (int i = 0; i < placement.domains[d].cpu_count; i++) {
+			printf(" %d", placement.domains[d].cpus[i]);
+		}
+		printf("\n");
+	}
+	printf("%-14s %9s %9s   %10s\n", "pairing", "writer", "reader", "throughput");
+
+	CPU_DOMAIN *first = &placement.domains[0];
+	CPU_DOMAIN *second = placement.domain_count > 1 ? &placement.domains[1] : NULL;
+	bench_pair("unpinned", -1, -1, total, rounds, 1);
+	bench_pair("same cpu", first->cpus[0], first->cpus[0], total, rounds, 1);
+	bench_pair("same domain", first->cpus[0], first->cpu_count > 1 ? first->cpus[1] : -1, total, rounds,
+		first->cpu_count > 1);
+	bench_pair("cross domain", first->cpus[0], second != NULL ? second->cpus[0] : -1, total, rounds, second != NULL);
+
+	free_cpu_placement(&placement);
+	return EXIT_SUCCESS;
+}
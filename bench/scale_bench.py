@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""
+End-to-end scaling benchmark of cook (make bench)
+Generates a synthetic cookbook (bench/gen_cookbook.c) for every shape and size, cooks it with every -c
+and keeps what cook --timings reports: parse time, analysis time, the main cook's cpu time per recipe
+(the scheduler overhead, the steps take no time) and its peak RSS, with the wall time of the whole run
+The results are written as JSON; --compare prints every result next to the same one of an older file
+
+usage: scale_bench.py [--shapes fanout,chain,...] [--sizes 1000,10000] [--cooks 1,4,16]
+                      [--width 32] [--seed 1] [--out file.json] [--compare old.json]
+"""
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+BIN = "bin"
+WORK = "tmp/bench"
+METRICS = ["parse_ms", "analysis_ms", "scheduler_cpu_us_per_recipe", "wall_us_per_recipe", "peak_rss_kb"]
+
+
+def generate(shape, size, width, seed):
+    path = os.path.join(WORK, "%s_%d.ckb" % (shape, size))
+    with open(path, "w") as out:
+        subprocess.run([os.path.join(BIN, "gen_cookbook"), shape, str(size), str(width), str(seed)], stdout=out, check=True)
+    return path
+
+
+def cook(path, cooks):
+    timings = os.path.join(WORK, "timings.json")
+    started = time.monotonic()
+    done = subprocess.run([os.path.join(BIN, "cook"), "--timings=" + timings, "-c", str(cooks), "-f", path],
+                          stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    wall_s = time.monotonic() - started
+    if done.returncode != 0:
+        sys.stderr.write("ERROR: cook failed on %s -c %d:\n%s" % (path, cooks, done.stderr.decode(errors="replace")))
+        return None
+    with open(timings) as f:
+        job = json.load(f)["jobs"][0]
+    job["wall_s"] = round(wall_s, 3)
+    return job
+
+
+def compare(results, old):
+    print("%-10s %8s %5s  %-28s %12s %12s %8s" % ("SHAPE", "SIZE", "-c", "METRIC", "OLD", "NEW", "CHANGE"))
+    for r in results:
+        before = old.get((r["shape"], r["size"], r["cooks"]))
+        if before is None:
+            continue
+        for metric in METRICS:
+            a, b = before.get(metric), r.get(metric)
+            if a is None or b is None:
+                continue
+            change = "%+.1f%%" % ((b - a) * 100.0 / a) if a > 0 else "-"
+            print("%-10s %8d %5d  %-28s %12.3f %12.3f %8s" % (r["shape"], r["size"], r["cooks"], metric, a, b, change))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cook scaling benchmark")
+    parser.add_argument("--shapes", default="fanout,chain,lattice,layered,pipeline")
+    parser.add_argument("--sizes", default="1000,10000")
+    parser.add_argument("--cooks", default="1,4,16")
+    parser.add_argument("--width", type=int, default=32)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--out", default=os.path.join(WORK, "scale.json"))
+    parser.add_argument("--compare")
+    args = parser.parse_args()
+
+    os.makedirs(WORK, exist_ok=True)
+    old = None
+    if args.compare:  # read first, the results may be about to replace it
+        with open(args.compare) as f:
+            old = {(r["shape"], r["size"], r["cooks"]): r for r in json.load(f)["results"]}
+    results = []
+    for shape in args.shapes.split(","):
+        # a pipeline of 32 steps per recipe would measure the steps, its chains stay short pipelines
+        width = min(args.width, 4) if shape == "pipeline" else args.width
+        for size in [int(s) for s in args.sizes.split(",")]:
+            path = generate(shape, size, width, args.seed)
+            for cooks in [int(c) for c in args.cooks.split(",")]:
+                job = cook(path, cooks)
+                if job is None:
+                    return 1
+                result = {"shape": shape, "size": size, "width": width, "cooks": cooks}
+                result.update({k: v for k, v in job.items() if k != "cookbook"})
+                results.append(result)
+                print("%-10s %8d recipes -c %-3d parse %9.1fms  analysis %9.1fms  %7.1fus cpu/recipe  %7.1fus wall/recipe  %7dKB"
+                      % (shape, job["recipes"], cooks, job["parse_ms"], job["analysis_ms"],
+                         job["scheduler_cpu_us_per_recipe"], job["wall_us_per_recipe"], job["peak_rss_kb"]))
+                sys.stdout.flush()
+
+    with open(args.out, "w") as f:
+        json.dump({"cpus": os.cpu_count(), "seed": args.seed, "results": results}, f, indent=1)
+        f.write("\n")
+    print("results written to %s" % args.out)
+    if old is not None:
+        compare(results, old)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
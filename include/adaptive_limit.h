@@ -0,0 +1,55 @@
+/*
+	Contains the adaptive cook limit used by cook -c auto
+	Instead of a fixed max_cooks the main processing loop asks for the current limit, which is
+	re-computed every ADAPTIVE_SAMPLE_MS from the online cpus, the load average, MemAvailable
+	and the pressure stall information (PSI) of the kernel, and kept between min and max cooks
+*/
+#ifndef ADAPTIVE_LIMIT_H
+#define ADAPTIVE_LIMIT_H
+
+#define ADAPTIVE_SAMPLE_MS 500          // how often the inputs are sampled while cooks are running
+#define ADAPTIVE_HYSTERESIS 2           // samples in a row that must agree before the limit moves (memory trouble excepted)
+#define ADAPTIVE_MEM_LOW_PERCENT 10     // MemAvailable below this share of MemTotal halves the limit
+#define ADAPTIVE_MEM_PRESSURE 10.0      // memory PSI "some avg10" above this halves the limit
+#define ADAPTIVE_CPU_PRESSURE 40.0      // cpu PSI "some avg10" above this lowers the limit by one cook
+
+// one sample of the system (values that could not be read are 0)
+typedef struct adaptive_inputs {
+	int online_cpus;
+	double load_1min;
+	long mem_available_kb;
+	long mem_total_kb;
+	double cpu_pressure;         // /proc/pressure/cpu some avg10 (percent of time stalled)
+	double mem_pressure;         // /proc/pressure/memory some avg10
+} ADAPTIVE_INPUTS;
+
+// a change of the limit, kept for the run summary
+typedef struct adaptive_change {
+	long at_ms;                  // since the start of the run
+	int limit;
+	const char *reason;
+} ADAPTIVE_CHANGE;
+
+typedef struct adaptive_limit {
+	int min_cooks;
+	int max_cooks;
+	int limit;                   // current limit on active cooks
+	long start_ms;               // monotonic time the run started
+	long last_sample_ms;
+	int raise_votes;             // samples in a row asking for more cooks
+	int lower_votes;             // samples in a row asking for fewer cooks
+	ADAPTIVE_CHANGE *history;
+	int history_count;
+	int history_capacity;
+} ADAPTIVE_LIMIT;
+
+long monotonic_ms(void);
+void read_adaptive_inputs(ADAPTIVE_INPUTS *inputs);
+
+void start_adaptive_limit(ADAPTIVE_LIMIT *adaptive, int min_cooks, int max_cooks, long now_ms);
+int adapt_limit(ADAPTIVE_LIMIT *adaptive, const ADAPTIVE_INPUTS *inputs, int active_cooks, long now_ms);
+int poll_adaptive_limit(ADAPTIVE_LIMIT *adaptive, int active_cooks);
+long adaptive_wait_ms(ADAPTIVE_LIMIT *adaptive);
+void free_adaptive_limit(ADAPTIVE_LIMIT *adaptive);
+
+#endif
@@ -0,0 +1,35 @@
+/*
+	Contains the logging backend of the debug.h macros (make debug)
+	A macro only formats its message into a slot of a ring buffer of the process, nothing is written then;
+	a thread of the process writes the slots to stderr in order with their time, level, file, function and
+	line, and whatever is left when the process exits. Taking a slot is one compare-and-swap, so logging
+	never waits for stderr (or a lock), and a full ring drops the message (the count is written at exit)
+	COOK_LOG_LEVEL=debug|info|success|warn|error|off picks the lowest level written at runtime (debug)
+	A forked child starts a ring and thread of its own on its first message; a child that leaves with
+	_exit() (every cook) writes what it logged only after calling flush_log()
+*/
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#define LOG_RING_SLOTS 1024         // messages waiting to be written (a power of 2)
+#define LOG_MESSAGE_MAX 240         // longest message kept (cut short)
+#define LOG_DRAIN_MS 5              // how often the thread looks at the ring
+
+typedef enum log_level {
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_SUCCESS,
+	LOG_WARN,
+	LOG_ERROR,
+	LOG_OFF
+} LOG_LEVEL;
+
+extern int log_threshold;           // messages below it are not even formatted
+
+void log_message(int level, const char *file, const char *function, int line, const char *format, ...)
+	__attribute__((format(printf, 5, 6)));
+void set_log_level(int level);
+int parse_log_level(const char *name);   // -1 if it is not a level
+void flush_log(void);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+	Contains the layout of a libcook context and the analysis of its main recipes (targets)
+	Only the cook sources include this header, users of the library see COOK_CONTEXT as opaque
+*/
+#ifndef COOK_CONTEXT_H
+#define COOK_CONTEXT_H
+
+#include <sys/types.h>
+
+#include "libcook.h"
+#include "cookbook.h"
+#include "stack_queue_tree_traversal.h"
+#include "token_budget.h"
+#include "adaptive_limit.h"
+#include "resources.h"
+#include "scheduling_policy.h"
+#include "duration_history.h"
+#include "cpu_placement.h"
+#include "priority_class.h"
+#include "trace_events.h"
+#include "resource_usage.h"
+#include "status_page.h"
+#include "latency_histogram.h"
+
+// how long the phases of the last load and run took (cook --timings)
+typedef struct run_timings {
+	double parse_ms;            // cook_load_cookbook(): reading, annotations and parsing
+	double analysis_ms;         // cycle check and analysis of the targets (0 when an earlier run's was reused)
+	double run_ms;              // start of the run until every cook was reaped
+	double cpu_ms;              // user + system time of the main cook during the run: the scheduler's own cost
+	long peak_rss_kb;           // max RSS of the main cook so far
+	long long started_ns;       // latency_now_ns() and cpu time when the run started
+	double cpu_started_ms;
+} RUN_TIMINGS;
+
+// result of the cycle check and analysis phase for a set of targets
+typedef struct cook_analysis {
+	RECIPE **targets;           // targets the analysis was done for (own copy)
+	int target_count;
+	int status;                 // 0 if the targets can be cooked, -1 if one of their trees is broken
+	int recipe_count;           // number of recipes required by the targets together (size of the completed list)
+	RECIPE **required;          // those recipes, each one once
+	RECIPE **leaves;            // leaf recipes that seed the work queue
+	int leaf_count;
+} COOK_ANALYSIS;
+
+// why the main cook killed a cook (it is reaped like any other, but reported differently)
+typedef enum slot_kill {
+	SLOT_RUNNING,
+	SLOT_TIMED_OUT,             // ran past the timeout of its recipe
+	SLOT_LOST_RACE              // a speculative copy of the same recipe finished first (or the other way round)
+} SLOT_KILL;
+
+// one cook process started by the main processing loop
+typedef struct cook_slot {
+	pid_t pid;                  // pid of the cook, 0 if the slot is free
+	RECIPE *recipe;             // recipe the cook is working on
+	long started_ms;            // monotonic_ms() when it was started
+	long started_us;            // trace time when it was started (while tracing)
+	int backup;                 // speculative copy of a recipe another slot is cooking too
+	int domain;                 // cpu domain the cook is pinned to, -1 if it is not pinned
+	SLOT_KILL killed;
+	long long freed_ns;         // latency_now_ns() when its last cook was reaped (--latency), 0 before the first
+} COOK_SLOT;
+
+struct cook_context {
+	COOKBOOK *cookbook;         // parsed cookbook, owned by the context
+	COOK_RESOURCES resources;   // its resource annotations (none for a plain cookbook)
+	char *cookbook_path;        // file it was loaded from (names the job in error messages)
+	RECIPE **targets;           // selected main recipes, cooked together in one run
+	int target_count;
+	int target_capacity;
+
+	COOK_ANALYSIS analysis;     // analysis of the targets, valid when analyzed is set
+	int analyzed;
+
+	// state of the current run
+	WORK_QUEUE *work_queue;
+	RECIPE **completed_recipes;
+	int completed_count;
+	int active_cooks;
+	int active_units;           // cook units taken by the active cooks (one per cook without annotations)
+	int max_cooks;
+	COOK_SLOT *slots;           // max_cooks slots
+	int started_count;          // cooks started by this run (breaks ties between jobs of a pool)
+	int failed;                 // the run is abandoned (or ended without its targets), nothing new is started
+	int failed_count;           // recipes whose cook failed during the run
+	int keep_going;             // a failed recipe only stops its dependents instead of the whole run
+
+	long timeout_ms;            // cooks of recipes without a timeout of their own are killed after this long (0: never)
+	int speculate;              // stragglers of idempotent recipes get a backup copy while cooks are free
+	int group_cooks;            // every cook leads its own process group (set per run when there is something to kill)
+	int timed_out_count;        // recipes of the run that failed by their timeout
+	int backup_count;           // speculative copies started by the run
+	int backup_wins;            // of those, the ones that finished before the original
+
+	int retries;                // failed recipes without retries of their own are cooked again up to this many times
+	long retry_backoff_ms;      // wait before the first retry, doubled for every next one (RETRY_BACKOFF_MS if 0)
+	RECIPE **retrying;          // failed recipes waiting for their retry_at_ms, room for every required recipe
+	int retrying_count;
+	int retry_count;            // retries started by the run
+
+	const SCHEDULING_POLICY *policy;  // ranks the ready recipes of a run, NULL is fifo
+	DURATION_HISTORY history;   // how long the recipes and tasks of the cookbook took before
+	int show_eta;               // print the estimated time left whenever a recipe completes
+
+	long mem_floor_kb;          // no cook starts while less memory is available, unless none is running (0: off)
+	long mem_available_kb;      // last MemAvailable read (of the first context of a pool, which keeps the floor)
+	long mem_sampled_ms;        // when it was read, 0 for not yet
+	int throttled_count;        // recipes of the run held back by the memory floor
+
+	int critical_boost;         // the critical path of the targets gets the critical class (also with classes given)
+	int critical_count;         // recipes on it in the current run
+
+	TRACE_LOG own_trace;        // trace file opened by this context (cook_set_trace)
+	TRACE_LOG *trace;           // trace the runs are written to (own_trace or the one of another context), NULL: none
+	int trace_track;            // track of slot 0 of the current run, the other slots follow it
+
+	CPU_PLACEMENT placement;    // cpu domains the cooks are pinned to (mode PLACEMENT_NONE: not pinned)
+
+	RUN_USAGE usage;            // resource usage of the recipes of the last run (and its tasks and steps, cook_set_usage)
+	STATUS_PAGE status;         // live status page of the runs for cook-top (no path: none)
+	RUN_TIMINGS timings;        // phase timings of the last load and run
+	SCHEDULER_LATENCIES latency;  // scheduler latencies of the last run (enabled: cook_set_latency)
+
+	int weight;                 // share of a pool of cooks shared with other contexts (0 counts as 1)
+
+	int auto_min_cooks;         // > 0: the cook limit adapts to the system between this and max_cooks (-c auto)
+	ADAPTIVE_LIMIT adaptive;    // its state, kept after the run for the summary
+
+	TOKEN_BUDGET *budget;       // budget shared with other processes (cook daemon, jobserver), NULL otherwise
+	TOKEN_BUDGET jobserver;     // jobserver created or joined by this context (budget points at it)
+
+	cook_progress_callback progress;
+	void *progress_data;
+	cook_completion_callback completion;
+	void *completion_data;
+};
+
+int analyze_targets(COOKBOOK *cookbook, RECIPE **targets, int target_count, COOK_ANALYSIS *analysis);
+void free_analysis(COOK_ANALYSIS *analysis);
+
+void report_progress(COOK_CONTEXT *ctx, RECIPE *recipe, COOK_EVENT event, pid_t pid);
+
+#endif
@@ -0,0 +1,16 @@
+/*
+	Contains the cook daemon (cook -D) and its client (cook -S)
+	The daemon keeps a parsed cookbook and the analysis of each requested recipe in memory
+	and cooks recipes on request, streaming progress back over a Unix domain socket
+*/
+#ifndef COOK_DAEMON_H
+#define COOK_DAEMON_H
+
+#include "libcook.h"
+
+#define COOK_REQUEST_MAX 1024  // longest request line accepted by the daemon
+
+int run_cook_daemon(COOK_CONTEXT *ctx, const char *socket_path, int max_cooks);
+int send_cook_request(const char *socket_path, const char *recipe_name, int max_cooks);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+	Contains the placement of cooks on the cpus of the machine (cook --placement socket|numa|llc)
+	The cpus cook may run on are split into domains (one per socket, NUMA node or shared L3 cache) and every
+	cook is pinned to one domain with sched_setaffinity before it runs its tasks, so the processes of its
+	pipelines (which inherit the affinity) exchange their data through one cache instead of across sockets
+	A recipe is placed in the domain where most of its sub-recipes were cooked, as long as that domain has
+	a cpu to spare, and in the least loaded domain otherwise
+*/
+#ifndef CPU_PLACEMENT_H
+#define CPU_PLACEMENT_H
+
+#include "cookbook.h"
+
+typedef enum placement_mode {
+	PLACEMENT_NONE,             // cooks float over every cpu (default)
+	PLACEMENT_SOCKET,           // one domain per physical package
+	PLACEMENT_NUMA,             // one domain per NUMA node
+	PLACEMENT_LLC               // one domain per shared last level (L3) cache
+} PLACEMENT_MODE;
+
+typedef struct cpu_domain {
+	int *cpus;
+	int cpu_count;
+	int active;                 // cooks running in the domain
+} CPU_DOMAIN;
+
+typedef struct cpu_placement {
+	PLACEMENT_MODE mode;
+	CPU_DOMAIN *domains;        // NULL until the topology has been read
+	int domain_count;
+	int cpu_count;
+	int placed;                 // recipes placed by the run
+	int placed_near;            // of those, placed in the domain of their sub-recipes
+} CPU_PLACEMENT;
+
+int parse_placement_mode(const char *name);
+const char *placement_mode_name(PLACEMENT_MODE mode);
+
+int init_cpu_placement(CPU_PLACEMENT *placement, PLACEMENT_MODE mode);
+void free_cpu_placement(CPU_PLACEMENT *placement);
+
+int place_recipe(CPU_PLACEMENT *placement, RECIPE *recipe);       // in the main cook, returns the domain
+void unplace_recipe(CPU_PLACEMENT *placement, int domain);        // its cook is gone
+int pin_to_domain(CPU_PLACEMENT *placement, int domain);          // in the cook
+int pin_to_cpus(const int *cpus, int cpu_count);
+
+#endif
@@ -27,6 +27,16 @@
 #define KBWN ""
 #endif
 
+/*
+ * The macros below only put their message into the ring buffer of the process,
+ * a thread writes it to stderr with its time (see async_log.h), and
+ * COOK_LOG_LEVEL picks the lowest level written at runtime
+ */
+#if defined(DEBUG) || defined(INFO) || defined(WARN) || defined(SUCCESS) ||    \
+    defined(ERROR) || defined(VERBOSE)
+#include "async_log.h"
+#endif
+
 #ifdef VERBOSE
 #define DEBUG
 #define INFO
@@ -38,8 +48,9 @@
 #ifdef DEBUG
 #define debug(S, ...)                                                          \
   do {                                                                         \
-    fprintf(stderr, KMAG "DEBUG: %s:%s:%d " KNRM S NL, __FILE__,               \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (LOG_DEBUG >= log_threshold)                                            \
+      log_message(LOG_DEBUG, __FILE__, __extension__ __FUNCTION__, __LINE__,   \
+                  S, ##__VA_ARGS__);                                           \
   } while (0)
 #else
 #define debug(S, ...)
@@ -48,8 +59,9 @@
 #ifdef INFO
 #define info(S, ...)                                                           \
   do {                                                                         \
-    fprintf(stderr, KBLU "INFO: %s:%s:%d " KNRM S NL, __FILE__,                \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (LOG_INFO >= log_threshold)                                             \
+      log_message(LOG_INFO, __FILE__, __extension__ __FUNCTION__, __LINE__,    \
+                  S, ##__VA_ARGS__);                                           \
   } while (0)
 #else
 #define info(S, ...)
@@ -58,8 +70,9 @@
 #ifdef WARN
 #define warn(S, ...)                                                           \
   do {                                                                         \
-    fprintf(stderr, KYEL "WARN: %s:%s:%d " KNRM S NL, __FILE__,                \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (LOG_WARN >= log_threshold)                                             \
+      log_message(LOG_WARN, __FILE__, __extension__ __FUNCTION__, __LINE__,    \
+                  S, ##__VA_ARGS__);                                           \
   } while (0)
 #else
 #define warn(S, ...)
@@ -68,8 +81,9 @@
 #ifdef SUCCESS
 #define success(S, ...)                                                        \
   do {                                                                         \
-    fprintf(stderr, KGRN "SUCCESS: %s:%s:%d " KNRM S NL, __FILE__,             \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (LOG_SUCCESS >= log_threshold)                                          \
+      log_message(LOG_SUCCESS, __FILE__, __extension__ __FUNCTION__, __LINE__, \
+                  S, ##__VA_ARGS__);                                           \
   } while (0)
 #else
 #define success(S, ...)
@@ -78,8 +92,9 @@
 #ifdef ERROR
 #define error(S, ...)                                                          \
   do {                                                                         \
-    fprintf(stderr, KRED "ERROR: %s:%s:%d " KNRM S NL, __FILE__,               \
-            __extension__ __FUNCTION__, __LINE__, ##__VA_ARGS__);                \
+    if (LOG_ERROR >= log_threshold)                                            \
+      log_message(LOG_ERROR, __FILE__, __extension__ __FUNCTION__, __LINE__,   \
+                  S, ##__VA_ARGS__);                                           \
   } while (0)
 #else
 #define error(S, ...)
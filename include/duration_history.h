@@ -0,0 +1,74 @@
+/*
+	Contains the duration history: how long every recipe and task of a cookbook took when it was cooked
+	Each duration is kept as an exponentially weighted moving average with its variance, in memory for the
+	runs of a context and, when a history file is given (cook --history file), on disk between runs
+	The estimates feed the time based scheduling policies and the ETA (cook --eta)
+	The samples of a run are also kept on their own until the file is written, so a save folds them into
+	what the file has then (another cook sharing the file may have added its own since it was read)
+
+	History file: one line per recipe or task, the task is "-" for the recipe itself
+		cookbook <TAB> recipe <TAB> task <TAB> samples <TAB> mean_ms <TAB> variance_ms2
+*/
+#ifndef DURATION_HISTORY_H
+#define DURATION_HISTORY_H
+
+#include <stdio.h>
+
+#include "cookbook.h"
+
+#define HISTORY_ALPHA 0.3           // weight of a new sample in the moving average
+#define HISTORY_LINE_MAX 4096       // longest history file line read back
+
+// moving average of the durations of one recipe or task
+typedef struct duration_stat {
+	long samples;                   // 0: never cooked
+	double mean_ms;
+	double var_ms;                  // variance, in ms squared
+} DURATION_STAT;
+
+// duration of one task, sent by a cook to the main cook over the report pipe (small enough to be atomic)
+typedef struct task_report {
+	int recipe;                     // position of the recipe in the cookbook
+	int task;                       // position of the task in the recipe
+	long duration_ms;
+} TASK_REPORT;
+
+// a duration added since the history file was read
+typedef struct new_sample {
+	int recipe;
+	int task;                       // -1 for the recipe itself
+	long duration_ms;
+} NEW_SAMPLE;
+
+typedef struct duration_history {
+	char *path;                     // history file, NULL keeps the history in memory only
+	char *cookbook_key;             // the cookbook in the history file (its real path)
+	int recipe_count;
+	DURATION_STAT *recipes;         // by position of the recipe in the cookbook
+	DURATION_STAT **tasks;          // tasks[recipe][task]
+	int *task_counts;
+	int dirty;                      // samples were added since the file was read
+	NEW_SAMPLE *new_samples;        // those samples in the order they were added (only with a history file)
+	int new_count;
+	int new_capacity;
+	int report_read_fd;             // task report pipe of the current run (-1 outside a run)
+	int report_write_fd;
+} DURATION_HISTORY;
+
+void init_duration_history(DURATION_HISTORY *history);
+int start_duration_history(DURATION_HISTORY *history, COOKBOOK *cookbook, const char *cookbook_path);
+void clear_duration_history(DURATION_HISTORY *history);   // forgets the cookbook, keeps the path
+
+int load_duration_history(DURATION_HISTORY *history, COOKBOOK *cookbook);
+int save_duration_history(DURATION_HISTORY *history, COOKBOOK *cookbook);
+
+int has_durations(DURATION_HISTORY *history);
+void add_duration_sample(DURATION_STAT *stat, double duration_ms);
+void add_recipe_duration(DURATION_HISTORY *history, int recipe, long duration_ms);
+
+int open_task_reports(DURATION_HISTORY *history);
+void close_task_reports(DURATION_HISTORY *history);
+void send_task_report(DURATION_HISTORY *history, int recipe, int task, long duration_ms);   // in a cook
+void read_task_reports(DURATION_HISTORY *history);   // in the main cook
+
+#endif
@@ -0,0 +1,44 @@
+/*
+	Contains the latency histograms of the scheduler (cook --latency)
+	Three delays of the main cook are timed on the monotonic clock, for every recipe of a run:
+		sigchld to reap        the SIGCHLD handler ran until the cook was reaped
+		reap to queue updated  the cook was reaped until update_work_queue() released its dependents
+		ready to fork          the recipe went into the work queue until its cook was forked
+	They are kept in HDR-style histograms: exact below 32ns, then 32 buckets per power of two (about 3%
+	precision at any size) in a fixed array, so recording is a few instructions and never allocates
+*/
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdio.h>
+
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_SLOTS ((64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT)
+
+typedef struct latency_histogram {
+	long long count;
+	long long max_ns;
+	long long counts[HISTOGRAM_SLOTS];
+} LATENCY_HISTOGRAM;
+
+typedef enum scheduler_latency {
+	LATENCY_SIGCHLD_TO_REAP,
+	LATENCY_REAP_TO_QUEUE,
+	LATENCY_READY_TO_FORK,
+	LATENCY_COUNT
+} SCHEDULER_LATENCY;
+
+typedef struct scheduler_latencies {
+	int enabled;
+	LATENCY_HISTOGRAM histograms[LATENCY_COUNT];
+} SCHEDULER_LATENCIES;
+
+long long latency_now_ns(void);   // async-signal-safe (the SIGCHLD handler uses it)
+
+void reset_latencies(SCHEDULER_LATENCIES *latencies);
+void record_latency(SCHEDULER_LATENCIES *latencies, int which, long long ns);
+long long latency_percentile(LATENCY_HISTOGRAM *histogram, double percentile);
+void print_latencies(SCHEDULER_LATENCIES *latencies, const char *label, FILE *out);
+
+#endif
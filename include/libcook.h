@@ -0,0 +1,219 @@
+/*
+	libcook: the cook scheduler as an embeddable library
+	A COOK_CONTEXT holds a parsed cookbook, the selected main recipes and all of the state of a run,
+	so a program can load a cookbook once and cook from it as many times as it likes without
+	paying for process startup and re-parsing.  Contexts share no state with each other.
+
+	Typical use:
+
+		COOK_CONTEXT *ctx = cook_context_new();
+		cook_load_cookbook(ctx, "cookbook.ckb");
+		cook_select_target(ctx, "eggs_benedict");
+		cook_add_target(ctx, "pancakes");         // optional: more targets cooked in the same run
+		cook_set_progress_callback(ctx, on_progress, my_data);
+		if (cook_run(ctx, 4) != COOK_SUCCESS) ...
+		cook_context_free(ctx);
+
+	cook_run() forks one cook process per recipe and reaps only its own cooks.  For the duration
+	of the call it installs its own SIGCHLD handler and blocks SIGCHLD outside of its waits;
+	the caller's handler and signal mask are restored before it returns, so runs must not be
+	started concurrently from several threads of one process.
+*/
+#ifndef LIBCOOK_H
+#define LIBCOOK_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COOK_SUCCESS 0
+#define COOK_FAILURE -1
+
+typedef struct cook_context COOK_CONTEXT;
+
+// events passed to the progress callback
+typedef enum cook_event {
+	COOK_RECIPE_STARTED,     // a cook process was started for the recipe
+	COOK_RECIPE_COMPLETED,   // all of the recipe's tasks completed successfully
+	COOK_RECIPE_FAILED       // a task of the recipe failed, the run will not complete
+} COOK_EVENT;
+
+/*
+	Called in the calling process (never in a cook) each time a recipe changes state
+	pid is the cook process of the recipe, completed and total count the recipes of the run
+*/
+typedef void (*cook_progress_callback)(COOK_CONTEXT *ctx, const char *recipe_name, COOK_EVENT event,
+	int pid, int completed, int total, void *user_data);
+
+// Called once at the end of every cook_run() with the value cook_run() is about to return
+typedef void (*cook_completion_callback)(COOK_CONTEXT *ctx, int status, void *user_data);
+
+COOK_CONTEXT *cook_context_new(void);
+void cook_context_free(COOK_CONTEXT *ctx);
+
+int cook_load_cookbook(COOK_CONTEXT *ctx, const char *path);
+int cook_select_target(COOK_CONTEXT *ctx, const char *recipe_name);
+int cook_add_target(COOK_CONTEXT *ctx, const char *recipe_name);
+
+void cook_set_progress_callback(COOK_CONTEXT *ctx, cook_progress_callback callback, void *user_data);
+void cook_set_completion_callback(COOK_CONTEXT *ctx, cook_completion_callback callback, void *user_data);
+
+int cook_run(COOK_CONTEXT *ctx, int max_cooks);
+
+/*
+	Scheduling policy of the ready recipes: fifo (default), critical-path, critical-path-time,
+	most-dependents or sjf.  The time based policies use how long each recipe took in the earlier runs
+	of the context (before the first run they go by the number of steps of each recipe)
+
+	Returns COOK_FAILURE if there is no policy with that name
+*/
+int cook_set_policy(COOK_CONTEXT *ctx, const char *policy_name);
+
+/*
+	Duration history: every run records how long each recipe and task took, as a moving average that the
+	time based policies and the ETA use.  cook_set_history() keeps it in a file between runs (and between
+	programs, the file can hold any number of cookbooks), NULL keeps it in memory only
+	cook_set_eta() prints the estimated time left to stderr whenever a recipe completes, and
+	cook_estimate_remaining_ms() returns it (-1 outside a run, e.g. from the progress callback it is valid)
+*/
+int cook_set_history(COOK_CONTEXT *ctx, const char *path);
+void cook_set_eta(COOK_CONTEXT *ctx, int show_eta);
+long cook_estimate_remaining_ms(COOK_CONTEXT *ctx);
+
+/*
+	Timeouts: a cook still running timeout_ms after it was started is killed together with its steps and its
+	recipe fails (0 turns it off).  A "#@ recipe: timeout=..." annotation overrides it for one recipe
+	Speculation: a cook of a recipe annotated idempotent that runs far past its duration history gets a
+	second cook for the same recipe while cooks are free; the first one to finish wins, the other is killed
+*/
+void cook_set_timeout(COOK_CONTEXT *ctx, long timeout_ms);
+void cook_set_speculation(COOK_CONTEXT *ctx, int speculate);
+
+/*
+	Retries: a failed recipe is cooked again up to retries times, after backoff_ms (RETRY_BACKOFF_MS if 0)
+	and twice as long before every next retry; its dependents only go ahead once a retry succeeds
+	A "#@ recipe: retries=N backoff=..." annotation overrides it for one recipe
+*/
+void cook_set_retries(COOK_CONTEXT *ctx, int retries, long backoff_ms);
+
+/*
+	Trace: the recipes, tasks and steps of every run are written to path as Chrome trace events (JSON for
+	Perfetto or chrome://tracing), one track per cook slot. The file is complete once the context is freed
+	Contexts sharing a pool of cooks can share the trace of one of them
+*/
+int cook_set_trace(COOK_CONTEXT *ctx, const char *path);
+void cook_share_trace(COOK_CONTEXT *ctx, COOK_CONTEXT *owner);
+
+/*
+	Memory-aware admission: while less than mem_floor_kb of memory is available (MemAvailable) no new cook
+	is started, unless no cook is running at all; 0 turns it off. With a pool of contexts the floor of the
+	first one counts. The recipes held back are listed in the summary
+	Per recipe caps are "#@ recipe: rlimit_as=2G rlimit_cpu=10m rlimit_nofile=256 rlimit_nproc=64"
+*/
+void cook_set_mem_floor(COOK_CONTEXT *ctx, long mem_floor_kb);
+
+/*
+	Priority classes: the cooks of the recipes on the critical path of the targets (and their steps) get the
+	nice value and I/O priority of the critical class, recipes annotated with "#@ recipe: class=..." get theirs
+	Always on once the cookbook gives any recipe a class
+*/
+void cook_set_critical_boost(COOK_CONTEXT *ctx, int critical_boost);
+
+/*
+	Placement: "socket", "numa" or "llc" pins every cook (and so its steps) to the cpus of one socket,
+	NUMA node or shared L3 cache, preferably the one the cooks of its sub-recipes ran in; "none" stops it
+	The topology is read here, returns COOK_FAILURE for an unknown placement
+*/
+int cook_set_placement(COOK_CONTEXT *ctx, const char *mode_name);
+
+/*
+	Keep going mode: when a recipe fails only the recipes depending on it (directly or not) are skipped,
+	everything else is still cooked.  The run still returns COOK_FAILURE if a recipe failed
+*/
+void cook_set_keep_going(COOK_CONTEXT *ctx, int keep_going);
+
+/*
+	Adaptive cook limit: instead of always allowing max_cooks cooks, the runs of the context follow the
+	cpus, load average and memory of the system, never going below min_cooks or above max_cooks
+	min_cooks 0 turns it off again.  A pool (cook_run_pool) follows the setting of its first context
+*/
+void cook_set_auto_cooks(COOK_CONTEXT *ctx, int min_cooks);
+
+/*
+	GNU make jobserver: cook_create_jobserver() makes the budget of the context a jobserver for max_cooks jobs
+	(a pipe, or a FIFO with use_fifo) and advertises it to the steps in MAKEFLAGS, so the makes and
+	compilers the steps start borrow their jobs from the same max_cooks.  cook_join_jobserver() takes the
+	cooks out of the jobserver named in MAKEFLAGS instead (when cook runs under make) and returns
+	COOK_FAILURE if there is none.  cook_share_jobserver() lets ctx use the jobserver of owner
+	(the contexts of a pool must all use the same one)
+*/
+int cook_create_jobserver(COOK_CONTEXT *ctx, int max_cooks, int use_fifo);
+int cook_join_jobserver(COOK_CONTEXT *ctx);
+void cook_share_jobserver(COOK_CONTEXT *ctx, COOK_CONTEXT *owner);
+
+// Prints the completed, failed and skipped recipes of the last run of the context (and the cook limits it chose)
+void cook_print_summary(COOK_CONTEXT *ctx, FILE *out);
+
+// Returns 1 if the last run of the context did something the summary has to report even when it was not asked
+// for (a recipe timed out or was retried by its annotation, or waited for memory), 0 otherwise
+int cook_summary_pending(COOK_CONTEXT *ctx);
+
+/*
+	Usage: every cook is reaped with its resource usage (cpu time, max RSS, context switches, block I/O), so
+	it is kept for every recipe of the last run; with cook_set_usage() the cooks also report it for every task
+	and step. cook_print_usage() prints it with how the cook slots were used (busy, idle while a recipe was
+	ready, idle), cook_write_usage_json() writes the same as one JSON object
+*/
+void cook_set_usage(COOK_CONTEXT *ctx, int steps);
+
+/*
+	Perf counters: every cook counts the cycles, instructions, cache misses and branch misses of its recipe
+	(and the task clock and page faults) with perf_event_open(), they are part of the usage of the recipe
+	Counters the machine does not have are left out: without a PMU only the software ones are counted
+*/
+void cook_set_perf_counters(COOK_CONTEXT *ctx, int counters);
+
+/*
+	Status page: every run keeps its progress (queue depth, active cooks, what each cook is cooking, recipe
+	timings) in a file at path mapped shared, /dev/shm/cook.<pid> for a NULL path, for cook-top to read
+	without disturbing the run. The file is removed when the context is freed
+*/
+int cook_set_status_page(COOK_CONTEXT *ctx, const char *path);
+
+/*
+	Timings: how long parsing the cookbook, analysing the targets and the run took, with the cpu time and max
+	RSS of the main cook, printed by cook_print_timings() or written as one JSON object (kept for every run)
+*/
+void cook_print_timings(COOK_CONTEXT *ctx, FILE *out);
+void cook_write_timings_json(COOK_CONTEXT *ctx, FILE *out);
+
+/*
+	Latency: the scheduler times itself on the monotonic clock, from SIGCHLD to the reap of the cook, from the
+	reap to update_work_queue() done and from a recipe going into the work queue to its fork, for every recipe
+	cook_print_latency() prints p50, p99 and max of each for the last run (they are kept in histograms)
+	The steps of a recipe get COOK_READY_NS in their environment: the latency_now_ns() (CLOCK_MONOTONIC) at
+	which the recipe was ready and a cook slot of the context was free, so a step can time its own dispatch
+*/
+void cook_set_latency(COOK_CONTEXT *ctx, int enabled);
+void cook_print_latency(COOK_CONTEXT *ctx, FILE *out);
+void cook_print_usage(COOK_CONTEXT *ctx, FILE *out);
+void cook_write_usage_json(COOK_CONTEXT *ctx, FILE *out);
+
+/*
+	Cooks the targets of several contexts on one pool of max_cooks cooks
+	While more than one context has a recipe ready, the cooks are shared in proportion to the weights
+	Each context is its own failure domain: a failed recipe only stops the context it belongs to,
+	and every context gets its own completion callback
+
+	Returns COOK_SUCCESS if every context completed its targets, COOK_FAILURE otherwise
+*/
+int cook_set_weight(COOK_CONTEXT *ctx, int weight);
+int cook_run_pool(COOK_CONTEXT **ctxs, int count, int max_cooks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
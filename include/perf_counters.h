@@ -0,0 +1,43 @@
+/*
+	Contains the hardware performance counters of a cook (cook --perf)
+	Every cook opens the counters with perf_event_open() before its first task, with inherit set, so the
+	counts include every step it waits for; it reads them when its recipe is done and sends them to the
+	main cook with the usage of its steps (see resource_usage.h)
+	Cycles, instructions and cache and branch misses tell an instruction bound recipe from one stalling on
+	memory; where the machine has no PMU (a VM, a container) or perf_event_paranoid forbids them, only the
+	software counters (task clock, page faults) are counted, and if even those can't be opened nothing is
+*/
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+typedef enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_TASK_CLOCK,                // software, ns
+	PERF_PAGE_FAULTS,               // software
+	PERF_COUNTER_COUNT
+} PERF_COUNTER;
+
+#define PERF_HARDWARE ((1 << PERF_TASK_CLOCK) - 1)  // mask of the hardware counters
+
+// counts of one or more cooks, scaled up when the kernel had to multiplex the counters
+typedef struct perf_counts {
+	long long values[PERF_COUNTER_COUNT];
+	int counted;                    // mask of the counters the values are valid for
+} PERF_COUNTS;
+
+// counters open in a cook
+typedef struct perf_set {
+	int fds[PERF_COUNTER_COUNT];    // -1 for a counter not open
+} PERF_SET;
+
+const char *perf_counter_name(int counter);
+
+int probe_perf_counters(int *error);   // returns the mask of the counters that can be opened
+void open_perf_counters(PERF_SET *set, int available);
+void close_perf_counters(PERF_SET *set, PERF_COUNTS *counts);
+void add_perf_counts(PERF_COUNTS *counts, PERF_COUNTS *other);
+
+#endif
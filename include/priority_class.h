@@ -0,0 +1,27 @@
+/*
+	Contains the priority classes of recipes (#@ recipe: class=background)
+	A class is a nice value and an I/O priority (ioprio_set) the cook takes before it runs its tasks,
+	its steps inherit both, so bulk downloads and compression stay out of the way of the recipes the
+	targets are waiting on. The recipes on the critical path of the targets are raised to critical
+	(cook --critical-boost, and always once a cookbook gives any recipe a class)
+*/
+#ifndef PRIORITY_CLASS_H
+#define PRIORITY_CLASS_H
+
+typedef enum priority_class {
+	PRIORITY_INHERIT,           // no class: the cook runs like the main cook
+	PRIORITY_IDLE,              // only gets the cpu and the disk when nothing else wants them
+	PRIORITY_BACKGROUND,
+	PRIORITY_NORMAL,
+	PRIORITY_CRITICAL           // raising the nice value needs CAP_SYS_NICE (or RLIMIT_NICE), the I/O priority not
+} PRIORITY_CLASS;
+
+#define PRIORITY_CLASS_COUNT 5
+
+int parse_priority_class(const char *name);
+const char *priority_class_name(PRIORITY_CLASS priority_class);
+
+int apply_priority_class(PRIORITY_CLASS priority_class);   // in the cook
+int can_raise_priority(void);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+	Contains the resource usage of a run (cook --usage, cook --usage-json file)
+	Every process is reaped with wait4(), so the cpu time, max RSS, context switches and block I/O of every
+	step, task and recipe are added up instead of thrown away: the main cook gets each recipe's from its cook
+	(which includes the steps the cook waited for), the cooks send the usage of each step over a pipe
+	With perf counters (cook --perf) every cook also sends the counters of its recipe over that pipe
+	A cook never waits for room in the pipe (the main cook only reads it when it reaps a cook), a report that
+	does not fit is counted as lost instead, so a report with missing steps says so
+	The run also keeps how its cook slots were used: busy, idle while a recipe was ready (held back by the
+	limit, its resources or the memory floor), and idle with nothing to do
+*/
+#ifndef RESOURCE_USAGE_H
+#define RESOURCE_USAGE_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "cookbook.h"
+#include "perf_counters.h"
+
+// resource usage of one or more processes
+typedef struct usage {
+	long processes;
+	long user_us;
+	long sys_us;
+	long max_rss_kb;                // largest of the processes, not a sum
+	long voluntary_switches;
+	long involuntary_switches;
+	long in_blocks;
+	long out_blocks;
+} USAGE;
+
+// usage of one step of one task, sent by a cook to the main cook (small enough for one atomic write)
+typedef struct usage_report {
+	int recipe;                     // position of the recipe in the cookbook
+	int task;
+	int step;                       // -1: the perf counters of the cook instead
+	USAGE usage;
+	PERF_COUNTS counters;
+} USAGE_REPORT;
+
+typedef struct recipe_usage {
+	USAGE total;                    // every cook of the recipe (retries and backups too) and its steps
+	PERF_COUNTS counters;           // the same for the perf counters (--perf)
+	int task_count;
+	USAGE *tasks;
+	int *step_counts;
+	USAGE **steps;                  // steps[task][step]
+} RECIPE_USAGE;
+
+typedef struct run_usage {
+	int steps;                      // the cooks report the usage of every step (--usage, --usage-json)
+	int counters;                   // the cooks count perf events (--perf)
+	int counters_available;         // mask of the perf counters that could be opened by the last run
+	int counters_error;             // errno of the first hardware counter that could not be
+	int recipe_count;
+	RECIPE_USAGE *recipes;          // by position of the recipe in the cookbook, NULL before the first run
+	int report_read_fd;             // usage report pipe of the current run (-1 outside a run, or without steps)
+	int report_write_fd;
+	long *lost_shared;              // reports the cooks could not send, counted by them during a run (shared memory)
+	long lost_reports;              // how many the last run lost
+
+	// cook slots of the last run
+	int slots;
+	long started_ms;
+	long ended_ms;
+	long clock_ms;                  // last time the slots were accounted for
+	int free_slots;                 // how they were left then
+	int work_ready;
+	long busy_ms;                   // slot time the cooks of the run took
+	long idle_ready_ms;             // slot time a cook was free while a recipe of the run was ready
+} RUN_USAGE;
+
+void init_run_usage(RUN_USAGE *usage);
+int start_run_usage(RUN_USAGE *usage, COOKBOOK *cookbook, int slots, long now_ms);   // every run
+void clear_run_usage(RUN_USAGE *usage);
+
+void add_rusage(USAGE *usage, struct rusage *rusage);
+void add_usage(USAGE *usage, USAGE *other);
+
+int open_usage_reports(RUN_USAGE *usage);
+void close_usage_reports(RUN_USAGE *usage);
+void send_usage_report(RUN_USAGE *usage, int recipe, int task, int step, struct rusage *rusage);   // in a cook
+void send_counter_report(RUN_USAGE *usage, int recipe, PERF_COUNTS *counts);   // in a cook
+void read_usage_reports(RUN_USAGE *usage);   // in the main cook
+
+void account_slots(RUN_USAGE *usage, int free_slots, int work_ready, long now_ms);
+
+void print_run_usage(RUN_USAGE *usage, COOKBOOK *cookbook, const char *label, FILE *out);
+void write_run_usage_json(RUN_USAGE *usage, COOKBOOK *cookbook, const char *label, FILE *out);
+
+#endif
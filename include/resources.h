@@ -0,0 +1,79 @@
+/*
+	Contains the resource annotations of a cookbook and the admission of recipes against them
+	A cookbook line of the form
+
+		#@ recipe_name: cpu=4 mem=8G pool=store:2
+
+	says the recipe needs 4 of the max_cooks cook units, 8G of the memory of the machine and one of the
+	2 places of the named pool "store" while its cook runs.  Two more keys are about how the cook runs:
+	timeout=10m kills the cook (and its steps) after 10 minutes, and idempotent says the recipe can be
+	cooked twice at once, so a straggler may get a speculative copy (cook --speculate).  retries=3 cooks a
+	failed recipe again up to 3 times, waiting backoff=2s (1s if not given) before the first retry and twice
+	as long before each next one.  class=background (idle, background, normal or critical) sets the
+	nice value and I/O priority of the cook and its steps (see priority_class.h).  rlimit_as=2G,
+	rlimit_cpu=10m, rlimit_nofile=256 and rlimit_nproc=64 are setrlimit caps the cook puts on itself before
+	its first task, so every step inherits them (RLIMIT_CPU counts per process, RLIMIT_NPROC per user).
+	The keys of a recipe can be spread over several lines, a key given twice keeps its last value.
+	Annotation lines are taken out of the cookbook before it is parsed, so a cookbook without them is
+	parsed (and cooked) exactly as before: a recipe without an annotation costs one cook unit and nothing else
+*/
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <stdio.h>
+
+#include "cookbook.h"
+
+#define RESOURCE_DIRECTIVE "#@"
+
+// a named semaphore shared by the recipes annotated with pool=name:limit
+typedef struct resource_pool {
+	char *name;
+	int limit;
+	int in_use;
+} RESOURCE_POOL;
+
+typedef struct resource_annotation {
+	char *recipe_name;
+	RECIPE *recipe;          // resolved once the cookbook is parsed
+	int cpu;                 // cook units (1 if not given)
+	long mem_kb;             // memory (0 if not given)
+	int pool;                // index in the pools, -1 if none
+	long timeout_ms;         // 0 if not given
+	int idempotent;
+	int retries;             // 0 if not given
+	long retry_backoff_ms;   // 0 if not given
+	int priority_class;      // PRIORITY_INHERIT if not given
+	long rlimit_as_kb;       // setrlimit caps, 0 if not given
+	long rlimit_cpu_s;
+	long rlimit_nofile;
+	long rlimit_nproc;
+} RESOURCE_ANNOTATION;
+
+typedef struct cook_resources {
+	RESOURCE_ANNOTATION *annotations;
+	int annotation_count;
+	RESOURCE_POOL *pools;
+	int pool_count;
+	int classes_given;       // some recipe has a priority class (so the critical path is raised too)
+	long mem_capacity_kb;    // MemTotal of the machine
+	long mem_in_use_kb;
+} COOK_RESOURCES;
+
+long parse_duration_ms(const char *value);
+long parse_mem_kb(const char *value);
+long read_mem_available_kb(void);
+
+FILE *strip_resource_annotations(FILE *file, COOK_RESOURCES *resources, char **buffer);
+int resolve_resource_annotations(COOK_RESOURCES *resources, COOKBOOK *cookbook);
+void free_resources(COOK_RESOURCES *resources);
+
+// admission (the recipe states must have been set up by apply_resource_annotations at the start of the run)
+void apply_resource_annotations(COOK_RESOURCES *resources, int max_cooks);
+int recipe_units(RECIPE *recipe);
+int admits_recipe(COOK_RESOURCES *resources, RECIPE *recipe, int units_in_use, int limit, int *blocked_by_pool);
+void take_resources(COOK_RESOURCES *resources, RECIPE *recipe);
+void release_resources(COOK_RESOURCES *resources, RECIPE *recipe);
+int apply_recipe_limits(RECIPE *recipe);   // in the cook
+
+#endif
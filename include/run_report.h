@@ -0,0 +1,17 @@
+/*
+	Contains the end of run report: what happened to every recipe the targets of a run needed
+	(and how long its phases took)
+*/
+#ifndef RUN_REPORT_H
+#define RUN_REPORT_H
+
+#include <stdio.h>
+
+#include "cook_context.h"
+
+void print_run_summary(COOK_CONTEXT *ctx, FILE *out);
+void print_eta(COOK_CONTEXT *ctx, FILE *out);
+void print_run_timings(COOK_CONTEXT *ctx, FILE *out);
+void write_run_timings_json(COOK_CONTEXT *ctx, FILE *out);
+
+#endif
@@ -0,0 +1,28 @@
+/*
+	Contains the scheduling policies of the work queue (cook --policy name)
+	A policy ranks the recipes of a run once before it starts: it sets the priority in the state of every
+	required recipe, and the work queue (a heap) always hands out the ready recipe with the highest one
+*/
+#ifndef SCHEDULING_POLICY_H
+#define SCHEDULING_POLICY_H
+
+#include "libcook.h"
+#include "cookbook.h"
+
+typedef struct scheduling_policy {
+	const char *name;
+	const char *description;
+	void (*prioritize)(COOK_CONTEXT *ctx);    // sets RECIPE_STATE priority of the required recipes of the run
+} SCHEDULING_POLICY;
+
+const SCHEDULING_POLICY *find_scheduling_policy(const char *name);
+void print_scheduling_policies(FILE *out);
+
+void prioritize_recipes(COOK_CONTEXT *ctx);   // with the policy of the context (fifo if none was set)
+
+long estimate_recipe_ms(COOK_CONTEXT *ctx, RECIPE *recipe);
+long estimate_remaining_ms(COOK_CONTEXT *ctx, long now_ms);
+
+int boost_critical_path(COOK_CONTEXT *ctx);   // the critical path of the run gets PRIORITY_CRITICAL
+
+#endif
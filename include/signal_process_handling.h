@@ -1,8 +1,8 @@
 /*
 	Contains structure for work queue and stack for tree traversal
 */
-#ifndef CONST_H
-#define CONST_h
+#ifndef SIGNAL_PROCESS_HANDLING_H
+#define SIGNAL_PROCESS_HANDLING_H
 
 #include <signal.h>
 #include <sys/wait.h>
@@ -13,8 +13,23 @@
 
 #include "cookbook.h"
 #include "stack_queue_tree_traversal.h"
+#include "cook_context.h"
 
-void main_processing_loop(WORK_QUEUE *work_queue, int max_cooks, COOKBOOK *cookbook, RECIPE *recipe_selected, RECIPE **completed_recipes);
+// speculative execution (cook --speculate): when a cook of an idempotent recipe counts as a straggler
+#define SPECULATE_FACTOR 2.0        // running this many times its average duration
+#define SPECULATE_SIGMAS 3.0        // and this many standard deviations past it
+#define SPECULATE_MIN_MS 1000       // and never before this long
+#define SPECULATE_SAMPLE_MS 250     // how often a straggler waiting for a free cook is looked at again
+
+// retries of failed recipes (cook --retries, retries= annotation)
+#define RETRY_BACKOFF_MS 1000       // wait before the first retry when none is given
+#define RETRY_BACKOFF_MAX_MS 60000  // the doubling stops here
+
+// memory-aware admission (cook --mem-floor)
+#define MEM_FLOOR_SAMPLE_MS 250     // MemAvailable is read at most this often, and again this often while held
+
+int main_processing_loop(COOK_CONTEXT *ctx);
+int pool_processing_loop(COOK_CONTEXT **ctxs, int count, int max_cooks);
 
 void sigchld_handler(int sig);
 void sigchld_handler_cook(int sig);
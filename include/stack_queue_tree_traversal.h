@@ -1,8 +1,8 @@
 /*
 	Contains structure for work queue and stack for tree traversal
 */
-#ifndef CONST_H
-#define CONST_h
+#ifndef STACK_QUEUE_TREE_TRAVERSAL_H
+#define STACK_QUEUE_TREE_TRAVERSAL_H
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,30 +10,118 @@
 #include <sys/stat.h>
 #include <dirent.h>
 
-#include "cookbook.h"
+#include <sys/types.h>
 
-void initialize_recipe_states(RECIPE *recipe);
-void initialize_cookbook_states(COOKBOOK *cookbook);
+#include "cookbook.h"
 
-int validargs(char **cookbook, char **recipe_name, int argc, char **argv);
+// per recipe bookkeeping kept in recipe->state (allocated by initialize_cookbook_states)
+typedef struct recipe_state {
+	int visited;             // mark used by the tree traversals, also set once a cook is started
+	pid_t pid;               // pid of the cook processing the recipe, 0 before it is started
+	int dependency_count;    // sub-recipes not completed yet (initialize_dependency_count)
+	int required;            // needed by one of the targets of the run (set from the analysis)
+	int completed;           // all tasks done (set when its cook is reaped)
+	int failed;              // its cook failed (keep going mode: its dependents are skipped)
+	int cpu;                 // cook units its cook takes, 0 counts as 1 (resource annotation)
+	long mem_kb;             // memory its cook takes (resource annotation)
+	int pool;                // 1 + index of the named pool its cook takes a place in, 0 if none
+	long timeout_ms;         // its cook is killed after this long, 0 for the timeout of the run (annotation)
+	int idempotent;          // can be cooked twice at once (annotation), so a straggler may get a backup copy
+	int timed_out;           // its cook was killed by the timeout
+	int retries;             // a failed cook is retried this many times, 0 for the retries of the run (annotation)
+	long retry_backoff_ms;   // wait before the first retry, doubled for every next one, 0 for the run's (annotation)
+	int retries_used;        // retries started (or waiting) so far
+	long retry_at_ms;        // monotonic_ms() when the waiting retry goes back into the work queue
+	int priority_class;      // PRIORITY_CLASS its cook runs in (annotation, or critical on the critical path)
+	int critical;            // on the critical path of the targets (set when the run raises it)
+	long rlimit_as_kb;       // setrlimit caps its cook puts on itself and its steps, 0 for none (annotation)
+	long rlimit_cpu_s;
+	long rlimit_nofile;
+	long rlimit_nproc;
+	int throttled;           // its start was held back by the memory floor at least once
+	int index;               // position in the cookbook (the context keeps the durations of its recipes by it)
+	long priority;           // rank given by the scheduling policy of the run, higher is dequeued first
+	int queue_index;         // 1 + position in the work queue heap, 0 while not queued
+	int domain;              // 1 + cpu domain its cook was placed in, 0 if it was not placed
+	long long ready_ns;      // latency_now_ns() when it was last queued (only while the queue stamps it)
+} RECIPE_STATE;
+
+#define RECIPE_STATE_OF(recipe) ((RECIPE_STATE *)(recipe)->state)
+
+int initialize_recipe_states(RECIPE *recipe); // -1 if a state could not be allocated
+int initialize_cookbook_states(COOKBOOK *cookbook);
+
+// one -f cookbook[:recipe,...][@weight] job, every job is cooked on the same pool of cooks
+typedef struct cook_job_options {
+	char *cookbook;          // cookbook file to parse
+	char **recipe_names;     // main recipes ("targets") to cook, none selects the first recipe
+	int recipe_count;
+	int weight;              // share of the cooks the job gets while other jobs have work too
+} COOK_JOB_OPTIONS;
+
+// options parsed from the command line by validargs()
+typedef struct cook_options {
+	COOK_JOB_OPTIONS *jobs;  // -f: at least one job ("cookbook.ckb" if no -f is given)
+	int job_count;
+	int max_cooks;           // -c: maximum number of cooks active at once, shared by all jobs
+	int min_cooks;           // -c auto[:min:max]: the limit adapts to the system between min_cooks and max_cooks
+	int auto_cooks;
+	int cooks_given;         // -c was on the command line (a joined jobserver limits the cooks otherwise)
+	int jobserver;           // -J pipe|fifo: act as a GNU make jobserver for the steps (a JOBSERVER_MODE)
+	char *policy;            // --policy: scheduling policy of the ready recipes (NULL is fifo)
+	char *history;           // --history: duration history file (COOK_HISTORY in the environment otherwise)
+	int show_eta;            // --eta: print the estimated time left whenever a recipe completes
+	long timeout_ms;         // --timeout: cooks running longer are killed (with their steps), 0 for no timeout
+	int speculate;           // --speculate: stragglers of idempotent recipes get a backup cook
+	int retries;             // --retries: a failed recipe is cooked again up to this many times
+	long retry_backoff_ms;   // --retry-backoff: wait before the first retry (doubled for every next one)
+	char *trace;             // --trace: Chrome trace events of the recipes, tasks and steps are written here
+	long mem_floor_kb;       // --mem-floor: no new cook starts while less memory is available (one always may)
+	int critical_boost;      // --critical-boost: cooks on the critical path of the targets get the critical class
+	char *placement;         // --placement: pin every cook to the cpus of one socket, NUMA node or L3 (NULL: no)
+	int usage;               // --usage: print the resource usage of the recipes, tasks and steps at the end
+	char *usage_json;        // --usage-json: write it to this file as JSON
+	char *timings;           // --timings: print the phase timings of every run ("", or write them as JSON to this file)
+	int latency;             // --latency: print p50/p99/max of the scheduler latencies of every run
+	int perf;                // --perf: the usage includes the perf counters of every recipe (implies --usage)
+	char *status;            // --status: live status page for cook-top ("" for /dev/shm/cook.<pid>, NULL: none)
+	int keep_going;          // -k: a failed recipe only stops its own dependents, a summary is printed at the end
+	char *daemon_socket;     // -D: serve cook requests on this Unix socket instead of cooking once
+	char *request_socket;    // -S: send the cook request to the daemon listening on this socket
+} COOK_OPTIONS;
+
+int validargs(COOK_OPTIONS *options, int argc, char **argv);
+void free_options(COOK_OPTIONS *options);
 
 RECIPE *find_recipe(COOKBOOK *cookbook, const char *recipe_name);
 
-// functions and structs for work queue structure used for maintaining leaf nodes
-typedef struct queue_node {
+/*
+	functions and structs for the work queue of recipes that are ready to be cooked
+	It is a binary max heap on the priority each recipe had when it was queued, recipes with the same priority
+	come out in the order they were queued (so with every priority 0 it is the plain FIFO queue it used to be)
+*/
+typedef struct queue_entry {
 	RECIPE *recipe;
-	struct queue_node *next;
-} QUEUE_NODE;
+	long priority;           // RECIPE_STATE priority when the recipe was queued
+	unsigned long order;     // queue order, breaks ties between equal priorities
+} QUEUE_ENTRY;
 
 typedef struct {
-	QUEUE_NODE *front;
-	QUEUE_NODE *back;
+	QUEUE_ENTRY *entries;    // the heap, entries[0] is dequeued next
+	int size;
+	int capacity;
+	unsigned long next_order;
+	int stamp_ready;         // enqueue() keeps the time a recipe was queued (--latency), off it never reads the clock
 } WORK_QUEUE;
 
-WORK_QUEUE *init_work_queue();
-void enqueue(WORK_QUEUE *queue, RECIPE *recipe);
+WORK_QUEUE *init_work_queue(); // NULL if there is no memory for it
+void free_work_queue(WORK_QUEUE *queue);
+int enqueue(WORK_QUEUE *queue, RECIPE *recipe); // 0, or -1 if the queue could not grow
 RECIPE *dequeue_recipe(WORK_QUEUE *queue, RECIPE *target_recipe); // remove specific recipe from queue
 RECIPE *dequeue(WORK_QUEUE *queue);
+RECIPE *peek_work_queue(WORK_QUEUE *queue);
+int work_queue_size(WORK_QUEUE *queue);
+int sorted_work_queue(WORK_QUEUE *queue, RECIPE **recipes); // the queued recipes in dequeue order
 int is_work_queue_empty(WORK_QUEUE *queue);
 int is_ready_for_work_queue(RECIPE *recipe);
 
@@ -55,13 +143,16 @@ RECIPE *pop(STACK *stack);
 int is_stack_empty(STACK *stack);
 void mark_visited(RECIPE *recipe);
 int is_visited(RECIPE *recipe);
+int is_required(RECIPE *recipe);
+int is_completed(RECIPE *recipe);
 
 int stack_analysis_traversal(RECIPE *recipe_selected, WORK_QUEUE *work_queue);
+int stack_analysis_traversal_targets(RECIPE **targets, int target_count, WORK_QUEUE *work_queue, RECIPE **required);
 
 int check_circular_tree_cycle(RECIPE *recipe_root);
 int detect_cycle_dfs(RECIPE *recipe, STACK *stack);
 
-void update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int completed_count, RECIPE *main_recipe);
+int update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int completed_count);
 int is_in_completed_recipes(RECIPE *recipe, RECIPE **completed_recipes, int completed_count);
 
 /*
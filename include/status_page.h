@@ -0,0 +1,89 @@
+/*
+	Contains the live status page of a run (cook --status[=file], read by cook-top)
+	The main cook keeps a small file in /dev/shm mapped shared: the queue depth, active cooks, completed and
+	total counts, what every cook slot is cooking, and when every recipe started and ended. The cooks write
+	the task and step they are at into their own slot
+	Nothing is locked: the main cook bumps sequence to odd before it writes and back to even after, a reader
+	copies the page and keeps it if sequence was the same even number before and after (a seqlock), so
+	cook-top never makes the build wait, send it a signal or even a syscall
+*/
+#ifndef STATUS_PAGE_H
+#define STATUS_PAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define STATUS_MAGIC 0x4b4f4f43u    // "COOK"
+#define STATUS_VERSION 1
+#define STATUS_NAME_MAX 48          // longest recipe name kept (cut short)
+#define STATUS_DIR "/dev/shm/"      // default page: /dev/shm/cook.<pid>
+
+typedef enum status_state {
+	STATUS_WAITING,
+	STATUS_COOKING,
+	STATUS_COMPLETED,
+	STATUS_FAILED
+} STATUS_STATE;
+
+// start of the page, followed by slot_count slots and recipe_count recipes
+typedef struct status_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sequence;              // odd while the main cook is writing
+	int32_t pid;                    // main cook
+	int32_t slot_count;
+	int32_t recipe_count;           // every recipe of the cookbook
+	int32_t total;                  // of those, the ones the run needs
+	int32_t completed;
+	int32_t failed;
+	int32_t queue_depth;            // ready recipes waiting for a cook
+	int32_t active_cooks;
+	int32_t running;                // 0 before and after the run
+	int64_t started_ms;             // monotonic, like the times below
+	int64_t updated_ms;
+	char cookbook[128];
+} STATUS_HEADER;
+
+typedef struct status_slot {
+	int32_t pid;                    // cook, 0 if the slot is free
+	int32_t recipe;                 // position of its recipe, -1 if the slot is free
+	int32_t task;                   // task the cook is at, written by the cook (-1 before its first)
+	int32_t step;                   // steps of that task that have finished (a pipeline runs them all at once)
+	int32_t step_count;             // steps of that task
+	int32_t padding;
+	int64_t started_ms;
+} STATUS_SLOT;
+
+typedef struct status_recipe {
+	char name[STATUS_NAME_MAX];
+	int32_t state;                  // STATUS_STATE
+	int32_t cooks;                  // cooks started for it (retries and backups too)
+	int64_t started_ms;             // first cook started, 0 for not yet
+	int64_t ended_ms;               // completed or failed, 0 for not yet
+} STATUS_RECIPE;
+
+typedef struct status_page {
+	char *path;                     // NULL: no status page
+	int owned;                      // the file was created by this process (it is removed when closed)
+	size_t size;
+	void *map;                      // NULL while no run has mapped it
+	STATUS_HEADER *header;
+	STATUS_SLOT *slots;
+	STATUS_RECIPE *recipes;
+} STATUS_PAGE;
+
+// in the main cook
+void init_status_page(STATUS_PAGE *page);
+int set_status_path(STATUS_PAGE *page, const char *path);   // NULL path: /dev/shm/cook.<pid>
+int map_status_page(STATUS_PAGE *page, const char *cookbook, char **names, int recipe_count, int slot_count);
+void close_status_page(STATUS_PAGE *page);
+void begin_status_update(STATUS_PAGE *page);
+void end_status_update(STATUS_PAGE *page);
+
+// in a cook (its own slot only, the main cook does not write the task and step)
+void set_status_step(STATUS_PAGE *page, int slot, int task, int step, int step_count);
+
+// in cook-top: a copy of the page as it was at one moment (malloc'd), or NULL if it can't be read
+void *read_status_page(const char *path, size_t *size);
+
+#endif
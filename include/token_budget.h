@@ -0,0 +1,51 @@
+/*
+	Contains the token budget used to share a fixed number of cooks between processes
+	The budget is a pipe pre-loaded with one byte per cook: taking a byte out of the pipe
+	is permission to start a cook and writing it back returns the cook to the budget
+
+	The same budget can be a GNU make jobserver: its pipe (or FIFO) is advertised to the steps in
+	MAKEFLAGS, so a make or compiler started by a step borrows its extra jobs from the same tokens,
+	and cook itself can take its cooks out of the jobserver of a make it was started by
+*/
+#ifndef TOKEN_BUDGET_H
+#define TOKEN_BUDGET_H
+
+#define TOKEN_HELD_MAX 256      // tokens whose bytes are remembered (jobserver tokens go back as they came)
+#define JOBSERVER_SAMPLE_MS 100 // how often a jobserver cook created is checked for tokens borrowed by the steps
+#define JOBSERVER_MAX_COOKS 64  // cooks allowed under a joined jobserver when no -c is given (its tokens are the real limit)
+
+typedef enum jobserver_mode {
+	JOBSERVER_NONE,
+	JOBSERVER_PIPE,     // --jobserver-auth=R,W (every make)
+	JOBSERVER_FIFO      // --jobserver-auth=fifo:PATH (make 4.4 and later)
+} JOBSERVER_MODE;
+
+typedef struct token_budget {
+	int read_fd;        // read end of the token pipe (non-blocking, private to this process)
+	int write_fd;       // write end of the token pipe
+	int capacity;       // number of tokens the budget was created with (0: joined, unknown)
+	int tokens_held;    // tokens currently taken out of the pipe by this process
+
+	// jobserver only
+	JOBSERVER_MODE jobserver;
+	int implicit_token;         // 1 while the free token every make job has is not used by a cook
+	int shared_read_fd;         // pipe ends the steps inherit (-1 for a FIFO, they open it by name)
+	int shared_write_fd;
+	char fifo_path[108];        // FIFO created by cook (removed by close_token_budget)
+	char held[TOKEN_HELD_MAX];  // bytes of the tokens held
+	int borrowed_max;           // most tokens ever missing from the pipe that were not ours (steps had them)
+} TOKEN_BUDGET;
+
+int init_token_budget(TOKEN_BUDGET *budget, int capacity);
+int acquire_token(TOKEN_BUDGET *budget);
+void release_token(TOKEN_BUDGET *budget);
+void release_all_tokens(TOKEN_BUDGET *budget);
+void refill_token_budget(TOKEN_BUDGET *budget);
+void close_token_budget(TOKEN_BUDGET *budget);
+
+int init_jobserver(TOKEN_BUDGET *budget, int max_cooks, JOBSERVER_MODE mode);
+int join_jobserver(TOKEN_BUDGET *budget, const char *makeflags);
+int tokens_available(TOKEN_BUDGET *budget);
+void note_borrowed_tokens(TOKEN_BUDGET *budget);
+
+#endif
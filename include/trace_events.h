@@ -0,0 +1,37 @@
+/*
+	Contains the trace of a run as Chrome trace events (cook --trace out.json), for Perfetto or chrome://tracing
+	Every recipe is a slice on the track of the cook slot that cooked it, its tasks are nested in it and every
+	step is a slice on a track of its own (the steps of a pipeline overlap), so idle slots and stalls show up
+	The main cook and all its cooks append whole events to the same file (O_APPEND), the main cook closes
+	the JSON when the context is freed
+*/
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include <sys/types.h>
+
+#define TRACE_EVENT_MAX 4096        // longest event written
+#define TRACE_ARGS_MAX 2048         // longest args of an event (a long argv is cut short to fit)
+#define TRACE_STEP_TRACKS (1 << 30) // a step's track is this plus its pid, far above the slot tracks of every run
+
+typedef struct trace_log {
+	char *path;
+	int fd;                         // -1 while not tracing
+	pid_t pid;                      // main cook, the process of the timeline
+	long origin_us;                 // trace time 0 (monotonic)
+	int next_track;                 // first track not given to the slots of a run yet
+} TRACE_LOG;
+
+void init_trace(TRACE_LOG *trace);
+int open_trace(TRACE_LOG *trace, const char *path);
+void close_trace(TRACE_LOG *trace);
+
+long trace_now_us(TRACE_LOG *trace);
+int add_trace_tracks(TRACE_LOG *trace, int count, const char *label);   // returns the first track
+
+void trace_slice(TRACE_LOG *trace, const char *category, const char *name, int track,
+	long start_us, long end_us, const char *args);   // args: JSON members without the braces, may be NULL
+void trace_status(char *buffer, int size, int status);
+void trace_escape(char *buffer, int size, const char *text);
+
+#endif
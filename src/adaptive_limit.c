@@ -0,0 +1,181 @@
+/*
+	Adaptive cook limit (cook -c auto)
+	The limit aims at one cook per cpu that the rest of the system is not already using:
+	the load average minus our own active cooks is load from somebody else
+	Memory trouble (little MemAvailable or memory PSI) halves the limit at once, cpu PSI lowers it by one,
+	and the limit only goes up one cook at a time after ADAPTIVE_HYSTERESIS samples agree, so it doesn't flap
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adaptive_limit.h"
+
+long monotonic_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+// Function to read the "some avg10=" value of a /proc/pressure file, 0 if there is no PSI (old kernel, container)
+static double read_pressure(const char *path) {
+	double avg10 = 0;
+	FILE *file = fopen(path, "r");
+	if (file == NULL) return 0;
+	if (fscanf(file, "some avg10=%lf", &avg10) != 1) avg10 = 0;
+	fclose(file);
+	return avg10;
+}
+
+// Function to sample the system, anything that can't be read is left at 0 and ignored by adapt_limit()
+void read_adaptive_inputs(ADAPTIVE_INPUTS *inputs) {
+	memset(inputs, 0, sizeof(ADAPTIVE_INPUTS));
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	inputs->online_cpus = cpus > 0 ? (int)cpus : 1;
+
+	double load[1];
+	if (getloadavg(load, 1) == 1) inputs->load_1min = load[0];
+
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+	if (meminfo != NULL) {
+		char line[256];
+		while (fgets(line, sizeof(line), meminfo) != NULL) {
+			sscanf(line, "MemTotal: %ld kB", &inputs->mem_total_kb);
+			sscanf(line, "MemAvailable: %ld kB", &inputs->mem_available_kb);
+		}
+		fclose(meminfo);
+	}
+
+	inputs->cpu_pressure = read_pressure("/proc/pressure/cpu");
+	inputs->mem_pressure = read_pressure("/proc/pressure/memory");
+}
+
+static int clamp_limit(ADAPTIVE_LIMIT *adaptive, int limit) {
+	if (limit < adaptive->min_cooks) return adaptive->min_cooks;
+	if (limit > adaptive->max_cooks) return adaptive->max_cooks;
+	return limit;
+}
+
+static void record_change(ADAPTIVE_LIMIT *adaptive, long now_ms, const char *reason) {
+	if (adaptive->history_count == adaptive->history_capacity) {
+		int capacity = adaptive->history_capacity == 0 ? 16 : adaptive->history_capacity * 2;
+		ADAPTIVE_CHANGE *history = realloc(adaptive->history, capacity * sizeof(ADAPTIVE_CHANGE));
+		if (history == NULL) return; // the summary just misses a change
+		adaptive->history = history;
+		adaptive->history_capacity = capacity;
+	}
+	ADAPTIVE_CHANGE *change = &adaptive->history[adaptive->history_count++];
+	change->at_ms = now_ms - adaptive->start_ms;
+	change->limit = adaptive->limit;
+	change->reason = reason;
+}
+
+/*
+	Function to work out the limit the inputs ask for, before hysteresis
+	*memory_trouble is set when the limit must come down without waiting for more samples
+*/
+static int target_limit(ADAPTIVE_LIMIT *adaptive, const ADAPTIVE_INPUTS *inputs, int active_cooks,
+	const char **reason, int *memory_trouble) {
+
+	double others = inputs->load_1min - active_cooks; // load that isn't ours
+	if (others < 0) others = 0;
+
+	int target = inputs->online_cpus - (int)(others + 0.5);
+	*reason = others >= 0.5 ? "load" : "cpus";
+	*memory_trouble = 0;
+
+	if (inputs->cpu_pressure > ADAPTIVE_CPU_PRESSURE && target >= adaptive->limit) {
+		target = adaptive->limit - 1;
+		*reason = "cpu pressure";
+	}
+
+	int low_memory = inputs->mem_total_kb > 0 && inputs->mem_available_kb * 100 < inputs->mem_total_kb * ADAPTIVE_MEM_LOW_PERCENT;
+	if (low_memory || inputs->mem_pressure > ADAPTIVE_MEM_PRESSURE) {
+		if (target > adaptive->limit / 2) target = adaptive->limit / 2;
+		*reason = low_memory ? "low memory" : "memory pressure";
+		*memory_trouble = 1;
+	}
+
+	return clamp_limit(adaptive, target);
+}
+
+/*
+	Function to start the adaptive limit for a run, between min_cooks and max_cooks
+	The first limit is taken straight from a sample of the system (nothing of ours is running yet)
+*/
+void start_adaptive_limit(ADAPTIVE_LIMIT *adaptive, int min_cooks, int max_cooks, long now_ms) {
+	ADAPTIVE_INPUTS inputs;
+	const char *reason;
+	int memory_trouble;
+
+	adaptive->min_cooks = min_cooks;
+	adaptive->max_cooks = max_cooks;
+	adaptive->start_ms = now_ms;
+	adaptive->last_sample_ms = now_ms;
+	adaptive->raise_votes = 0;
+	adaptive->lower_votes = 0;
+	adaptive->history_count = 0;
+
+	read_adaptive_inputs(&inputs);
+	adaptive->limit = max_cooks; // the memory rules halve the limit, so start them from the top
+	adaptive->limit = target_limit(adaptive, &inputs, 0, &reason, &memory_trouble);
+	record_change(adaptive, now_ms, reason);
+}
+
+/*
+	Function to move the limit according to one sample of the system
+
+	Returns the new limit
+*/
+int adapt_limit(ADAPTIVE_LIMIT *adaptive, const ADAPTIVE_INPUTS *inputs, int active_cooks, long now_ms) {
+	const char *reason;
+	int memory_trouble;
+	int target = target_limit(adaptive, inputs, active_cooks, &reason, &memory_trouble);
+
+	adaptive->last_sample_ms = now_ms;
+
+	if (target > adaptive->limit) {
+		adaptive->lower_votes = 0;
+		if (++adaptive->raise_votes >= ADAPTIVE_HYSTERESIS) {
+			adaptive->limit++; // one cook at a time, the load average needs a while to show what it did
+			adaptive->raise_votes = 0;
+			record_change(adaptive, now_ms, reason);
+		}
+	} else if (target < adaptive->limit) {
+		adaptive->raise_votes = 0;
+		if (memory_trouble || ++adaptive->lower_votes >= ADAPTIVE_HYSTERESIS) {
+			adaptive->limit = target;
+			adaptive->lower_votes = 0;
+			record_change(adaptive, now_ms, reason);
+		}
+	} else {
+		adaptive->raise_votes = 0;
+		adaptive->lower_votes = 0;
+	}
+	return adaptive->limit;
+}
+
+// Function to get the current limit, sampling the system first if ADAPTIVE_SAMPLE_MS has passed
+int poll_adaptive_limit(ADAPTIVE_LIMIT *adaptive, int active_cooks) {
+	long now_ms = monotonic_ms();
+	if (now_ms - adaptive->last_sample_ms >= ADAPTIVE_SAMPLE_MS) {
+		ADAPTIVE_INPUTS inputs;
+		read_adaptive_inputs(&inputs);
+		adapt_limit(adaptive, &inputs, active_cooks, now_ms);
+	}
+	return adaptive->limit;
+}
+
+// Function to get how long the main processing loop may wait before the next sample is due
+long adaptive_wait_ms(ADAPTIVE_LIMIT *adaptive) {
+	long wait_ms = adaptive->last_sample_ms + ADAPTIVE_SAMPLE_MS - monotonic_ms();
+	return wait_ms > 0 ? wait_ms : 0;
+}
+
+void free_adaptive_limit(ADAPTIVE_LIMIT *adaptive) {
+	free(adaptive->history);
+	memset(adaptive, 0, sizeof(ADAPTIVE_LIMIT));
+}
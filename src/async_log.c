@@ -0,0 +1,162 @@
+/*
+	This is the c file for the logging backend of debug.h (see async_log.h)
+	The ring is a fixed array of slots: a writer takes the next slot by moving head with a compare-and-swap,
+	fills it and marks it ready; the drain (the thread, or flush_log) takes the ready slots from tail on and
+	stops at the first one not ready yet, so the messages come out in the order their slots were taken
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "async_log.h"
+#include "debug.h"
+
+typedef struct log_entry {
+	int ready;                      // filled in, waiting to be written
+	int level;
+	int line;
+	const char *file;               // string literals of the macro, not copied
+	const char *function;
+	long long at_ns;                // since the first message of the process
+	char message[LOG_MESSAGE_MAX];
+} LOG_ENTRY;
+
+static const char *level_names[] = { "DEBUG", "INFO", "SUCCESS", "WARN", "ERROR" };
+static const char *level_colors[] = { KMAG, KBLU, KGRN, KYEL, KRED };
+
+int log_threshold = LOG_DEBUG;      // before the first message: COOK_LOG_LEVEL is read then
+
+static LOG_ENTRY ring[LOG_RING_SLOTS];
+static unsigned long head;          // next slot to take
+static unsigned long tail;          // next slot to write (the drain only)
+static unsigned long dropped;       // messages that found the ring full
+static long long origin_ns;
+static pid_t owner;                 // process the ring and thread belong to (0: not started)
+static int stopping;
+static pthread_t drainer;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER; // thread against flush_log, never held by a writer
+
+static long long monotonic_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int parse_log_level(const char *name) {
+	const char *names[] = { "debug", "info", "success", "warn", "error", "off" };
+	for (int level = LOG_DEBUG; level <= LOG_OFF; level++) {
+		if (strcasecmp(name, names[level]) == 0) return level;
+	}
+	return -1;
+}
+
+void set_log_level(int level) {
+	__atomic_store_n(&log_threshold, level, __ATOMIC_RELAXED);
+}
+
+// writes every ready slot from tail on (the caller holds drain_lock)
+static void drain(void) {
+	while (1) {
+		LOG_ENTRY *entry = &ring[tail % LOG_RING_SLOTS];
+		if (!__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE)) break;
+		fprintf(stderr, "[%6lld.%06lld] %s%s: %s:%s:%d " KNRM "%s" NL, entry->at_ns / 1000000000, entry->at_ns / 1000 % 1000000,
+			level_colors[entry->level], level_names[entry->level], entry->file, entry->function, entry->line, entry->message);
+		__atomic_store_n(&entry->ready, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE); // the slot can be taken again
+	}
+	fflush(stderr);
+}
+
+static void *drain_thread(void *unused) {
+	(void)unused;
+	struct timespec interval = { 0, LOG_DRAIN_MS * 1000000L };
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&drain_lock);
+		drain();
+		pthread_mutex_unlock(&drain_lock);
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+// Function to write whatever the ring holds now (on exit, and before a forked child leaves with _exit())
+void flush_log(void) {
+	if (owner != getpid()) return;
+	pthread_mutex_lock(&drain_lock);
+	drain();
+	unsigned long lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+	if (lost > 0) fprintf(stderr, KYEL "WARN: " KNRM "%lu log messages dropped, the log ring was full" NL, lost);
+	pthread_mutex_unlock(&drain_lock);
+}
+
+static void stop_log(void) {
+	if (owner != getpid()) return;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(drainer, NULL);
+	flush_log();
+}
+
+// the child of a fork has the ring of its parent (which writes it) but not its thread: it starts over
+static void forked_child(void) {
+	owner = 0;
+	head = tail = dropped = 0;
+	stopping = 0;
+	memset(ring, 0, sizeof(ring));
+	pthread_mutex_init(&drain_lock, NULL);
+}
+
+// starts the ring of this process on its first message (the macros are only used by the main thread)
+static void start_log(void) {
+	static int registered = 0;
+	const char *level = getenv("COOK_LOG_LEVEL");
+	if (level != NULL && parse_log_level(level) >= 0) set_log_level(parse_log_level(level));
+
+	origin_ns = monotonic_ns();
+	owner = getpid();
+	if (!registered) { // atexit and pthread_atfork handlers are kept by a forked child
+		atexit(stop_log);
+		pthread_atfork(NULL, NULL, forked_child);
+		registered = 1;
+	}
+	if (pthread_create(&drainer, NULL, drain_thread, NULL) != 0) {
+		owner = 0;
+		set_log_level(LOG_OFF);
+		fprintf(stderr, "ERROR: Failed to start the log thread, logging is off" NL);
+	}
+}
+
+/*
+	Function behind the debug.h macros: formats the message into the next free slot of the ring
+	A message below the threshold is dropped before it is formatted, and one that finds the ring full is
+	only counted
+*/
+void log_message(int level, const char *file, const char *function, int line, const char *format, ...) {
+	if (level < __atomic_load_n(&log_threshold, __ATOMIC_RELAXED)) return;
+	if (owner == 0) start_log(); // first message of the process (a forked child is reset to 0)
+	if (level < __atomic_load_n(&log_threshold, __ATOMIC_RELAXED) || level >= LOG_OFF || owner == 0) return;
+
+	unsigned long slot = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	do {
+		if (slot - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+			__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&head, &slot, slot + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	LOG_ENTRY *entry = &ring[slot % LOG_RING_SLOTS];
+	entry->level = level;
+	entry->file = file;
+	entry->function = function;
+	entry->line = line;
+	entry->at_ns = monotonic_ns() - origin_ns;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(entry->message, sizeof(entry->message), format, args);
+	va_end(args);
+	__atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+}
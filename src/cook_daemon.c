@@ -0,0 +1,459 @@
+/*
+	Cook daemon: keeps a parsed cookbook in memory and cooks recipes on request
+	A request is one line sent over a connection to the daemon's Unix domain socket:
+
+		cook [main_recipe_name] [-c max_cooks]
+
+	and the daemon answers on the same connection with one line per event:
+
+		accepted <recipe> <request pid>
+		start <recipe> <cook pid>
+		done <recipe>
+		failed <recipe>
+		ok <recipe>             (last line: the main recipe was completed)
+		error <message>         (last line: the request could not be completed)
+
+	The cycle check and dependency analysis of a main recipe are done once and cached.
+	Each request is cooked by a forked child of the daemon, so the parsed cookbook is shared
+	copy-on-write and never parsed again, and all of the children draw their cooks from one
+	token budget so that concurrent requests together never run more than the daemon's -c cooks
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cook_daemon.h"
+#include "signal_process_handling.h"
+#include "async_log.h"
+
+#define REQUEST_READ_TIMEOUT 5  // seconds a client gets to send its request line
+#define PENDING_MAX 16          // connections that can be sending their request line at once
+
+// a connection the daemon is still reading the request line of (the accept loop never waits for one)
+typedef struct pending_request {
+	int fd;                     // -1 when the slot is free
+	int length;
+	long deadline_ms;           // now_ms() after which the request is given up on
+	char request[COOK_REQUEST_MAX];
+} PENDING_REQUEST;
+
+// cached result of the cycle check and analysis phase for one main recipe
+typedef struct analysis_entry {
+	COOK_ANALYSIS analysis;
+	struct analysis_entry *next;
+} ANALYSIS_ENTRY;
+
+static TOKEN_BUDGET daemon_budget;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_stop_handler(int sig) {
+	daemon_stop = 1;
+}
+
+static void daemon_sigchld_handler(int sig) {
+	// only here so pselect is interrupted when a request finishes
+}
+
+// Function to send a complete line on a connection (the daemon must never die of SIGPIPE)
+static void send_line(int fd, const char *line) {
+	send(fd, line, strlen(line), MSG_NOSIGNAL);
+}
+
+/*
+	Function to get the analysis of a main recipe, running the cycle check and analysis phase only the first time
+	The daemon never forks cooks itself, so the request children inherit a cookbook with clean recipe states
+*/
+static ANALYSIS_ENTRY *get_analysis(ANALYSIS_ENTRY **cache, COOKBOOK *cookbook, RECIPE *recipe) {
+	for (ANALYSIS_ENTRY *entry = *cache; entry != NULL; entry = entry->next) {
+		if (entry->analysis.target_count == 1 && entry->analysis.targets[0] == recipe) return entry;
+	}
+
+	ANALYSIS_ENTRY *entry = calloc(1, sizeof(ANALYSIS_ENTRY));
+	if (entry == NULL) return NULL;
+
+	analyze_targets(cookbook, &recipe, 1, &entry->analysis);
+
+	entry->next = *cache;
+	*cache = entry;
+	return entry;
+}
+
+static void free_analysis_cache(ANALYSIS_ENTRY *cache) {
+	while (cache != NULL) {
+		ANALYSIS_ENTRY *next = cache->next;
+		free_analysis(&cache->analysis);
+		free(cache);
+		cache = next;
+	}
+}
+
+// milliseconds on the monotonic clock, for the deadlines of the pending requests
+static long now_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+/*
+	Function to read what a pending connection has sent so far, without blocking
+	Returns 1 once the request line is complete (or the connection can't send any more), 0 while it is not
+*/
+static int read_pending(PENDING_REQUEST *pending) {
+	while (pending->length < COOK_REQUEST_MAX - 1) {
+		ssize_t n = read(pending->fd, pending->request + pending->length, COOK_REQUEST_MAX - 1 - pending->length);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+		if (n <= 0) return 1;
+		pending->length += n;
+		if (memchr(pending->request, '\n', pending->length) != NULL) return 1;
+	}
+	return 1;
+}
+
+/*
+	Function to parse a request line read from a connection
+	Returns 0 and fills in the recipe name and max cooks if the request is well formed, -1 otherwise
+*/
+static int parse_request(char *request, int length, char **recipe_name, int *max_cooks) {
+	request[length] = '\0';
+
+	char *newline = strchr(request, '\n');
+	if (newline == NULL) return -1;
+	*newline = '\0';
+
+	char *save = NULL;
+	char *word = strtok_r(request, " \t\r", &save);
+	if (word == NULL || strcmp(word, "cook") != 0) return -1;
+
+	*recipe_name = "";
+	*max_cooks = 1;
+	while ((word = strtok_r(NULL, " \t\r", &save)) != NULL) {
+		if (strcmp(word, "-c") == 0) {
+			if ((word = strtok_r(NULL, " \t\r", &save)) == NULL || (*max_cooks = atoi(word)) <= 0) return -1;
+		} else {
+			*recipe_name = word;
+		}
+	}
+	return 0;
+}
+
+// Function to stream one line of progress back to the client (MSG_NOSIGNAL: a client that hung up must not kill the request)
+static void send_status(int conn_fd, const char *format, const char *recipe_name, int pid) {
+	char line[COOK_REQUEST_MAX + 64];
+	snprintf(line, sizeof(line), format, recipe_name, pid);
+	send_line(conn_fd, line);
+}
+
+// progress callback of a request: one status line per recipe event
+static void request_progress(COOK_CONTEXT *ctx, const char *recipe_name, COOK_EVENT event,
+	int pid, int completed, int total, void *user_data) {
+	int conn_fd = *(int *)user_data;
+
+	if (event == COOK_RECIPE_STARTED) send_status(conn_fd, "start %s %d\n", recipe_name, pid);
+	else if (event == COOK_RECIPE_COMPLETED) send_status(conn_fd, "done %s\n", recipe_name, pid);
+	else send_status(conn_fd, "failed %s\n", recipe_name, pid);
+}
+
+/*
+	Function run by the child forked for a request: cooks the main recipe using the cached analysis
+	Never returns; the exit status is that of a normal cook run
+*/
+static void run_request(int conn_fd, COOK_CONTEXT *ctx, ANALYSIS_ENTRY *entry, int max_cooks) {
+	// back to the signal setup of a plain cook process before running the main processing loop
+	struct sigaction sa;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	sigset_t empty_mask;
+	sigemptyset(&empty_mask);
+	sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+	// the child's copy of the context cooks with the cached analysis and the daemon's budget
+	RECIPE *recipe = entry->analysis.targets[0];
+	cook_select_target(ctx, recipe->name);
+	ctx->analysis = entry->analysis;
+	ctx->analyzed = 1;
+	ctx->budget = &daemon_budget;
+	cook_set_progress_callback(ctx, request_progress, &conn_fd);
+
+	send_status(conn_fd, "accepted %s %d\n", recipe->name, getpid());
+
+	int status = cook_run(ctx, max_cooks);
+	if (status == COOK_SUCCESS) send_status(conn_fd, "ok %s\n", recipe->name, 0);
+	else send_status(conn_fd, "error %s was not completed\n", recipe->name, 0);
+	flush_log();
+	_exit(status == COOK_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*
+	Function to serve one connection once its request line was read: parse it, look up its analysis and fork
+	the child that cooks it (which closes the listening socket and the other pending connections)
+	Returns 1 if a request child was started and 0 otherwise
+*/
+static int handle_connection(PENDING_REQUEST *connection, PENDING_REQUEST *pending, int listen_fd, COOK_CONTEXT *ctx,
+	ANALYSIS_ENTRY **cache, int max_cooks) {
+	char reply[COOK_REQUEST_MAX + 64];
+	char *recipe_name;
+	int request_cooks;
+	int conn_fd = connection->fd;
+
+	if (parse_request(connection->request, connection->length, &recipe_name, &request_cooks) != 0) {
+		send_line(conn_fd, "error malformed request, expected: cook [main_recipe_name] [-c max_cooks]\n");
+		return 0;
+	}
+
+	RECIPE *recipe = find_recipe(ctx->cookbook, recipe_name);
+	if (recipe == NULL) {
+		snprintf(reply, sizeof(reply), "error recipe '%s' not found in cookbook\n", recipe_name);
+		send_line(conn_fd, reply);
+		return 0;
+	}
+
+	ANALYSIS_ENTRY *entry = get_analysis(cache, ctx->cookbook, recipe);
+	if (entry == NULL || entry->analysis.status != 0) {
+		snprintf(reply, sizeof(reply), "error recipe '%s' has a broken dependency tree\n", recipe->name);
+		send_line(conn_fd, reply);
+		return 0;
+	}
+
+	// a request can ask for fewer cooks than the daemon has, never for more
+	if (request_cooks > max_cooks) request_cooks = max_cooks;
+
+	// the request child streams its progress with blocking sends
+	fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) & ~O_NONBLOCK);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(listen_fd);
+		for (int i = 0; i < PENDING_MAX; i++) {
+			if (pending[i].fd != -1 && &pending[i] != connection) close(pending[i].fd);
+		}
+		run_request(conn_fd, ctx, entry, request_cooks);
+	} else if (pid < 0) {
+		send_line(conn_fd, "error fork failed\n");
+		return 0;
+	}
+	return 1;
+}
+
+// Function to create the listening socket, replacing a stale socket file left by a previous daemon
+static int open_daemon_socket(const char *socket_path) {
+	struct sockaddr_un addr;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR: Socket path '%s' is too long. \n", socket_path);
+		return -1;
+	}
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd == -1) {
+		fprintf(stderr, "ERROR: Failed to create daemon socket: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	unlink(socket_path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, 16) == -1) {
+		fprintf(stderr, "ERROR: Failed to listen on '%s': %s\n", socket_path, strerror(errno));
+		close(listen_fd);
+		return -1;
+	}
+	return listen_fd;
+}
+
+// Function to close a pending connection and free its slot, with a last error line for the client if reply is given
+static void drop_pending(PENDING_REQUEST *pending, const char *reply) {
+	if (reply != NULL) send_line(pending->fd, reply);
+	close(pending->fd);
+	pending->fd = -1;
+}
+
+/*
+	Function to take a new connection into a free pending slot, so its request line is read as it arrives
+	Returns 0, or -1 if every slot is taken (the connection is turned away)
+*/
+static int add_pending(PENDING_REQUEST *pending, int conn_fd) {
+	for (int i = 0; i < PENDING_MAX; i++) {
+		if (pending[i].fd == -1) {
+			fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) | O_NONBLOCK);
+			pending[i].fd = conn_fd;
+			pending[i].length = 0;
+			pending[i].deadline_ms = now_ms() + REQUEST_READ_TIMEOUT * 1000L;
+			return 0;
+		}
+	}
+	send_line(conn_fd, "error daemon busy, too many requests being sent\n");
+	close(conn_fd);
+	return -1;
+}
+
+/*
+	Function to run the daemon until SIGTERM or SIGINT
+	After a stop is requested no new connections are accepted; running requests are allowed to finish
+	The request lines are read as they arrive, a client that is slow to send one never holds up the others
+
+	Returns EXIT_SUCCESS on a clean shutdown and EXIT_FAILURE if the daemon could not start
+*/
+int run_cook_daemon(COOK_CONTEXT *ctx, const char *socket_path, int max_cooks) {
+	ANALYSIS_ENTRY *cache = NULL;
+	PENDING_REQUEST pending[PENDING_MAX];
+	int active_requests = 0;
+
+	for (int i = 0; i < PENDING_MAX; i++) pending[i].fd = -1;
+
+	if (init_token_budget(&daemon_budget, max_cooks) != 0) return EXIT_FAILURE;
+
+	int listen_fd = open_daemon_socket(socket_path);
+	if (listen_fd == -1) {
+		close_token_budget(&daemon_budget);
+		return EXIT_FAILURE;
+	}
+
+	struct sigaction sa;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0; // no SA_RESTART: pselect has to return when one of these arrives
+	sa.sa_handler = daemon_stop_handler;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sa.sa_handler = daemon_sigchld_handler;
+	sigaction(SIGCHLD, &sa, NULL);
+
+	// same strategy as the main processing loop: signals stay blocked except while waiting in pselect
+	sigset_t block_mask, orig_mask;
+	sigemptyset(&block_mask);
+	sigaddset(&block_mask, SIGCHLD);
+	sigaddset(&block_mask, SIGTERM);
+	sigaddset(&block_mask, SIGINT);
+	sigprocmask(SIG_BLOCK, &block_mask, &orig_mask);
+
+	while (!daemon_stop || active_requests > 0) {
+		fd_set read_set;
+		FD_ZERO(&read_set);
+		int max_fd = listen_fd;
+		long first_deadline_ms = -1;
+		if (!daemon_stop) FD_SET(listen_fd, &read_set);
+		for (int i = 0; i < PENDING_MAX; i++) {
+			if (pending[i].fd == -1) continue;
+			FD_SET(pending[i].fd, &read_set);
+			if (pending[i].fd > max_fd) max_fd = pending[i].fd;
+			if (first_deadline_ms == -1 || pending[i].deadline_ms < first_deadline_ms) first_deadline_ms = pending[i].deadline_ms;
+		}
+
+		// wake up for the first pending request that runs out of time
+		struct timespec timeout, *wait_for = NULL;
+		if (first_deadline_ms != -1) {
+			long wait_ms = first_deadline_ms - now_ms();
+			if (wait_ms < 0) wait_ms = 0;
+			timeout.tv_sec = wait_ms / 1000;
+			timeout.tv_nsec = (wait_ms % 1000) * 1000000L;
+			wait_for = &timeout;
+		}
+
+		int ready = pselect(max_fd + 1, &read_set, NULL, NULL, wait_for, &orig_mask);
+
+		int status;
+		while (waitpid(-1, &status, WNOHANG) > 0) {
+			active_requests--;
+		}
+		if (active_requests == 0) {
+			// nobody is holding tokens, recover any lost by a request child that was killed
+			refill_token_budget(&daemon_budget);
+		}
+
+		long current_ms = now_ms();
+		for (int i = 0; i < PENDING_MAX; i++) {
+			if (pending[i].fd == -1) continue;
+			if (daemon_stop) {
+				drop_pending(&pending[i], "error daemon is shutting down\n");
+			} else if (ready > 0 && FD_ISSET(pending[i].fd, &read_set) && read_pending(&pending[i])) {
+				active_requests += handle_connection(&pending[i], pending, listen_fd, ctx, &cache, max_cooks);
+				drop_pending(&pending[i], NULL);
+			} else if (current_ms >= pending[i].deadline_ms) {
+				drop_pending(&pending[i], "error malformed request, expected: cook [main_recipe_name] [-c max_cooks]\n");
+			}
+		}
+
+		if (ready > 0 && !daemon_stop && FD_ISSET(listen_fd, &read_set)) {
+			int conn_fd = accept(listen_fd, NULL, NULL);
+			if (conn_fd == -1) continue;
+			fcntl(conn_fd, F_SETFD, FD_CLOEXEC);
+			add_pending(pending, conn_fd);
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+
+	close(listen_fd);
+	unlink(socket_path);
+	close_token_budget(&daemon_budget);
+	free_analysis_cache(cache);
+	return EXIT_SUCCESS;
+}
+
+/*
+	Function for the client side (cook -S): send one request to a daemon and copy its progress to stdout
+
+	Returns EXIT_SUCCESS if the daemon reported that the main recipe was completed, EXIT_FAILURE otherwise
+*/
+int send_cook_request(const char *socket_path, const char *recipe_name, int max_cooks) {
+	struct sockaddr_un addr;
+	char line[COOK_REQUEST_MAX + 64];
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR: Socket path '%s' is too long. \n", socket_path);
+		return EXIT_FAILURE;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		fprintf(stderr, "ERROR: Failed to create socket: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		fprintf(stderr, "ERROR: Can't connect to cook daemon at '%s': %s\n", socket_path, strerror(errno));
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(line, sizeof(line), "cook %s -c %d\n", recipe_name, max_cooks);
+	send_line(fd, line);
+
+	FILE *replies = fdopen(fd, "r");
+	if (replies == NULL) {
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	int completed = 0;
+	while (fgets(line, sizeof(line), replies) != NULL) {
+		fputs(line, stdout);
+		fflush(stdout);
+		completed = (strncmp(line, "ok ", 3) == 0);
+	}
+	fclose(replies);
+
+	return completed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,202 @@
+/*
+	This is the c file for the placement of cooks on cpu domains (see cpu_placement.h)
+	The topology comes from /sys/devices/system/cpu, only the cpus in the affinity mask cook was started
+	with are used (so cook under taskset or a cpuset cgroup stays inside it)
+*/
+#define _GNU_SOURCE // cpu_set_t and sched_setaffinity
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "cpu_placement.h"
+#include "stack_queue_tree_traversal.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu/cpu%d/%s"
+#define DOMAIN_KEY_MAX 256
+
+static const char *mode_names[] = { "none", "socket", "numa", "llc" };
+
+// Returns the PLACEMENT_MODE with this name, or -1 if there is none
+int parse_placement_mode(const char *name) {
+	for (int i = 0; i < (int)(sizeof(mode_names) / sizeof(mode_names[0])); i++) {
+		if (strcmp(mode_names[i], name) == 0) return i;
+	}
+	return -1;
+}
+
+const char *placement_mode_name(PLACEMENT_MODE mode) {
+	return mode_names[mode];
+}
+
+// reads the first line of a sysfs file of the cpu into key, returns 0 or -1 if there is no such file
+static int read_cpu_file(int cpu, const char *file, char *key) {
+	char path[256];
+	snprintf(path, sizeof(path), SYSFS_CPU, cpu, file);
+	FILE *in = fopen(path, "r");
+	if (in == NULL) return -1;
+	if (fgets(key, DOMAIN_KEY_MAX, in) == NULL) key[0] = '\0';
+	key[strcspn(key, "\n")] = '\0';
+	fclose(in);
+	return 0;
+}
+
+// the NUMA node of a cpu is the nodeN entry in its sysfs directory
+static int read_cpu_node(int cpu, char *key) {
+	char path[256];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	DIR *dir = opendir(path);
+	if (dir == NULL) return -1;
+
+	int found = -1;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "node", 4) == 0) {
+			snprintf(key, DOMAIN_KEY_MAX, "%s", entry->d_name);
+			found = 0;
+			break;
+		}
+	}
+	closedir(dir);
+	return found;
+}
+
+/*
+	Function to work out which domain a cpu belongs to, as a string that is the same for every cpu of the domain
+	A machine without the information (no L3, no NUMA nodes) puts every cpu in one domain
+*/
+static void domain_key(PLACEMENT_MODE mode, int cpu, char *key) {
+	int found = -1;
+	switch (mode) {
+		case PLACEMENT_SOCKET: found = read_cpu_file(cpu, "topology/physical_package_id", key); break;
+		case PLACEMENT_NUMA: found = read_cpu_node(cpu, key); break;
+		case PLACEMENT_LLC: found = read_cpu_file(cpu, "cache/index3/shared_cpu_list", key); break;
+		default: break;
+	}
+	if (found != 0) strcpy(key, "all");
+}
+
+/*
+	Function to read the topology of the cpus cook may run on and split them into domains
+
+	Returns 0 on success and -1 otherwise
+*/
+int init_cpu_placement(CPU_PLACEMENT *placement, PLACEMENT_MODE mode) {
+	memset(placement, 0, sizeof(CPU_PLACEMENT));
+	placement->mode = mode;
+	if (mode == PLACEMENT_NONE) return 0;
+
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+		perror("Failed to read the cpus cook may run on");
+		return -1;
+	}
+
+	int cpu_total = CPU_COUNT(&allowed);
+	char (*keys)[DOMAIN_KEY_MAX] = calloc(cpu_total, DOMAIN_KEY_MAX);
+	placement->domains = calloc(cpu_total, sizeof(CPU_DOMAIN));
+	if (keys == NULL || placement->domains == NULL) {
+		perror("Failed to allocate the cpu domains");
+		free(keys);
+		free_cpu_placement(placement);
+		return -1;
+	}
+
+	for (int cpu = 0; cpu < CPU_SETSIZE && placement->cpu_count < cpu_total; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed)) continue;
+		placement->cpu_count++;
+
+		char key[DOMAIN_KEY_MAX];
+		domain_key(mode, cpu, key);
+		int d = 0;
+		while (d < placement->domain_count && strcmp(keys[d], key) != 0) d++;
+
+		CPU_DOMAIN *domain = &placement->domains[d];
+		if (d == placement->domain_count) {
+			strcpy(keys[d], key);
+			domain->cpus = calloc(cpu_total, sizeof(int));
+			if (domain->cpus == NULL) {
+				perror("Failed to allocate the cpu domains");
+				free(keys);
+				free_cpu_placement(placement);
+				return -1;
+			}
+			placement->domain_count++;
+		}
+		domain->cpus[domain->cpu_count++] = cpu;
+	}
+	free(keys);
+	return 0;
+}
+
+void free_cpu_placement(CPU_PLACEMENT *placement) {
+	for (int d = 0; placement->domains != NULL && d < placement->domain_count; d++) {
+		free(placement->domains[d].cpus);
+	}
+	free(placement->domains);
+	placement->domains = NULL;
+	placement->domain_count = 0;
+}
+
+// domain a is less loaded than domain b (active cooks per cpu, compared without dividing)
+static int less_loaded(CPU_DOMAIN *a, CPU_DOMAIN *b) {
+	return (long)a->active * b->cpu_count < (long)b->active * a->cpu_count;
+}
+
+/*
+	Function to choose the domain the cook of a recipe runs in, just before it is started
+	The sub-recipes vote with the domain they were cooked in; the winner is taken if it still has a cpu
+	without a cook, otherwise the least loaded domain is. The choice is kept in the state of the recipe
+	so its own dependents can follow it
+
+	Returns the domain, or -1 if cooks are not placed
+*/
+int place_recipe(CPU_PLACEMENT *placement, RECIPE *recipe) {
+	if (placement->mode == PLACEMENT_NONE || placement->domain_count == 0) return -1;
+
+	int near = -1, best_votes = 0;
+	int *votes = calloc(placement->domain_count, sizeof(int));
+	for (RECIPE_LINK *dep = recipe->this_depends_on; votes != NULL && dep != NULL; dep = dep->next) {
+		int d = RECIPE_STATE_OF(dep->recipe)->domain - 1;
+		if (d < 0 || d >= placement->domain_count) continue;
+		if (++votes[d] > best_votes) {
+			best_votes = votes[d];
+			near = d;
+		}
+	}
+	free(votes);
+
+	int chosen = near;
+	if (chosen < 0 || placement->domains[chosen].active >= placement->domains[chosen].cpu_count) {
+		chosen = 0;
+		for (int d = 1; d < placement->domain_count; d++) {
+			if (less_loaded(&placement->domains[d], &placement->domains[chosen])) chosen = d;
+		}
+	}
+
+	placement->domains[chosen].active++;
+	placement->placed++;
+	if (chosen == near) placement->placed_near++;
+	RECIPE_STATE_OF(recipe)->domain = chosen + 1;
+	return chosen;
+}
+
+void unplace_recipe(CPU_PLACEMENT *placement, int domain) {
+	if (domain >= 0 && domain < placement->domain_count) placement->domains[domain].active--;
+}
+
+// Function to pin the calling process (and so every process it starts from now on) to the given cpus
+int pin_to_cpus(const int *cpus, int cpu_count) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int i = 0; i < cpu_count; i++) {
+		CPU_SET(cpus[i], &set);
+	}
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int pin_to_domain(CPU_PLACEMENT *placement, int domain) {
+	if (domain < 0 || domain >= placement->domain_count) return 0;
+	return pin_to_cpus(placement->domains[domain].cpus, placement->domains[domain].cpu_count);
+}
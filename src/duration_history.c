@@ -0,0 +1,344 @@
+/*
+	This is the c file for the duration history of a cookbook (see duration_history.h)
+	The cooks time their own tasks and send the durations to the main cook over a pipe, the main cook
+	times the recipes itself and folds everything into the moving averages
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include "duration_history.h"
+#include "stack_queue_tree_traversal.h"
+
+void init_duration_history(DURATION_HISTORY *history) {
+	memset(history, 0, sizeof(DURATION_HISTORY));
+	history->report_read_fd = history->report_write_fd = -1;
+}
+
+/*
+	Function to set up an empty history (nothing cooked yet) for every recipe and task of the cookbook
+	Any history of a cookbook loaded before is forgotten
+
+	Returns 0 on success and -1 if it could not be allocated
+*/
+int start_duration_history(DURATION_HISTORY *history, COOKBOOK *cookbook, const char *cookbook_path) {
+	clear_duration_history(history);
+
+	int count = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next) {
+		count++;
+	}
+	history->recipes = calloc(count, sizeof(DURATION_STAT));
+	history->tasks = calloc(count, sizeof(DURATION_STAT *));
+	history->task_counts = calloc(count, sizeof(int));
+	if (history->recipes == NULL || history->tasks == NULL || history->task_counts == NULL) {
+		perror("Failed to allocate the duration history");
+		clear_duration_history(history);
+		return -1;
+	}
+	history->recipe_count = count;
+
+	int i = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next, i++) {
+		for (TASK *task = recipe->tasks; task != NULL; task = task->next) {
+			history->task_counts[i]++;
+		}
+		history->tasks[i] = calloc(history->task_counts[i] + 1, sizeof(DURATION_STAT));
+		if (history->tasks[i] == NULL) {
+			perror("Failed to allocate the duration history");
+			clear_duration_history(history);
+			return -1;
+		}
+	}
+
+	char resolved[PATH_MAX];
+	history->cookbook_key = strdup(realpath(cookbook_path, resolved) != NULL ? resolved : cookbook_path);
+	if (history->cookbook_key == NULL) {
+		perror("Failed to allocate the duration history");
+		clear_duration_history(history);
+		return -1;
+	}
+	return 0;
+}
+
+void clear_duration_history(DURATION_HISTORY *history) {
+	for (int i = 0; history->tasks != NULL && i < history->recipe_count; i++) {
+		free(history->tasks[i]);
+	}
+	free(history->tasks);
+	free(history->task_counts);
+	free(history->recipes);
+	free(history->cookbook_key);
+	free(history->new_samples);
+	history->new_samples = NULL;
+	history->new_count = history->new_capacity = 0;
+	history->tasks = NULL;
+	history->task_counts = NULL;
+	history->recipes = NULL;
+	history->cookbook_key = NULL;
+	history->recipe_count = 0;
+	history->dirty = 0;
+}
+
+// Returns 1 if any recipe of the cookbook has been timed (the estimates are in milliseconds then)
+int has_durations(DURATION_HISTORY *history) {
+	for (int i = 0; i < history->recipe_count; i++) {
+		if (history->recipes[i].samples > 0) return 1;
+	}
+	return 0;
+}
+
+/*
+	Function to fold one more duration into a moving average (the first sample is taken as it is)
+	The variance is the exponentially weighted one, so a recipe whose times jump around gets a wide spread
+*/
+void add_duration_sample(DURATION_STAT *stat, double duration_ms) {
+	if (stat->samples++ == 0) {
+		stat->mean_ms = duration_ms;
+		stat->var_ms = 0;
+		return;
+	}
+	double diff = duration_ms - stat->mean_ms;
+	stat->mean_ms += HISTORY_ALPHA * diff;
+	stat->var_ms = (1 - HISTORY_ALPHA) * (stat->var_ms + HISTORY_ALPHA * diff * diff);
+}
+
+// Function to keep a sample until the history file is written (a sample that can't be kept is not saved)
+static void keep_new_sample(DURATION_HISTORY *history, int recipe, int task, long duration_ms) {
+	if (history->path == NULL) return;
+	if (history->new_count == history->new_capacity) {
+		int capacity = history->new_capacity > 0 ? 2 * history->new_capacity : 64;
+		NEW_SAMPLE *samples = realloc(history->new_samples, capacity * sizeof(NEW_SAMPLE));
+		if (samples == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate the duration history, a duration is not saved\n");
+			return;
+		}
+		history->new_samples = samples;
+		history->new_capacity = capacity;
+	}
+	NEW_SAMPLE sample = { recipe, task, duration_ms };
+	history->new_samples[history->new_count++] = sample;
+}
+
+void add_recipe_duration(DURATION_HISTORY *history, int recipe, long duration_ms) {
+	if (recipe < 0 || recipe >= history->recipe_count) return;
+	add_duration_sample(&history->recipes[recipe], duration_ms);
+	keep_new_sample(history, recipe, -1, duration_ms);
+	history->dirty = 1;
+}
+
+// finds the stat a history file line is about, NULL if the recipe or task is not in the cookbook
+static DURATION_STAT *stat_of(DURATION_HISTORY *history, COOKBOOK *cookbook, const char *recipe_name, const char *task) {
+	int index = 0;
+	RECIPE *recipe = cookbook->recipes;
+	while (recipe != NULL && strcmp(recipe->name, recipe_name) != 0) {
+		recipe = recipe->next;
+		index++;
+	}
+	if (recipe == NULL) return NULL;
+	if (strcmp(task, "-") == 0) return &history->recipes[index];
+
+	char *end;
+	long task_index = strtol(task, &end, 10);
+	if (*end != '\0' || task_index < 0 || task_index >= history->task_counts[index]) return NULL;
+	return &history->tasks[index][task_index];
+}
+
+/*
+	Function to split a history file line into its six fields (the line is cut up in place)
+
+	Returns 0 if the line has them all and -1 otherwise
+*/
+static int split_history_line(char *line, char **fields) {
+	line[strcspn(line, "\n")] = '\0';
+	for (int i = 0; i < 6; i++) {
+		fields[i] = line;
+		char *tab = strchr(line, '\t');
+		if (i < 5) {
+			if (tab == NULL) return -1;
+			*tab = '\0';
+			line = tab + 1;
+		}
+	}
+	return 0;
+}
+
+// Function to take the stat of a split line of this cookbook, lines of recipes the cookbook no longer has are ignored
+static void read_stat(DURATION_HISTORY *history, COOKBOOK *cookbook, char **fields) {
+	DURATION_STAT *stat = stat_of(history, cookbook, fields[1], fields[2]);
+	if (stat == NULL) return;
+	stat->samples = atol(fields[3]);
+	stat->mean_ms = atof(fields[4]);
+	stat->var_ms = atof(fields[5]);
+}
+
+/*
+	Function to read the history of the cookbook back from the history file (it replaces what is in memory)
+	A missing file is an empty history; lines of other cookbooks, of recipes the cookbook no longer has
+	and broken lines are ignored
+
+	Returns 0 on success and -1 if the file could not be read
+*/
+int load_duration_history(DURATION_HISTORY *history, COOKBOOK *cookbook) {
+	if (history->path == NULL || history->recipes == NULL) return 0;
+
+	FILE *file = fopen(history->path, "r");
+	if (file == NULL) {
+		if (errno == ENOENT) return 0;
+		fprintf(stderr, "ERROR: Can't open the duration history '%s': %s\n", history->path, strerror(errno));
+		return -1;
+	}
+	flock(fileno(file), LOCK_SH);
+
+	char line[HISTORY_LINE_MAX];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *fields[6];
+		if (line[0] == '#' || split_history_line(line, fields) != 0) continue;
+		if (strcmp(fields[0], history->cookbook_key) != 0) continue;
+		read_stat(history, cookbook, fields);
+	}
+	fclose(file); // also drops the lock
+	history->dirty = 0;
+	history->new_count = 0;
+	return 0;
+}
+
+static void write_stat(FILE *out, const char *cookbook_key, const char *recipe_name, int task, DURATION_STAT *stat) {
+	if (stat->samples == 0) return;
+	if (task < 0) fprintf(out, "%s\t%s\t-", cookbook_key, recipe_name);
+	else fprintf(out, "%s\t%s\t%d", cookbook_key, recipe_name, task);
+	fprintf(out, "\t%ld\t%.1f\t%.1f\n", stat->samples, stat->mean_ms, stat->var_ms);
+}
+
+/*
+	Function to write the history of the cookbook to the history file, keeping the lines of other cookbooks
+	The file is locked while it is rewritten, so cooks sharing a history file never mix their lines
+	The cookbook's stats are read again under the lock and the samples added since the last read are folded
+	into them, so the samples another cook saved in the meantime are kept (the memory gets the result too)
+
+	Returns 0 on success (or if there was nothing new to write) and -1 otherwise
+*/
+int save_duration_history(DURATION_HISTORY *history, COOKBOOK *cookbook) {
+	if (history->path == NULL || history->recipes == NULL || !history->dirty) return 0;
+
+	int fd = open(history->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	FILE *file = fd >= 0 ? fdopen(fd, "r+") : NULL;
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: Can't write the duration history '%s': %s\n", history->path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	flock(fd, LOCK_EX);
+
+	// the lines of the other cookbooks are kept as they are
+	char *kept = NULL;
+	size_t kept_size = 0;
+	FILE *keep = open_memstream(&kept, &kept_size);
+	if (keep == NULL) {
+		fprintf(stderr, "ERROR: Can't write the duration history '%s': %s\n", history->path, strerror(errno));
+		fclose(file);
+		return -1;
+	}
+
+	// and this cookbook's lines are what the new samples are folded into
+	for (int i = 0; i < history->recipe_count; i++) {
+		memset(&history->recipes[i], 0, sizeof(DURATION_STAT));
+		memset(history->tasks[i], 0, (history->task_counts[i] + 1) * sizeof(DURATION_STAT));
+	}
+	char line[HISTORY_LINE_MAX];
+	char copy[HISTORY_LINE_MAX];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *fields[6];
+		strcpy(copy, line);
+		if (line[0] == '#' || split_history_line(copy, fields) != 0) continue;
+		if (strcmp(fields[0], history->cookbook_key) != 0) fputs(line, keep);
+		else read_stat(history, cookbook, fields);
+	}
+	fclose(keep);
+	for (int i = 0; i < history->new_count; i++) {
+		NEW_SAMPLE *sample = &history->new_samples[i];
+		if (sample->task < 0) add_duration_sample(&history->recipes[sample->recipe], sample->duration_ms);
+		else add_duration_sample(&history->tasks[sample->recipe][sample->task], sample->duration_ms);
+	}
+	history->new_count = 0;
+
+	rewind(file);
+	int ret = ftruncate(fd, 0);
+	fprintf(file, "# cook duration history: cookbook recipe task samples mean_ms variance_ms2\n");
+	if (kept != NULL) fputs(kept, file);
+	free(kept);
+
+	int i = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next, i++) {
+		write_stat(file, history->cookbook_key, recipe->name, -1, &history->recipes[i]);
+		for (int t = 0; t < history->task_counts[i]; t++) {
+			write_stat(file, history->cookbook_key, recipe->name, t, &history->tasks[i][t]);
+		}
+	}
+
+	if (fflush(file) != 0 || ret != 0) {
+		fprintf(stderr, "ERROR: Can't write the duration history '%s': %s\n", history->path, strerror(errno));
+		ret = -1;
+	}
+	fclose(file); // also drops the lock
+	history->dirty = 0;
+	return ret;
+}
+
+/*
+	Function to open the pipe the cooks of a run send their task durations over
+	Both ends are nonblocking (a cook never waits on a full pipe, the duration is just lost)
+	and close-on-exec so the steps never see them
+
+	Returns 0 on success and -1 otherwise
+*/
+int open_task_reports(DURATION_HISTORY *history) {
+	int fds[2];
+	if (pipe(fds) == -1) {
+		fprintf(stderr, "ERROR: Failed to create the task report pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	history->report_read_fd = fds[0];
+	history->report_write_fd = fds[1];
+	return 0;
+}
+
+void close_task_reports(DURATION_HISTORY *history) {
+	if (history->report_read_fd >= 0) {
+		read_task_reports(history); // cooks reaped last may still have something in the pipe
+		close(history->report_read_fd);
+	}
+	if (history->report_write_fd >= 0) close(history->report_write_fd);
+	history->report_read_fd = history->report_write_fd = -1;
+}
+
+void send_task_report(DURATION_HISTORY *history, int recipe, int task, long duration_ms) {
+	if (history->report_write_fd < 0) return;
+	TASK_REPORT report = { recipe, task, duration_ms };
+	if (write(history->report_write_fd, &report, sizeof(report)) != sizeof(report)) {
+		// the pipe is full, the main cook has not caught up: this duration is not worth waiting for
+	}
+}
+
+// Function to fold every task duration waiting in the report pipe into the history
+void read_task_reports(DURATION_HISTORY *history) {
+	TASK_REPORT report;
+	if (history->report_read_fd < 0) return;
+
+	while (read(history->report_read_fd, &report, sizeof(report)) == sizeof(report)) {
+		if (report.recipe < 0 || report.recipe >= history->recipe_count) continue;
+		if (report.task < 0 || report.task >= history->task_counts[report.recipe]) continue;
+		add_duration_sample(&history->tasks[report.recipe][report.task], report.duration_ms);
+		keep_new_sample(history, report.recipe, report.task, report.duration_ms);
+		history->dirty = 1;
+	}
+}
@@ -0,0 +1,82 @@
+/*
+	This is the c file for the latency histograms of the scheduler (see latency_histogram.h)
+	A value below HISTOGRAM_SUB_COUNT has a slot of its own; above, the slot is picked by the position of
+	its highest bit (the power of two) and the HISTOGRAM_SUB_BITS bits below it
+*/
+#include <string.h>
+#include <time.h>
+
+#include "latency_histogram.h"
+
+static const char *latency_names[LATENCY_COUNT] = { "sigchld to reap", "reap to queue updated", "ready to fork" };
+
+long long latency_now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void reset_latencies(SCHEDULER_LATENCIES *latencies) {
+	int enabled = latencies->enabled;
+	memset(latencies, 0, sizeof(SCHEDULER_LATENCIES));
+	latencies->enabled = enabled;
+}
+
+static int slot_of(long long ns) {
+	if (ns < HISTOGRAM_SUB_COUNT) return ns > 0 ? (int)ns : 0;
+	int shift = 63 - __builtin_clzll(ns) - HISTOGRAM_SUB_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_COUNT + (int)((ns >> shift) - HISTOGRAM_SUB_COUNT);
+}
+
+// largest value that falls in a slot
+static long long highest_of(int slot) {
+	if (slot < HISTOGRAM_SUB_COUNT) return slot;
+	int shift = slot / HISTOGRAM_SUB_COUNT - 1;
+	long long lowest = (long long)(HISTOGRAM_SUB_COUNT + slot % HISTOGRAM_SUB_COUNT) << shift;
+	return lowest + (1LL << shift) - 1;
+}
+
+void record_latency(SCHEDULER_LATENCIES *latencies, int which, long long ns) {
+	if (!latencies->enabled || which < 0 || which >= LATENCY_COUNT) return;
+	LATENCY_HISTOGRAM *histogram = &latencies->histograms[which];
+	if (ns < 0) ns = 0;
+	histogram->counts[slot_of(ns)]++;
+	histogram->count++;
+	if (ns > histogram->max_ns) histogram->max_ns = ns;
+}
+
+/*
+	Function to find the latency that percentile of the recorded values are at or below (50 for the median)
+
+	Returns it rounded up to the end of its slot (never past the largest value), 0 if nothing was recorded
+*/
+long long latency_percentile(LATENCY_HISTOGRAM *histogram, double percentile) {
+	if (histogram->count == 0) return 0;
+	long long wanted = (long long)(histogram->count * percentile / 100.0 + 0.999999), seen = 0;
+	if (wanted < 1) wanted = 1;
+	for (int slot = 0; slot < HISTOGRAM_SLOTS; slot++) {
+		seen += histogram->counts[slot];
+		if (seen >= wanted) {
+			long long value = highest_of(slot);
+			return value < histogram->max_ns ? value : histogram->max_ns;
+		}
+	}
+	return histogram->max_ns;
+}
+
+/*
+	Function to print p50, p99 and max of every latency of the last run, in milliseconds
+
+	LATENCY (cookbook.ckb)            count       p50       p99       max
+	sigchld to reap                      14   0.031ms   0.052ms   0.052ms
+*/
+void print_latencies(SCHEDULER_LATENCIES *latencies, const char *label, FILE *out) {
+	char title[256];
+	snprintf(title, sizeof(title), "LATENCY (%s)", label);
+	fprintf(out, "%-32s %7s %11s %11s %11s\n", title, "count", "p50", "p99", "max");
+	for (int which = 0; which < LATENCY_COUNT; which++) {
+		LATENCY_HISTOGRAM *histogram = &latencies->histograms[which];
+		fprintf(out, "%-32s %7lld %9.3fms %9.3fms %9.3fms\n", latency_names[which], histogram->count,
+			latency_percentile(histogram, 50) / 1e6, latency_percentile(histogram, 99) / 1e6, histogram->max_ns / 1e6);
+	}
+}
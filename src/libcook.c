@@ -0,0 +1,637 @@
+/*
+	libcook: context management and the public entry points of the cook library
+	Everything a run needs (cookbook, targets, analysis, work queue, completed list, cooks)
+	hangs off the COOK_CONTEXT, so several contexts can be used by one program
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+#include "libcook.h"
+#include "signal_process_handling.h"
+#include "run_report.h"
+
+COOK_CONTEXT *cook_context_new(void) {
+	COOK_CONTEXT *ctx = calloc(1, sizeof(COOK_CONTEXT));
+	if (ctx == NULL) return NULL;
+	ctx->jobserver.read_fd = ctx->jobserver.write_fd = -1;
+	ctx->jobserver.shared_read_fd = ctx->jobserver.shared_write_fd = -1;
+	init_duration_history(&ctx->history);
+	init_trace(&ctx->own_trace);
+	init_run_usage(&ctx->usage);
+	init_status_page(&ctx->status);
+	return ctx;
+}
+
+void cook_context_free(COOK_CONTEXT *ctx) {
+	if (ctx == NULL) return;
+	free_analysis(&ctx->analysis);
+	free_adaptive_limit(&ctx->adaptive);
+	if (ctx->jobserver.jobserver != JOBSERVER_NONE) close_token_budget(&ctx->jobserver);
+	free_cookbook(ctx->cookbook);
+	free_resources(&ctx->resources);
+	free(ctx->cookbook_path);
+	free(ctx->targets);
+	clear_duration_history(&ctx->history);
+	free(ctx->history.path);
+	free_cpu_placement(&ctx->placement);
+	close_trace(&ctx->own_trace);
+	clear_run_usage(&ctx->usage);
+	close_status_page(&ctx->status);
+	free(ctx);
+}
+
+/*
+	Function to run the cycle check and the analysis phase for the targets of a run
+	The recipe states are cleared before and after so that neither pass sees marks left by another
+	A sub-recipe shared by several targets shows up once in required, so it is only cooked once
+
+	Returns 0 and fills in the analysis if the targets can be cooked, -1 otherwise (analysis->status is -1)
+*/
+int analyze_targets(COOKBOOK *cookbook, RECIPE **targets, int target_count, COOK_ANALYSIS *analysis) {
+	memset(analysis, 0, sizeof(COOK_ANALYSIS));
+
+	int cookbook_size = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next) {
+		cookbook_size++;
+	}
+	analysis->targets = calloc(target_count, sizeof(RECIPE *));
+	analysis->required = calloc(cookbook_size, sizeof(RECIPE *));
+	if (analysis->targets == NULL || analysis->required == NULL) {
+		perror("Failed to allocate the analysis");
+		free_analysis(analysis);
+		analysis->status = -1;
+		return -1;
+	}
+	memcpy(analysis->targets, targets, target_count * sizeof(RECIPE *));
+	analysis->target_count = target_count;
+
+	// check for the edge case of circular dependency in the tree cookbook data structure (for every target)
+	for (int i = 0; i < target_count; i++) {
+		initialize_cookbook_states(cookbook);
+		if (check_circular_tree_cycle(targets[i]) != 0) {
+			analysis->status = -1;
+			initialize_cookbook_states(cookbook);
+			return -1;
+		}
+	}
+	initialize_cookbook_states(cookbook);
+
+	// ANALYSIS PHASE: STACK struct for recursive tree traversal and WORK QUEUE implemented
+	WORK_QUEUE *work_queue = init_work_queue(); // only used to collect the leaf nodes
+	if (work_queue == NULL) {
+		analysis->status = -1;
+		return -1;
+	}
+	analysis->recipe_count = stack_analysis_traversal_targets(targets, target_count, work_queue, analysis->required);
+	initialize_cookbook_states(cookbook);
+	if (analysis->recipe_count < 0) {
+		free_work_queue(work_queue);
+		analysis->status = -1;
+		return -1;
+	}
+
+	analysis->leaf_count = work_queue_size(work_queue);
+
+	if (analysis->leaf_count == 0) {
+		fprintf(stderr, "ERROR: No Leaf Nodes Detected from Tree Traversal - Work Queue initialized to empty when should be populated with leaf nodes\n");
+		free_work_queue(work_queue);
+		analysis->status = -1;
+		return -1;
+	}
+
+	analysis->leaves = calloc(analysis->leaf_count, sizeof(RECIPE *));
+	if (analysis->leaves == NULL) {
+		perror("Failed to allocate leaf recipes array");
+		free_work_queue(work_queue);
+		analysis->status = -1;
+		return -1;
+	}
+	for (int i = 0; i < analysis->leaf_count; i++) {
+		analysis->leaves[i] = dequeue(work_queue);
+	}
+	free_work_queue(work_queue);
+	return 0;
+}
+
+void free_analysis(COOK_ANALYSIS *analysis) {
+	free(analysis->targets);
+	free(analysis->required);
+	free(analysis->leaves);
+	memset(analysis, 0, sizeof(COOK_ANALYSIS));
+}
+
+// Function to hand a change of recipe state to the progress callback of the context
+void report_progress(COOK_CONTEXT *ctx, RECIPE *recipe, COOK_EVENT event, pid_t pid) {
+	if (ctx->progress == NULL) return;
+	ctx->progress(ctx, recipe->name, event, pid, ctx->completed_count, ctx->analysis.recipe_count, ctx->progress_data);
+}
+
+/*
+	Function to parse a cookbook file into the context, replacing any cookbook loaded before
+
+	Returns COOK_SUCCESS, or COOK_FAILURE if the file can't be read or doesn't parse
+*/
+int cook_load_cookbook(COOK_CONTEXT *ctx, const char *path) {
+	int err = 0;
+	FILE *file_open;
+	long long started_ns = latency_now_ns();
+
+	// PARSING THE COOKBOOK
+	if ((file_open = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "ERROR: Can't open cookbook '%s': %s\n", path, strerror(errno));
+		return COOK_FAILURE;
+	}
+
+	// resource annotations (#@ lines) are not cookbook syntax, the parser only gets the rest
+	COOK_RESOURCES resources = { 0 };
+	char *stripped_text;
+	FILE *cookbook_text = strip_resource_annotations(file_open, &resources, &stripped_text);
+	if (cookbook_text == NULL) {
+		fprintf(stderr, "ERROR: error reading the resource annotations of cookbook '%s'\n", path);
+		fclose(file_open);
+		free_resources(&resources);
+		return COOK_FAILURE;
+	}
+
+	COOKBOOK *cookbook_parsed = parse_cookbook(cookbook_text, &err); // the result is the cookbook data structure
+	fclose(cookbook_text);
+	free(stripped_text);
+	if (!err && resolve_resource_annotations(&resources, cookbook_parsed) != 0) err = 1;
+	if (err) { // err non zero value because error detected in parsing the cookbook
+		fprintf(stderr, "ERROR: error parsing cookbook '%s'\n", path);
+		fclose(file_open); // close the file after an error is caught
+		free_cookbook(cookbook_parsed);
+		free_resources(&resources);
+		return COOK_FAILURE;
+	}
+
+	// CLOSING INPUT STREAM
+	if (fclose(file_open) != 0) { // close the file and handle if there is an error
+		fprintf(stderr, "ERROR: error in closing the file after parsed. \n");
+		free_cookbook(cookbook_parsed); // cookbook was parsed and mem allocated correctly but now since file can't be closed must free cookbook stuff
+		free_resources(&resources);
+		return COOK_FAILURE;
+	}
+
+	if (initialize_cookbook_states(cookbook_parsed) != 0) {
+		free_cookbook(cookbook_parsed);
+		free_resources(&resources);
+		return COOK_FAILURE;
+	}
+
+	free_analysis(&ctx->analysis);
+	free_cookbook(ctx->cookbook);
+	free_resources(&ctx->resources);
+	free(ctx->cookbook_path);
+	ctx->cookbook = cookbook_parsed;
+	ctx->resources = resources;
+	ctx->cookbook_path = strdup(path);
+	clear_duration_history(&ctx->history); // set up again for the new cookbook by its first run
+	ctx->target_count = 0;
+	ctx->analyzed = 0;
+	ctx->timings.parse_ms = (latency_now_ns() - started_ns) / 1e6;
+	return COOK_SUCCESS;
+}
+
+/*
+	Function to select the main recipe of the next runs, replacing any targets selected before
+	If recipe_name is empty or NULL, the first recipe in the cookbook is selected
+
+	Returns COOK_SUCCESS, or COOK_FAILURE if there is no such recipe in the loaded cookbook
+*/
+int cook_select_target(COOK_CONTEXT *ctx, const char *recipe_name) {
+	RECIPE *recipe = find_recipe(ctx->cookbook, recipe_name);
+	if (recipe == NULL) return COOK_FAILURE;
+
+	if (ctx->target_count == 1 && ctx->targets[0] == recipe) return COOK_SUCCESS;
+
+	ctx->target_count = 0;
+	return cook_add_target(ctx, recipe_name);
+}
+
+/*
+	Function to add one more main recipe to the targets of the next runs
+	All targets are cooked by one run under one max_cooks budget, a recipe added twice is only cooked once
+
+	Returns COOK_SUCCESS, or COOK_FAILURE if there is no such recipe in the loaded cookbook
+*/
+int cook_add_target(COOK_CONTEXT *ctx, const char *recipe_name) {
+	RECIPE *recipe = find_recipe(ctx->cookbook, recipe_name);
+	if (recipe == NULL) return COOK_FAILURE;
+
+	for (int i = 0; i < ctx->target_count; i++) {
+		if (ctx->targets[i] == recipe) return COOK_SUCCESS;
+	}
+
+	if (ctx->target_count == ctx->target_capacity) {
+		int capacity = ctx->target_capacity == 0 ? 4 : ctx->target_capacity * 2;
+		RECIPE **targets = realloc(ctx->targets, capacity * sizeof(RECIPE *));
+		if (targets == NULL) {
+			perror("Failed to allocate the targets array");
+			return COOK_FAILURE;
+		}
+		ctx->targets = targets;
+		ctx->target_capacity = capacity;
+	}
+	ctx->targets[ctx->target_count++] = recipe;
+
+	free_analysis(&ctx->analysis);
+	ctx->analyzed = 0;
+	return COOK_SUCCESS;
+}
+
+void cook_set_progress_callback(COOK_CONTEXT *ctx, cook_progress_callback callback, void *user_data) {
+	ctx->progress = callback;
+	ctx->progress_data = user_data;
+}
+
+void cook_set_completion_callback(COOK_CONTEXT *ctx, cook_completion_callback callback, void *user_data) {
+	ctx->completion = callback;
+	ctx->completion_data = user_data;
+}
+
+// Function to end a run: calls the completion callback and passes the status through
+static int finish_run(COOK_CONTEXT *ctx, int status) {
+	if (ctx->completion != NULL) ctx->completion(ctx, status, ctx->completion_data);
+	return status;
+}
+
+/*
+	Function to set how big a share of a pool of cooks the context gets (see cook_run_pool)
+
+	Returns COOK_SUCCESS, or COOK_FAILURE if the weight is not positive
+*/
+int cook_set_weight(COOK_CONTEXT *ctx, int weight) {
+	if (weight <= 0) return COOK_FAILURE;
+	ctx->weight = weight;
+	return COOK_SUCCESS;
+}
+
+int cook_set_policy(COOK_CONTEXT *ctx, const char *policy_name) {
+	const SCHEDULING_POLICY *policy = find_scheduling_policy(policy_name);
+	if (policy == NULL) {
+		fprintf(stderr, "ERROR: Unknown scheduling policy '%s', the policies are: \n", policy_name);
+		print_scheduling_policies(stderr);
+		return COOK_FAILURE;
+	}
+	ctx->policy = policy;
+	return COOK_SUCCESS;
+}
+
+int cook_set_history(COOK_CONTEXT *ctx, const char *path) {
+	char *copy = NULL;
+	if (path != NULL && (copy = strdup(path)) == NULL) return COOK_FAILURE;
+	free(ctx->history.path);
+	ctx->history.path = copy;
+	return COOK_SUCCESS;
+}
+
+void cook_set_eta(COOK_CONTEXT *ctx, int show_eta) {
+	ctx->show_eta = show_eta;
+}
+
+long cook_estimate_remaining_ms(COOK_CONTEXT *ctx) {
+	return estimate_remaining_ms(ctx, monotonic_ms());
+}
+
+void cook_set_timeout(COOK_CONTEXT *ctx, long timeout_ms) {
+	ctx->timeout_ms = timeout_ms > 0 ? timeout_ms : 0;
+}
+
+void cook_set_speculation(COOK_CONTEXT *ctx, int speculate) {
+	ctx->speculate = speculate;
+}
+
+void cook_set_retries(COOK_CONTEXT *ctx, int retries, long backoff_ms) {
+	ctx->retries = retries > 0 ? retries : 0;
+	ctx->retry_backoff_ms = backoff_ms > 0 ? backoff_ms : 0;
+}
+
+int cook_set_trace(COOK_CONTEXT *ctx, const char *path) {
+	if (open_trace(&ctx->own_trace, path) != 0) return COOK_FAILURE;
+	ctx->trace = &ctx->own_trace;
+	return COOK_SUCCESS;
+}
+
+void cook_share_trace(COOK_CONTEXT *ctx, COOK_CONTEXT *owner) {
+	ctx->trace = owner->trace;
+}
+
+void cook_set_mem_floor(COOK_CONTEXT *ctx, long mem_floor_kb) {
+	ctx->mem_floor_kb = mem_floor_kb > 0 ? mem_floor_kb : 0;
+}
+
+void cook_set_critical_boost(COOK_CONTEXT *ctx, int critical_boost) {
+	ctx->critical_boost = critical_boost;
+}
+
+int cook_set_placement(COOK_CONTEXT *ctx, const char *mode_name) {
+	int mode = parse_placement_mode(mode_name);
+	if (mode < 0) {
+		fprintf(stderr, "ERROR: Unknown placement '%s' (expected none, socket, numa or llc). \n", mode_name);
+		return COOK_FAILURE;
+	}
+	free_cpu_placement(&ctx->placement);
+	return init_cpu_placement(&ctx->placement, mode) == 0 ? COOK_SUCCESS : COOK_FAILURE;
+}
+
+void cook_set_keep_going(COOK_CONTEXT *ctx, int keep_going) {
+	ctx->keep_going = keep_going;
+}
+
+void cook_set_auto_cooks(COOK_CONTEXT *ctx, int min_cooks) {
+	ctx->auto_min_cooks = min_cooks > 0 ? min_cooks : 0;
+}
+
+int cook_create_jobserver(COOK_CONTEXT *ctx, int max_cooks, int use_fifo) {
+	if (max_cooks <= 0 || ctx->jobserver.jobserver != JOBSERVER_NONE) return COOK_FAILURE;
+	if (init_jobserver(&ctx->jobserver, max_cooks, use_fifo ? JOBSERVER_FIFO : JOBSERVER_PIPE) != 0) return COOK_FAILURE;
+	ctx->budget = &ctx->jobserver;
+	return COOK_SUCCESS;
+}
+
+int cook_join_jobserver(COOK_CONTEXT *ctx) {
+	if (ctx->jobserver.jobserver != JOBSERVER_NONE) return COOK_FAILURE;
+	if (!join_jobserver(&ctx->jobserver, getenv("MAKEFLAGS"))) return COOK_FAILURE;
+	ctx->budget = &ctx->jobserver;
+	return COOK_SUCCESS;
+}
+
+void cook_share_jobserver(COOK_CONTEXT *ctx, COOK_CONTEXT *owner) {
+	ctx->budget = owner->budget;
+}
+
+void cook_print_summary(COOK_CONTEXT *ctx, FILE *out) {
+	print_run_summary(ctx, out);
+}
+
+int cook_summary_pending(COOK_CONTEXT *ctx) {
+	return ctx->timed_out_count > 0 || ctx->retry_count > 0 || ctx->throttled_count > 0;
+}
+
+void cook_set_usage(COOK_CONTEXT *ctx, int steps) {
+	ctx->usage.steps = steps;
+}
+
+void cook_set_perf_counters(COOK_CONTEXT *ctx, int counters) {
+	ctx->usage.counters = counters;
+}
+
+void cook_print_timings(COOK_CONTEXT *ctx, FILE *out) {
+	print_run_timings(ctx, out);
+	fflush(out);
+}
+
+void cook_write_timings_json(COOK_CONTEXT *ctx, FILE *out) {
+	write_run_timings_json(ctx, out);
+}
+
+void cook_set_latency(COOK_CONTEXT *ctx, int enabled) {
+	ctx->latency.enabled = enabled;
+}
+
+void cook_print_latency(COOK_CONTEXT *ctx, FILE *out) {
+	print_latencies(&ctx->latency, ctx->cookbook_path, out);
+	fflush(out);
+}
+
+int cook_set_status_page(COOK_CONTEXT *ctx, const char *path) {
+	return set_status_path(&ctx->status, path) == 0 ? COOK_SUCCESS : COOK_FAILURE;
+}
+
+// Function to (re)map the status page for a run of max_cooks cooks, a page that can't be written is left out
+static void start_status_page(COOK_CONTEXT *ctx, int max_cooks) {
+	if (ctx->status.path == NULL) return;
+
+	int count = 0;
+	for (RECIPE *recipe = ctx->cookbook->recipes; recipe != NULL; recipe = recipe->next) count++;
+	char **names = calloc(count > 0 ? count : 1, sizeof(char *));
+	if (names == NULL) return;
+	count = 0;
+	for (RECIPE *recipe = ctx->cookbook->recipes; recipe != NULL; recipe = recipe->next) names[count++] = recipe->name;
+
+	if (map_status_page(&ctx->status, ctx->cookbook_path, names, count, max_cooks) == 0 && ctx->status.map != NULL) {
+		begin_status_update(&ctx->status);
+		ctx->status.header->total = ctx->analysis.recipe_count;
+		ctx->status.header->started_ms = ctx->status.header->updated_ms = monotonic_ms();
+		ctx->status.header->running = 1;
+		end_status_update(&ctx->status);
+	}
+	free(names);
+}
+
+void cook_print_usage(COOK_CONTEXT *ctx, FILE *out) {
+	if (ctx->cookbook == NULL) return;
+	print_run_usage(&ctx->usage, ctx->cookbook, ctx->cookbook_path, out);
+	fflush(out);
+}
+
+void cook_write_usage_json(COOK_CONTEXT *ctx, FILE *out) {
+	if (ctx->cookbook == NULL) return;
+	write_run_usage_json(&ctx->usage, ctx->cookbook, ctx->cookbook_path, out);
+}
+
+/*
+	Function to get the user + system time of this process (the main cook) so far, and its max RSS if peak_rss_kb
+	is given: VmHWM, ru_maxrss would be the one of the program that exec'd cook if that one was bigger
+*/
+static double process_cpu_ms(long *peak_rss_kb) {
+	struct rusage self;
+	if (getrusage(RUSAGE_SELF, &self) != 0) return 0;
+	if (peak_rss_kb != NULL) {
+		*peak_rss_kb = self.ru_maxrss;
+		char line[128];
+		FILE *status = fopen("/proc/self/status", "r");
+		while (status != NULL && fgets(line, sizeof(line), status) != NULL) {
+			if (sscanf(line, "VmHWM: %ld", peak_rss_kb) == 1) break;
+		}
+		if (status != NULL) fclose(status);
+	}
+	return (self.ru_utime.tv_sec + self.ru_stime.tv_sec) * 1000.0 + (self.ru_utime.tv_usec + self.ru_stime.tv_usec) / 1000.0;
+}
+
+// Function to free the work queue, completed list and cook slots of a run (the queue is empty once the loop returns)
+static void end_run(COOK_CONTEXT *ctx) {
+	if (ctx->timings.started_ns > 0) {
+		ctx->timings.run_ms = (latency_now_ns() - ctx->timings.started_ns) / 1e6;
+		ctx->timings.cpu_ms = process_cpu_ms(&ctx->timings.peak_rss_kb) - ctx->timings.cpu_started_ms;
+		ctx->timings.started_ns = 0;
+	}
+	free_work_queue(ctx->work_queue);
+	close_task_reports(&ctx->history);
+	close_usage_reports(&ctx->usage);
+	if (ctx->status.map != NULL) {
+		begin_status_update(&ctx->status);
+		ctx->status.header->running = 0;
+		ctx->status.header->active_cooks = 0;
+		end_status_update(&ctx->status);
+	}
+	save_duration_history(&ctx->history, ctx->cookbook);
+	free(ctx->completed_recipes);
+	free(ctx->retrying);
+	free(ctx->slots);
+	ctx->work_queue = NULL;
+	ctx->completed_recipes = NULL;
+	ctx->retrying = NULL;
+	ctx->slots = NULL;
+}
+
+/*
+	Function to get a context ready for the main processing loop with max_cooks cook slots
+	The analysis is done on the first run and reused by later runs of the same targets
+
+	Returns 0 if the run can start and -1 otherwise (nothing is left allocated then)
+*/
+static int start_run(COOK_CONTEXT *ctx, int max_cooks) {
+	if (ctx->cookbook == NULL) {
+		fprintf(stderr, "ERROR: No cookbook has been loaded. \n");
+		return -1;
+	}
+	if (ctx->target_count == 0 && cook_select_target(ctx, NULL) != COOK_SUCCESS) {
+		return -1;
+	}
+
+	ctx->timings.analysis_ms = 0;
+	if (!ctx->analyzed) {
+		long long started_ns = latency_now_ns();
+		analyze_targets(ctx->cookbook, ctx->targets, ctx->target_count, &ctx->analysis);
+		ctx->analyzed = 1;
+		ctx->timings.analysis_ms = (latency_now_ns() - started_ns) / 1e6;
+	}
+	if (ctx->analysis.status != 0) {
+		return -1;
+	}
+
+	if (ctx->history.recipes == NULL &&
+		start_duration_history(&ctx->history, ctx->cookbook, ctx->cookbook_path) != 0) {
+		return -1;
+	}
+	load_duration_history(&ctx->history, ctx->cookbook); // picks up what other cooks (or a daemon request) added
+
+	if (initialize_cookbook_states(ctx->cookbook) != 0) {
+		return -1;
+	}
+	int index = 0;
+	for (RECIPE *recipe = ctx->cookbook->recipes; recipe != NULL; recipe = recipe->next) {
+		RECIPE_STATE_OF(recipe)->index = index++;
+	}
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE_STATE_OF(ctx->analysis.required[i])->required = 1; // update_work_queue only queues these
+	}
+	apply_resource_annotations(&ctx->resources, max_cooks);
+	ctx->group_cooks = ctx->timeout_ms > 0 || ctx->speculate;
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		if (RECIPE_STATE_OF(ctx->analysis.required[i])->timeout_ms > 0) ctx->group_cooks = 1;
+	}
+	prioritize_recipes(ctx); // before the leaves are queued, the queue takes the priority a recipe has then
+	ctx->critical_count = ctx->critical_boost || ctx->resources.classes_given ? boost_critical_path(ctx) : 0;
+
+	// Initializing the work queue
+	ctx->work_queue = init_work_queue(); // work queue will be edited as recipe subrecipes have dependencies completed
+	if (ctx->work_queue == NULL) {
+		end_run(ctx);
+		return -1;
+	}
+	ctx->work_queue->stamp_ready = ctx->latency.enabled;
+	reset_latencies(&ctx->latency);
+	for (int i = 0; i < ctx->analysis.leaf_count; i++) {
+		if (enqueue(ctx->work_queue, ctx->analysis.leaves[i]) != 0) { // initially populated with the leaf nodes
+			end_run(ctx);
+			return -1;
+		}
+	}
+
+	ctx->completed_recipes = calloc(ctx->analysis.recipe_count, sizeof(RECIPE *));
+	ctx->retrying = calloc(ctx->analysis.recipe_count, sizeof(RECIPE *));
+	ctx->slots = calloc(max_cooks, sizeof(COOK_SLOT));
+	if (ctx->completed_recipes == NULL || ctx->retrying == NULL || ctx->slots == NULL || open_task_reports(&ctx->history) != 0 ||
+		start_run_usage(&ctx->usage, ctx->cookbook, max_cooks, monotonic_ms()) != 0 ||
+		((ctx->usage.steps || ctx->usage.counters) && open_usage_reports(&ctx->usage) != 0)) {
+		perror("Failed to allocate completed recipes array");
+		end_run(ctx);
+		return -1;
+	}
+	ctx->completed_count = 0;
+	ctx->active_cooks = 0;
+	ctx->active_units = 0;
+	ctx->started_count = 0;
+	ctx->failed = 0;
+	ctx->failed_count = 0;
+	ctx->timed_out_count = 0;
+	ctx->backup_count = 0;
+	ctx->backup_wins = 0;
+	ctx->retrying_count = 0;
+	ctx->retry_count = 0;
+	ctx->throttled_count = 0;
+	ctx->mem_sampled_ms = 0;
+	if (ctx->trace != NULL) ctx->trace_track = add_trace_tracks(ctx->trace, max_cooks, ctx->cookbook_path);
+	ctx->placement.placed = 0;
+	ctx->placement.placed_near = 0;
+	for (int d = 0; d < ctx->placement.domain_count; d++) {
+		ctx->placement.domains[d].active = 0;
+	}
+	ctx->max_cooks = max_cooks;
+	start_status_page(ctx, max_cooks);
+	ctx->timings.started_ns = latency_now_ns();
+	ctx->timings.cpu_started_ms = process_cpu_ms(NULL);
+	return 0;
+}
+
+/*
+	Function to cook the selected targets (the first recipe if none was selected) with up to max_cooks cooks
+
+	Returns COOK_SUCCESS if every target was completed, COOK_FAILURE otherwise
+*/
+int cook_run(COOK_CONTEXT *ctx, int max_cooks) {
+	if (max_cooks <= 0) {
+		fprintf(stderr, "ERROR: Invalid number of cooks specified. \n");
+		return finish_run(ctx, COOK_FAILURE);
+	}
+	if (start_run(ctx, max_cooks) != 0) {
+		return finish_run(ctx, COOK_FAILURE);
+	}
+
+	// MAIN PROCESSING LOOP
+	int status = main_processing_loop(ctx) == 0 ? COOK_SUCCESS : COOK_FAILURE;
+
+	// FREE WORK QUEUE STRUCTURE AND LIST STRUCTURES (just lists of pointers)
+	end_run(ctx);
+
+	return finish_run(ctx, status);
+}
+
+int cook_run_pool(COOK_CONTEXT **ctxs, int count, int max_cooks) {
+	int status = COOK_SUCCESS;
+
+	if (max_cooks <= 0) {
+		fprintf(stderr, "ERROR: Invalid number of cooks specified. \n");
+		for (int i = 0; i < count; i++) finish_run(ctxs[i], COOK_FAILURE);
+		return COOK_FAILURE;
+	}
+
+	// a context that can't start fails alone, the others are still cooked
+	COOK_CONTEXT **running = calloc(count, sizeof(COOK_CONTEXT *));
+	if (running == NULL) {
+		perror("Failed to allocate the pool");
+		for (int i = 0; i < count; i++) finish_run(ctxs[i], COOK_FAILURE);
+		return COOK_FAILURE;
+	}
+	int running_count = 0;
+	for (int i = 0; i < count; i++) {
+		if (start_run(ctxs[i], max_cooks) == 0) running[running_count++] = ctxs[i];
+		else ctxs[i]->failed = 1;
+	}
+
+	// MAIN PROCESSING LOOP (shared by all of the contexts)
+	if (running_count > 0) pool_processing_loop(running, running_count, max_cooks);
+	free(running);
+
+	for (int i = 0; i < count; i++) {
+		end_run(ctxs[i]);
+		if (finish_run(ctxs[i], ctxs[i]->failed ? COOK_FAILURE : COOK_SUCCESS) != COOK_SUCCESS) status = COOK_FAILURE;
+	}
+	return status;
+}
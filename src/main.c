@@ -3,8 +3,11 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <limits.h>
 
+#include "libcook.h"
 #include "signal_process_handling.h"
+#include "cook_daemon.h"
 
 int main(int argc, char *argv[]) {
     /*
@@ -13,90 +16,197 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "AT START! (main process) Current Process ID: %d\n", cpid);
     fprintf(stderr, "AT START! Parent Process ID: %d\n", ppid);
     */
-    int err = 0;
-    FILE *file_open;
-
-    char *cookbook = "cookbook.ckb";
-    char *recipe_name = "";
-    int max_cooks = 1;
+    COOK_OPTIONS options = { 0 };
 
     // VALIDATE the command line arguments
-    if ((max_cooks = validargs(&cookbook, &recipe_name, argc, argv)) == -1) {
+    if (validargs(&options, argc, argv) == -1) {
         fprintf(stderr, "ERROR: Invalid argument combination passed on command line - failed to validate. \n");
+        free_options(&options);
         exit(EXIT_FAILURE);
     }
 
-    // PARSING THE COOKBOOK
-    if((file_open = fopen(cookbook, "r")) == NULL) {
-       fprintf(stderr, "ERROR: Can't open cookbook '%s': %s\n", cookbook, strerror(errno));
-       exit(EXIT_FAILURE);
-    }
-
-    COOKBOOK *cookbook_parsed;
+    COOK_JOB_OPTIONS *first = &options.jobs[0];
 
-    cookbook_parsed = parse_cookbook(file_open, &err); // the result is the cookbook data structure
-    if(err) { // err non zero value because error detected in parsing the cookbook
-       fprintf(stderr, "ERROR: error parsing cookbook '%s'\n", cookbook);
-       fclose(file_open); // close the file after an error is caught
-       exit(EXIT_FAILURE);
+    // CLIENT OF A COOK DAEMON: the daemon already has the cookbook parsed, just send the request
+    if (options.request_socket != NULL) {
+        int request_status = send_cook_request(options.request_socket,
+            first->recipe_count > 0 ? first->recipe_names[0] : "", options.max_cooks);
+        free_options(&options);
+        exit(request_status);
     }
 
-    // fprintf(stderr, "%s\n", cookbook_parsed->recipes->tasks->steps->words[0]);
-
-    // CLOSING INPUT STREAM
-    if (fclose(file_open) != 0) { // close the file and handle if there is an error
-        fprintf(stderr, "ERROR: error in closing the file after parsed. \n");
-        free_cookbook(cookbook_parsed); // cookbook was parsed and mem allocated correctly but now since file can't be closed must free cookbook stuff to exit
+    // one context per cookbook job, every job is cooked on the same pool of cooks
+    COOK_CONTEXT **ctxs = calloc(options.job_count, sizeof(COOK_CONTEXT *));
+    if (ctxs == NULL) {
+        perror("Failed to allocate the cook contexts");
+        free_options(&options);
         exit(EXIT_FAILURE);
     }
 
-    initialize_cookbook_states(cookbook_parsed);
-
-    // fprintf(stderr, "%s\n", cookbook_parsed->recipes->tasks->steps->words[0]);
-
-    // FIND RECIPE SELECTED
-    RECIPE *recipe_selected = find_recipe(cookbook_parsed, recipe_name);
-    if (recipe_selected == NULL) {
-        fprintf(stderr, "ERRROR: Recipe '%s' not found in cookbook. \n", recipe_name);
-        free_cookbook(cookbook_parsed); // cookbook was parsed and mem allocated correctly but now since file can't be closed must free cookbook stuff to exit
-        exit(EXIT_FAILURE);
+    int setup_failed = 0;
+    for (int j = 0; j < options.job_count && !setup_failed; j++) {
+        COOK_JOB_OPTIONS *job = &options.jobs[j];
+
+        COOK_CONTEXT *ctx = ctxs[j] = cook_context_new();
+        if (ctx == NULL) {
+            perror("Failed to allocate the cook context");
+            setup_failed = 1;
+            break;
+        }
+
+        // PARSING THE COOKBOOK (the cookbook data structure is owned by the context from here on)
+        if (cook_load_cookbook(ctx, job->cookbook) != COOK_SUCCESS) {
+            setup_failed = 1;
+            break;
+        }
+        cook_set_weight(ctx, job->weight);
+        if (options.policy != NULL && cook_set_policy(ctx, options.policy) != COOK_SUCCESS) {
+            setup_failed = 1;
+            break;
+        }
+        if (options.history != NULL && cook_set_history(ctx, options.history) != COOK_SUCCESS) {
+            setup_failed = 1;
+            break;
+        }
+        cook_set_eta(ctx, options.show_eta);
+        cook_set_timeout(ctx, options.timeout_ms);
+        cook_set_speculation(ctx, options.speculate);
+        cook_set_retries(ctx, options.retries, options.retry_backoff_ms);
+        if (options.trace != NULL) { // one trace for every job, opened by the first
+            if (j > 0) cook_share_trace(ctx, ctxs[0]);
+            else if (cook_set_trace(ctx, options.trace) != COOK_SUCCESS) {
+                setup_failed = 1;
+                break;
+            }
+        }
+        cook_set_mem_floor(ctx, options.mem_floor_kb);
+        cook_set_critical_boost(ctx, options.critical_boost);
+        cook_set_usage(ctx, options.usage || options.usage_json != NULL || options.perf);
+        cook_set_perf_counters(ctx, options.perf);
+        cook_set_latency(ctx, options.latency);
+        if (options.status != NULL) { // the first job gets the page asked for, every other job one next to it
+            char status_path[PATH_MAX];
+            if (options.status[0] != '\0') snprintf(status_path, sizeof(status_path), "%s", options.status);
+            else snprintf(status_path, sizeof(status_path), STATUS_DIR "cook.%d", (int)getpid());
+            if (j > 0) snprintf(status_path + strlen(status_path), sizeof(status_path) - strlen(status_path), ".%d", j);
+            if (cook_set_status_page(ctx, status_path) != COOK_SUCCESS) {
+                setup_failed = 1;
+                break;
+            }
+        }
+        if (options.placement != NULL && cook_set_placement(ctx, options.placement) != COOK_SUCCESS) {
+            setup_failed = 1;
+            break;
+        }
+        cook_set_keep_going(ctx, options.keep_going);
+        if (options.auto_cooks) cook_set_auto_cooks(ctx, options.min_cooks);
+
+        if (options.daemon_socket != NULL) break; // the daemon selects recipes per request
+
+        // FIND RECIPES SELECTED (no name selects the first recipe, every name after the first is one more target)
+        if (job->recipe_count == 0) cook_select_target(ctx, "");
+        for (int i = 0; i < job->recipe_count; i++) {
+            int found = i == 0 ? cook_select_target(ctx, job->recipe_names[i]) : cook_add_target(ctx, job->recipe_names[i]);
+            if (found != COOK_SUCCESS) {
+                fprintf(stderr, "ERRROR: Recipe '%s' not found in cookbook. \n", job->recipe_names[i]);
+                setup_failed = 1; // cookbook was parsed and mem allocated correctly but now since recipe is missing must free cookbook stuff to exit
+                break;
+            }
+        }
     }
 
-    // Initializing the work queue
-    WORK_QUEUE *work_queue = init_work_queue(); // work queue will be edited as recipe subrecipes have dependencies completed
-
-    // check for the edge case of circular dependency in the tree cookbook data structure
-    if (check_circular_tree_cycle(recipe_selected) != 0) {
-        free(work_queue);
-        free_cookbook(cookbook_parsed);
-        exit(EXIT_FAILURE);
+    // JOBSERVER: be one for the steps (-J), or take the cooks out of the one of the make that started cook
+    if (!setup_failed && options.daemon_socket == NULL) {
+        if (options.jobserver != JOBSERVER_NONE) {
+            if (cook_create_jobserver(ctxs[0], options.max_cooks, options.jobserver == JOBSERVER_FIFO) != COOK_SUCCESS) setup_failed = 1;
+        } else if (cook_join_jobserver(ctxs[0]) == COOK_SUCCESS && !options.cooks_given) {
+            options.max_cooks = JOBSERVER_MAX_COOKS;
+        }
+        for (int j = 1; j < options.job_count; j++) {
+            cook_share_jobserver(ctxs[j], ctxs[0]);
+        }
     }
 
-    // ANALYSIS PHASE: STACK struct for recursive tree traversal and WORK QUEUE implemented
-    int recipe_count = stack_analysis_traversal(recipe_selected, work_queue); // work queue initially populated with leaf nodes
-    // fprintf(stderr, "RECIPE COUNT: %d\n", recipe_count);
+    int status = COOK_FAILURE;
+    if (setup_failed) {
+        status = COOK_FAILURE;
+    } else if (options.daemon_socket != NULL) {
+        // COOK DAEMON: keep the parsed cookbook and serve cook requests until told to stop
+        status = run_cook_daemon(ctxs[0], options.daemon_socket, options.max_cooks) == 0 ? COOK_SUCCESS : COOK_FAILURE;
+    } else if (options.job_count == 1) {
+        // ANALYSIS PHASE AND MAIN PROCESSING LOOP
+        status = cook_run(ctxs[0], options.max_cooks);
+    } else {
+        // the same for every job at once, sharing max_cooks by weight
+        status = cook_run_pool(ctxs, options.job_count, options.max_cooks);
+    }
 
-    if (is_work_queue_empty(work_queue)) {
-        fprintf(stderr, "ERROR: No Leaf Nodes Detected from Tree Traversal - Work Queue initialized to empty when should be populated with leaf nodes\n");
-        free(work_queue);
-        free_cookbook(cookbook_parsed);
-        exit(EXIT_FAILURE);
+    // KEEP GOING MODE, ADAPTIVE COOKS, JOBSERVER, TIMEOUTS, SPECULATION, RETRIES, MEMORY FLOOR, PRIORITY CLASSES
+    // OR PLACEMENT: say what was cooked and what was not (and how many cooks were allowed, which recipes timed out,
+    // how the backup cooks did, what was retried, what waited for memory, which recipes were raised, where the
+    // cooks ran)
+    // (the annotations of the cookbook can turn these on too, so a run that used them says so)
+    int summary = options.keep_going || options.auto_cooks || options.jobserver || options.timeout_ms ||
+        options.speculate || options.retries || options.mem_floor_kb || options.critical_boost || options.placement !=
+        NULL;
+    for (int j = 0; !setup_failed && j < options.job_count; j++) {
+        if (cook_summary_pending(ctxs[j])) summary = 1;
+    }
+    if (summary && !setup_failed && options.daemon_socket == NULL) {
+        for (int j = 0; j < options.job_count; j++) {
+            cook_print_summary(ctxs[j], stderr);
+        }
     }
 
-    // print_queue(&work_queue); // checking the first initialization of the work queue - should just be populated with the leaf nodes at first
+    // USAGE: the cpu time, memory, context switches and block I/O of what was cooked (the perf counters too), and how
+    // busy the cooks were
+    if (options.perf && options.usage_json == NULL) options.usage = 1;
+    if ((options.usage || options.usage_json != NULL) && !setup_failed && options.daemon_socket == NULL) {
+        for (int j = 0; options.usage && j < options.job_count; j++) {
+            cook_print_usage(ctxs[j], stderr);
+        }
+        FILE *json = options.usage_json != NULL ? fopen(options.usage_json, "w") : NULL;
+        if (options.usage_json != NULL && json == NULL) {
+            fprintf(stderr, "ERROR: Can't write the usage report '%s': %s\n", options.usage_json, strerror(errno));
+            status = COOK_FAILURE;
+        } else if (json != NULL) {
+            fprintf(json, "{\"jobs\":[\n");
+            for (int j = 0; j < options.job_count; j++) {
+                if (j > 0) fprintf(json, ",\n");
+                cook_write_usage_json(ctxs[j], json);
+            }
+            fprintf(json, "\n]}\n");
+            fclose(json);
+        }
+    }
 
-    RECIPE **completed_recipes;
-    completed_recipes = calloc(recipe_count, sizeof(RECIPE *));
-    if (!completed_recipes) {
-        perror("Failed to allocate completed recipes array");
-        free(work_queue);
-        free_cookbook(cookbook_parsed);
-        free(completed_recipes);
-        exit(EXIT_FAILURE);
+    // LATENCY: how long the scheduler took to notice a finished cook, to release its dependents and to fork a ready recipe
+    if (options.latency && !setup_failed && options.daemon_socket == NULL) {
+        for (int j = 0; j < options.job_count; j++) {
+            cook_print_latency(ctxs[j], stderr);
+        }
     }
 
-    // MAIN PROCESSING LOOP
-    main_processing_loop(work_queue, max_cooks, cookbook_parsed, recipe_selected, completed_recipes);
+    // TIMINGS: parse, analysis and run time with the main cook's own cpu time and memory (make bench reads the JSON)
+    if (options.timings != NULL && !setup_failed && options.daemon_socket == NULL) {
+        FILE *json = options.timings[0] != '\0' ? fopen(options.timings, "w") : NULL;
+        if (options.timings[0] == '\0') {
+            for (int j = 0; j < options.job_count; j++) {
+                cook_print_timings(ctxs[j], stderr);
+            }
+        } else if (json == NULL) {
+            fprintf(stderr, "ERROR: Can't write the timings '%s': %s\n", options.timings, strerror(errno));
+            status = COOK_FAILURE;
+        } else {
+            fprintf(json, "{\"jobs\":[\n");
+            for (int j = 0; j < options.job_count; j++) {
+                if (j > 0) fprintf(json, ",\n");
+                cook_write_timings_json(ctxs[j], json);
+            }
+            fprintf(json, "\n]}\n");
+            fclose(json);
+        }
+    }
 /*
     // UNPARSING THE COOKBOOK
     unparse_cookbook(cookbook_parsed, stdout); // error handling below
@@ -110,17 +220,12 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 */
-    // fprintf(stderr, "Main processing loop returned, freeing data structures\n");
-    // FREE WORK QUEUE STRUCTURE (this is good!)
-    free(work_queue);
-
-    // FREE LIST STRUCTURE (this is good!)
-    free(completed_recipes); // just a list of pointers
-
-    // FREE STACK STRUCTURE (should already be free - i think it is malloc in push and freed in push? and also locally defined in stack)
-
-    // FREE COOKBOOK TREE STRUCTURE
-    free_cookbook(cookbook_parsed);
+    // FREE COOK CONTEXTS (work queue, completed list, analysis and cookbook tree structure)
+    for (int j = 0; j < options.job_count; j++) {
+        cook_context_free(ctxs[j]);
+    }
+    free(ctxs);
+    free_options(&options);
 
-    exit(EXIT_SUCCESS);
+    exit(status == COOK_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
 }
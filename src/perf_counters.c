@@ -0,0 +1,98 @@
+/*
+	This is the c file for the hardware performance counters of the cooks (see perf_counters.h)
+	The counters are opened one by one (not as a group: a group can't be inherited), each only counting
+	user space so perf_event_paranoid 2 (the default) still allows them
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf_counters.h"
+
+static const struct {
+	const char *name;
+	unsigned int type;
+	unsigned long long config;
+} counter_events[PERF_COUNTER_COUNT] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+};
+
+const char *perf_counter_name(int counter) {
+	return counter >= 0 && counter < PERF_COUNTER_COUNT ? counter_events[counter].name : "?";
+}
+
+// opens one counter of the calling process (and, with inherit, of the children it forks after this)
+static int open_counter(int counter, int inherit) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counter_events[counter].type;
+	attr.config = counter_events[counter].config;
+	attr.inherit = inherit;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+	Function to find out which counters a cook will be able to open, by opening each of them once
+	error gets the errno of the first hardware counter that failed (0 if they all opened)
+
+	Returns the mask of the counters that opened
+*/
+int probe_perf_counters(int *error) {
+	int available = 0;
+	*error = 0;
+	for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+		int fd = open_counter(counter, 0);
+		if (fd >= 0) {
+			available |= 1 << counter;
+			close(fd);
+		} else if (*error == 0 && (1 << counter) & PERF_HARDWARE) {
+			*error = errno;
+		}
+	}
+	return available;
+}
+
+// Function to open the available counters in a cook, before it runs its first task (a counter that fails is left out)
+void open_perf_counters(PERF_SET *set, int available) {
+	for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+		set->fds[counter] = (available & (1 << counter)) ? open_counter(counter, 1) : -1;
+	}
+}
+
+/*
+	Function to read and close the counters of a cook, once the steps it forked are reaped (their counts
+	are only added to the cook's when they exit)
+	A counter the kernel multiplexed with others is scaled up to the time it was enabled
+*/
+void close_perf_counters(PERF_SET *set, PERF_COUNTS *counts) {
+	memset(counts, 0, sizeof(PERF_COUNTS));
+	for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+		unsigned long long value[3]; // count, time enabled, time running
+		if (set->fds[counter] < 0) continue;
+		if (read(set->fds[counter], value, sizeof(value)) == sizeof(value) && value[2] > 0) {
+			counts->values[counter] = value[2] < value[1] ? (long long)((double)value[0] * value[1] / value[2]) : (long long)value[0];
+			counts->counted |= 1 << counter;
+		}
+		close(set->fds[counter]);
+		set->fds[counter] = -1;
+	}
+}
+
+void add_perf_counts(PERF_COUNTS *counts, PERF_COUNTS *other) {
+	for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+		if (other->counted & (1 << counter)) counts->values[counter] += other->values[counter];
+	}
+	counts->counted |= other->counted;
+}
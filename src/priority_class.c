@@ -0,0 +1,80 @@
+/*
+	This is the c file for the priority classes of recipes (see priority_class.h)
+	The nice values are relative to the one of the main cook, so cook started with nice keeps its place
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "priority_class.h"
+
+// ioprio_set has no glibc wrapper, these are the values of linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+typedef struct priority_class_info {
+	const char *name;
+	int nice_delta;             // added to the nice value of the main cook
+	int io_class;               // 0 leaves the I/O priority alone
+	int io_level;               // 0 (first) to 7 (last) within the best effort class
+} PRIORITY_CLASS_INFO;
+
+static const PRIORITY_CLASS_INFO classes[PRIORITY_CLASS_COUNT] = {
+	{ "inherit", 0, 0, 0 },
+	{ "idle", 19, IOPRIO_CLASS_IDLE, 0 },
+	{ "background", 10, IOPRIO_CLASS_BE, 7 },
+	{ "normal", 0, IOPRIO_CLASS_BE, 4 },
+	{ "critical", -5, IOPRIO_CLASS_BE, 0 },
+};
+
+// Returns the PRIORITY_CLASS with this name, or -1 if there is none
+int parse_priority_class(const char *name) {
+	for (int i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+		if (strcmp(classes[i].name, name) == 0) return i;
+	}
+	return -1;
+}
+
+const char *priority_class_name(PRIORITY_CLASS priority_class) {
+	return classes[priority_class].name;
+}
+
+/*
+	Function to put the calling process (a cook) and every process it starts from now on in a priority class
+	A nice value that may not be lowered (no CAP_SYS_NICE) is left as it is, the I/O priority is still set
+
+	Returns 0 if both were set and -1 if either could not be
+*/
+int apply_priority_class(PRIORITY_CLASS priority_class) {
+	const PRIORITY_CLASS_INFO *info = &classes[priority_class];
+	int ret = 0;
+
+	if (info->nice_delta != 0) {
+		errno = 0;
+		int nice_value = getpriority(PRIO_PROCESS, 0);
+		if (errno != 0 || setpriority(PRIO_PROCESS, 0, nice_value + info->nice_delta) != 0) ret = -1;
+	}
+#ifdef SYS_ioprio_set
+	if (info->io_class != 0) {
+		int ioprio = (info->io_class << IOPRIO_CLASS_SHIFT) | info->io_level;
+		if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0) ret = -1;
+	}
+#endif
+	return ret;
+}
+
+// Returns 1 if a cook may lower its nice value for the critical class (root, CAP_SYS_NICE is not checked otherwise)
+int can_raise_priority(void) {
+	if (geteuid() == 0) return 1;
+
+	struct rlimit limit;
+	errno = 0;
+	int nice_value = getpriority(PRIO_PROCESS, 0);
+	if (errno != 0 || getrlimit(RLIMIT_NICE, &limit) != 0) return 0;
+	return limit.rlim_cur == RLIM_INFINITY || 20 - (long)limit.rlim_cur <= nice_value + classes[PRIORITY_CRITICAL].nice_delta;
+}
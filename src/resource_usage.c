@@ -0,0 +1,388 @@
+/*
+	This is the c file for the resource usage of a run (see resource_usage.h)
+	The usage is kept for the last run only, a new run of the context starts it from zero
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "resource_usage.h"
+
+void init_run_usage(RUN_USAGE *usage) {
+	memset(usage, 0, sizeof(RUN_USAGE));
+	usage->report_read_fd = usage->report_write_fd = -1;
+}
+
+/*
+	Function to set up the usage of a new run: zero for every recipe, task and step of the cookbook
+
+	Returns 0 on success and -1 if it could not be allocated
+*/
+int start_run_usage(RUN_USAGE *usage, COOKBOOK *cookbook, int slots, long now_ms) {
+	clear_run_usage(usage);
+
+	int count = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next) count++;
+	usage->recipes = calloc(count > 0 ? count : 1, sizeof(RECIPE_USAGE));
+	if (usage->recipes == NULL) return -1;
+	usage->recipe_count = count;
+
+	int i = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next, i++) {
+		RECIPE_USAGE *recipe_usage = &usage->recipes[i];
+		for (TASK *task = recipe->tasks; task != NULL; task = task->next) recipe_usage->task_count++;
+
+		int tasks = recipe_usage->task_count > 0 ? recipe_usage->task_count : 1;
+		recipe_usage->tasks = calloc(tasks, sizeof(USAGE));
+		recipe_usage->step_counts = calloc(tasks, sizeof(int));
+		recipe_usage->steps = calloc(tasks, sizeof(USAGE *));
+		if (recipe_usage->tasks == NULL || recipe_usage->step_counts == NULL || recipe_usage->steps == NULL) {
+			clear_run_usage(usage);
+			return -1;
+		}
+
+		int t = 0;
+		for (TASK *task = recipe->tasks; task != NULL; task = task->next, t++) {
+			for (STEP *step = task->steps; step != NULL; step = step->next) recipe_usage->step_counts[t]++;
+			recipe_usage->steps[t] = calloc(recipe_usage->step_counts[t] + 1, sizeof(USAGE));
+			if (recipe_usage->steps[t] == NULL) {
+				clear_run_usage(usage);
+				return -1;
+			}
+		}
+	}
+
+	if (usage->counters) usage->counters_available = probe_perf_counters(&usage->counters_error);
+	usage->slots = slots;
+	usage->started_ms = usage->ended_ms = usage->clock_ms = now_ms;
+	usage->free_slots = usage->work_ready = 0;
+	return 0;
+}
+
+void clear_run_usage(RUN_USAGE *usage) {
+	for (int i = 0; usage->recipes != NULL && i < usage->recipe_count; i++) {
+		RECIPE_USAGE *recipe_usage = &usage->recipes[i];
+		for (int t = 0; recipe_usage->steps != NULL && t < recipe_usage->task_count; t++) free(recipe_usage->steps[t]);
+		free(recipe_usage->steps);
+		free(recipe_usage->step_counts);
+		free(recipe_usage->tasks);
+	}
+	free(usage->recipes);
+	usage->recipes = NULL;
+	usage->recipe_count = 0;
+	usage->busy_ms = usage->idle_ready_ms = 0;
+	usage->lost_reports = 0;
+}
+
+// Function to add the usage wait4() returned for one process
+void add_rusage(USAGE *usage, struct rusage *rusage) {
+	USAGE other = {
+		1,
+		rusage->ru_utime.tv_sec * 1000000L + rusage->ru_utime.tv_usec,
+		rusage->ru_stime.tv_sec * 1000000L + rusage->ru_stime.tv_usec,
+		rusage->ru_maxrss,
+		rusage->ru_nvcsw,
+		rusage->ru_nivcsw,
+		rusage->ru_inblock,
+		rusage->ru_oublock
+	};
+	add_usage(usage, &other);
+}
+
+void add_usage(USAGE *usage, USAGE *other) {
+	usage->processes += other->processes;
+	usage->user_us += other->user_us;
+	usage->sys_us += other->sys_us;
+	if (other->max_rss_kb > usage->max_rss_kb) usage->max_rss_kb = other->max_rss_kb;
+	usage->voluntary_switches += other->voluntary_switches;
+	usage->involuntary_switches += other->involuntary_switches;
+	usage->in_blocks += other->in_blocks;
+	usage->out_blocks += other->out_blocks;
+}
+
+/*
+	Function to open the pipe the cooks of a run send the usage of their steps over
+	Like the task report pipe it is nonblocking (a report that does not fit is lost) and close-on-exec
+	The lost reports are counted in a page shared with the cooks, so the main cook can tell how many there were
+
+	Returns 0 on success and -1 otherwise
+*/
+int open_usage_reports(RUN_USAGE *usage) {
+	int fds[2];
+	void *lost = mmap(NULL, sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (lost == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Failed to map the lost usage report count: %s\n", strerror(errno));
+		return -1;
+	}
+	if (pipe(fds) == -1) {
+		fprintf(stderr, "ERROR: Failed to create the usage report pipe: %s\n", strerror(errno));
+		munmap(lost, sizeof(long));
+		return -1;
+	}
+	usage->lost_shared = lost;
+	*usage->lost_shared = 0;
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	usage->report_read_fd = fds[0];
+	usage->report_write_fd = fds[1];
+	return 0;
+}
+
+void close_usage_reports(RUN_USAGE *usage) {
+	if (usage->report_read_fd >= 0) {
+		read_usage_reports(usage);
+		close(usage->report_read_fd);
+	}
+	if (usage->report_write_fd >= 0) close(usage->report_write_fd);
+	usage->report_read_fd = usage->report_write_fd = -1;
+	if (usage->lost_shared != NULL) {
+		usage->lost_reports = __atomic_load_n(usage->lost_shared, __ATOMIC_RELAXED); // every cook has been reaped
+		munmap(usage->lost_shared, sizeof(long));
+		usage->lost_shared = NULL;
+	}
+}
+
+// a cook waiting for the main cook to read the pipe could wait for ever (it reads when it reaps), so it only counts
+static void lose_report(RUN_USAGE *usage) {
+	if (usage->lost_shared != NULL) __atomic_add_fetch(usage->lost_shared, 1, __ATOMIC_RELAXED);
+}
+
+void send_usage_report(RUN_USAGE *usage, int recipe, int task, int step, struct rusage *rusage) {
+	if (usage->report_write_fd < 0) return;
+	USAGE_REPORT report = { recipe, task, step, { 0 }, { { 0 }, 0 } };
+	add_rusage(&report.usage, rusage);
+	if (write(usage->report_write_fd, &report, sizeof(report)) != sizeof(report)) {
+		lose_report(usage); // the pipe is full, the main cook has not caught up
+	}
+}
+
+void send_counter_report(RUN_USAGE *usage, int recipe, PERF_COUNTS *counts) {
+	if (usage->report_write_fd < 0) return;
+	USAGE_REPORT report = { recipe, 0, -1, { 0 }, *counts };
+	if (write(usage->report_write_fd, &report, sizeof(report)) != sizeof(report)) {
+		lose_report(usage); // lost like a usage report
+	}
+}
+
+// Function to add every step usage waiting in the report pipe to its step and task
+void read_usage_reports(RUN_USAGE *usage) {
+	USAGE_REPORT report;
+	if (usage->report_read_fd < 0) return;
+
+	while (read(usage->report_read_fd, &report, sizeof(report)) == sizeof(report)) {
+		if (report.recipe < 0 || report.recipe >= usage->recipe_count) continue;
+		RECIPE_USAGE *recipe_usage = &usage->recipes[report.recipe];
+		if (report.step == -1) {
+			add_perf_counts(&recipe_usage->counters, &report.counters);
+			continue;
+		}
+		if (report.task < 0 || report.task >= recipe_usage->task_count) continue;
+		if (report.step < 0 || report.step >= recipe_usage->step_counts[report.task]) continue;
+		add_usage(&recipe_usage->steps[report.task][report.step], &report.usage);
+		add_usage(&recipe_usage->tasks[report.task], &report.usage);
+	}
+}
+
+/*
+	Function to account for the cook slots since the last call, which left free_slots of them idle and the run
+	with (work_ready) or without a recipe in its work queue; the idle time counts as idle while work was ready
+	in the first case. Then the slots are as given until the next call
+	(the busy time is added by the main cook as it reaps every cook)
+*/
+void account_slots(RUN_USAGE *usage, int free_slots, int work_ready, long now_ms) {
+	long elapsed_ms = now_ms - usage->clock_ms;
+	if (elapsed_ms > 0 && usage->work_ready && usage->free_slots > 0) usage->idle_ready_ms += elapsed_ms * usage->free_slots;
+	usage->free_slots = free_slots;
+	usage->work_ready = work_ready;
+	usage->clock_ms = usage->ended_ms = now_ms;
+}
+
+static double seconds(long us) {
+	return us / 1000000.0;
+}
+
+static void print_usage_line(FILE *out, const char *indent, const char *name, USAGE *usage) {
+	fprintf(out, "%s%-*s %8.3fs %8.3fs %8.1fM %8ld %8ld %8ld %8ld\n", indent, 24 - (int)strlen(indent), name,
+		seconds(usage->user_us), seconds(usage->sys_us), usage->max_rss_kb / 1024.0,
+		usage->voluntary_switches, usage->involuntary_switches, usage->in_blocks, usage->out_blocks);
+}
+
+// the shares of the slot time of the run: busy, idle while work was ready (in percent)
+static void slot_shares(RUN_USAGE *usage, double *busy, double *idle_ready) {
+	double slot_ms = (double)usage->slots * (usage->ended_ms - usage->started_ms);
+	*busy = slot_ms > 0 ? 100.0 * usage->busy_ms / slot_ms : 0;
+	*idle_ready = slot_ms > 0 ? 100.0 * usage->idle_ready_ms / slot_ms : 0;
+	if (*busy > 100) *busy = 100;
+	if (*idle_ready > 100 - *busy) *idle_ready = 100 - *busy;
+}
+
+// prints a counter of a recipe, or "-" if it was not counted
+static void print_count(FILE *out, PERF_COUNTS *counts, int counter, int width) {
+	if (counts->counted & (1 << counter)) fprintf(out, " %*lld", width, counts->values[counter]);
+	else fprintf(out, " %*s", width, "-");
+}
+
+/*
+	Function to print the perf counters of every cooked recipe, with the instructions per cycle and the
+	cache misses per thousand instructions (a low IPC with many misses is a recipe stalling on memory)
+*/
+static void print_counters(RUN_USAGE *usage, COOKBOOK *cookbook, FILE *out) {
+	if (usage->counters_available == 0) {
+		fprintf(out, "PERF COUNTERS: unavailable (%s)\n", strerror(usage->counters_error != 0 ? usage->counters_error : ENOSYS));
+		return;
+	}
+	if ((usage->counters_available & PERF_HARDWARE) != PERF_HARDWARE) {
+		fprintf(out, "PERF COUNTERS (no hardware counters: %s)\n", strerror(usage->counters_error));
+	} else {
+		fprintf(out, "PERF COUNTERS\n");
+	}
+	fprintf(out, "%-24s %14s %14s %6s %12s %12s %14s %11s\n", "recipe", "cycles", "instructions", "IPC",
+		"cache misses", "branch miss", "task clock ns", "page faults");
+
+	int i = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next, i++) {
+		PERF_COUNTS *counts = &usage->recipes[i].counters;
+		if (usage->recipes[i].total.processes == 0) continue;
+
+		fprintf(out, "%-24s", recipe->name);
+		print_count(out, counts, PERF_CYCLES, 14);
+		print_count(out, counts, PERF_INSTRUCTIONS, 14);
+		int both = (1 << PERF_CYCLES) | (1 << PERF_INSTRUCTIONS);
+		if ((counts->counted & both) == both && counts->values[PERF_CYCLES] > 0) {
+			fprintf(out, " %6.2f", (double)counts->values[PERF_INSTRUCTIONS] / counts->values[PERF_CYCLES]);
+		} else {
+			fprintf(out, " %6s", "-");
+		}
+		print_count(out, counts, PERF_CACHE_MISSES, 12);
+		print_count(out, counts, PERF_BRANCH_MISSES, 12);
+		print_count(out, counts, PERF_TASK_CLOCK, 14);
+		print_count(out, counts, PERF_PAGE_FAULTS, 11);
+		fprintf(out, "\n");
+	}
+}
+
+/*
+	Function to print the usage of the last run: one line per cooked recipe, then its tasks and steps
+	(when the cooks reported them), the perf counters of the recipes (--perf) and how the cook slots were used
+
+	USAGE (cookbook.ckb)          user      sys   max rss   vcsw   ivcsw  blk in  blk out
+	recipe                      0.010s   0.004s      1.5M ...
+	  task 0                    ...
+	    step 0 (echo)           ...
+	SLOTS (2 cooks, 1.2s): 61.0% busy, 12.5% idle with work ready, 26.5% idle
+	REPORTS: 0 lost to a full report pipe
+*/
+void print_run_usage(RUN_USAGE *usage, COOKBOOK *cookbook, const char *label, FILE *out) {
+	if (usage->recipes == NULL) return;
+
+	char title[256];
+	snprintf(title, sizeof(title), "USAGE (%s)", label);
+	fprintf(out, "%-24s %9s %9s %9s %8s %8s %8s %8s\n", title, "user", "sys", "max rss", "vcsw", "ivcsw", "blk in", "blk out");
+
+	int i = 0;
+	for (RECIPE *recipe = cookbook->recipes; recipe != NULL; recipe = recipe->next, i++) {
+		RECIPE_USAGE *recipe_usage = &usage->recipes[i];
+		if (recipe_usage->total.processes == 0) continue;
+		print_usage_line(out, "", recipe->name, &recipe_usage->total);
+
+		int t = 0;
+		for (TASK *task = recipe->tasks; usage->steps && task != NULL; task = task->next, t++) {
+			char name[64];
+			snprintf(name, sizeof(name), "task %d", t);
+			print_usage_line(out, "  ", name, &recipe_usage->tasks[t]);
+
+			int s = 0;
+			for (STEP *step = task->steps; step != NULL; step = step->next, s++) {
+				snprintf(name, sizeof(name), "step %d (%s)", s, step->words[0]);
+				print_usage_line(out, "    ", name, &recipe_usage->steps[t][s]);
+			}
+		}
+	}
+
+	if (usage->counters) print_counters(usage, cookbook, out);
+
+	double busy, idle_ready;
+	slot_shares(usage, &busy, &idle_ready);
+	fprintf(out, "SLOTS (%d cooks, %.1fs): %.1f%% busy, %.1f%% idle with work ready, %.1f%% idle\n", usage->slots,
+		(usage->ended_ms - usage->started_ms) / 1000.0, busy, idle_ready, 100 - busy - idle_ready);
+	fprintf(out, "REPORTS: %ld lost to a full report pipe\n", usage->lost_reports);
+}
+
+// writes text as a JSON string
+static void write_json_string(FILE *out, const char *text) {
+	fputc('"', out);
+	for (; *text != '\0'; text++) {
+		unsigned char c = *text;
+		if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+		else if (c < 0x20) fprintf(out, "\\u%04x", c);
+		else fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void write_json_usage(FILE *out, USAGE *usage) {
+	fprintf(out, "{\"processes\":%ld,\"user_s\":%.6f,\"sys_s\":%.6f,\"max_rss_kb\":%ld,\"voluntary_switches\":%ld,"
+		"\"involuntary_switches\":%ld,\"in_blocks\":%ld,\"out_blocks\":%ld}", usage->processes, seconds(usage->user_us),
+		seconds(usage->sys_us), usage->max_rss_kb, usage->voluntary_switches, usage->involuntary_switches,
+		usage->in_blocks, usage->out_blocks);
+}
+
+// Function to write the same report as one JSON object (the tasks and steps only when the cooks reported them,
+// a counter that was not counted is null)
+void write_run_usage_json(RUN_USAGE *usage, COOKBOOK *cookbook, const char *label, FILE *out) {
+	double busy, idle_ready;
+	slot_shares(usage, &busy, &idle_ready);
+
+	fprintf(out, "{\"cookbook\":");
+	write_json_string(out, label);
+	fprintf(out, ",\"wall_s\":%.3f,\"slots\":{\"count\":%d,\"busy\":%.4f,\"idle_work_ready\":%.4f,\"idle\":%.4f},"
+		"\"lost_reports\":%ld,\"recipes\":[", (usage->ended_ms - usage->started_ms) / 1000.0, usage->slots, busy / 100,
+		idle_ready / 100, (100 - busy - idle_ready) / 100, usage->lost_reports);
+
+	int i = 0, written = 0;
+	for (RECIPE *recipe = cookbook->recipes; usage->recipes != NULL && recipe != NULL; recipe = recipe->next, i++) {
+		RECIPE_USAGE *recipe_usage = &usage->recipes[i];
+		if (recipe_usage->total.processes == 0) continue;
+
+		fprintf(out, "%s\n{\"name\":", written++ > 0 ? "," : "");
+		write_json_string(out, recipe->name);
+		fprintf(out, ",\"usage\":");
+		write_json_usage(out, &recipe_usage->total);
+		if (usage->counters) {
+			fprintf(out, ",\"counters\":{");
+			for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+				fprintf(out, "%s\"%s\":", counter > 0 ? "," : "", perf_counter_name(counter));
+				if (recipe_usage->counters.counted & (1 << counter)) fprintf(out, "%lld", recipe_usage->counters.values[counter]);
+				else fprintf(out, "null");
+			}
+			fprintf(out, "}");
+		}
+		if (usage->steps) {
+			fprintf(out, ",\"tasks\":[");
+			int t = 0;
+			for (TASK *task = recipe->tasks; task != NULL; task = task->next, t++) {
+				fprintf(out, "%s{\"usage\":", t > 0 ? "," : "");
+				write_json_usage(out, &recipe_usage->tasks[t]);
+				fprintf(out, ",\"steps\":[");
+				int s = 0;
+				for (STEP *step = task->steps; step != NULL; step = step->next, s++) {
+					fprintf(out, "%s{\"program\":", s > 0 ? "," : "");
+					write_json_string(out, step->words[0]);
+					fprintf(out, ",\"usage\":");
+					write_json_usage(out, &recipe_usage->steps[t][s]);
+					fprintf(out, "}");
+				}
+				fprintf(out, "]}");
+			}
+			fprintf(out, "]");
+		}
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n]}");
+}
@@ -0,0 +1,414 @@
+/*
+	Resource annotations of a cookbook (#@ recipe: cpu=4 mem=8G pool=store:2 timeout=10m idempotent retries=3 class=idle
+	rlimit_as=2G)
+	The parser knows nothing about them: the annotation lines are cut out of the cookbook text
+	and the rest is handed to parse_cookbook() through a memory stream
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/resource.h>
+
+#include "resources.h"
+#include "priority_class.h"
+#include "stack_queue_tree_traversal.h"
+
+// Function to parse a memory size like 512M, 8G or 100000 (bytes), returns the size in kB or -1
+long parse_mem_kb(const char *value) {
+	char *end;
+	double size = strtod(value, &end);
+	if (end == value || size < 0) return -1;
+
+	switch (toupper((unsigned char)*end)) {
+		case '\0': size /= 1024; break;
+		case 'K': size *= 1; end++; break;
+		case 'M': size *= 1024; end++; break;
+		case 'G': size *= 1024 * 1024; end++; break;
+		case 'T': size *= 1024.0 * 1024 * 1024; end++; break;
+		default: return -1;
+	}
+	if (*end == 'B' || *end == 'b') end++;
+	if (*end != '\0') return -1;
+	return (long)(size + 0.5);
+}
+
+// Function to parse a duration like 30, 30s, 1.5m, 2h or 500ms (seconds without a unit), returns it in ms or -1
+long parse_duration_ms(const char *value) {
+	char *end;
+	double duration = strtod(value, &end);
+	if (end == value || duration < 0) return -1;
+
+	if (strcmp(end, "ms") == 0) return (long)(duration + 0.5);
+	if (strcmp(end, "") == 0 || strcmp(end, "s") == 0) duration *= 1000;
+	else if (strcmp(end, "m") == 0) duration *= 60 * 1000;
+	else if (strcmp(end, "h") == 0) duration *= 60 * 60 * 1000;
+	else return -1;
+	return (long)(duration + 0.5);
+}
+
+// Function to find the named pool, adding it with the given limit if it is new; returns its index or -1
+static int find_pool(COOK_RESOURCES *resources, const char *name, int limit) {
+	for (int i = 0; i < resources->pool_count; i++) {
+		if (strcmp(resources->pools[i].name, name) == 0) {
+			if (resources->pools[i].limit != limit) {
+				fprintf(stderr, "ERROR: Pool '%s' is given the limits %d and %d\n", name, resources->pools[i].limit, limit);
+				return -1;
+			}
+			return i;
+		}
+	}
+
+	RESOURCE_POOL *pools = realloc(resources->pools, (resources->pool_count + 1) * sizeof(RESOURCE_POOL));
+	if (pools == NULL) return -1;
+	resources->pools = pools;
+	if ((pools[resources->pool_count].name = strdup(name)) == NULL) return -1;
+	pools[resources->pool_count].limit = limit;
+	pools[resources->pool_count].in_use = 0;
+	return resources->pool_count++;
+}
+
+/*
+	Function to parse one annotation line (without the #@)
+	A recipe annotated on several lines gets one annotation: a later line adds its keys to what the earlier
+	lines gave (a key given again takes the later value)
+
+	Returns 0 if it was added and -1 if it is malformed (or can't be stored)
+*/
+static int parse_annotation(COOK_RESOURCES *resources, char *line) {
+	char *colon = strchr(line, ':');
+	if (colon == NULL) {
+		fprintf(stderr, "ERROR: Resource annotation without 'recipe:' %s\n", line);
+		return -1;
+	}
+	*colon = '\0';
+
+	// recipe name without the blanks around it
+	char *name = line;
+	while (*name == ' ' || *name == '\t') name++;
+	char *name_end = name + strlen(name);
+	while (name_end > name && (name_end[-1] == ' ' || name_end[-1] == '\t')) *--name_end = '\0';
+	if (*name == '\0') {
+		fprintf(stderr, "ERROR: Resource annotation without a recipe name\n");
+		return -1;
+	}
+
+	RESOURCE_ANNOTATION annotation = { NULL, NULL, 1, 0, -1, 0, 0, 0, 0, PRIORITY_INHERIT, 0, 0, 0, 0 };
+	int earlier = -1;
+	for (int i = 0; i < resources->annotation_count; i++) {
+		if (strcmp(resources->annotations[i].recipe_name, name) == 0) {
+			earlier = i;
+			annotation = resources->annotations[i];
+			break;
+		}
+	}
+	for (char *word = strtok(colon + 1, " \t\r\n"); word != NULL; word = strtok(NULL, " \t\r\n")) {
+		if (strcmp(word, "idempotent") == 0) { // the only flag without a value
+			annotation.idempotent = 1;
+			continue;
+		}
+		char *value = strchr(word, '=');
+		if (value == NULL) {
+			fprintf(stderr, "ERROR: Resource annotation of '%s' has '%s' instead of key=value\n", name, word);
+			return -1;
+		}
+		*value++ = '\0';
+
+		if (strcmp(word, "cpu") == 0) {
+			annotation.cpu = atoi(value);
+			if (annotation.cpu <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' needs cpu >= 1\n", name);
+				return -1;
+			}
+		} else if (strcmp(word, "mem") == 0) {
+			if ((annotation.mem_kb = parse_mem_kb(value)) < 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' has an invalid memory size '%s'\n", name, value);
+				return -1;
+			}
+		} else if (strcmp(word, "pool") == 0) {
+			char *limit = strrchr(value, ':');
+			if (limit == NULL || atoi(limit + 1) <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' needs pool=name:limit\n", name);
+				return -1;
+			}
+			*limit++ = '\0';
+			if ((annotation.pool = find_pool(resources, value, atoi(limit))) < 0) return -1;
+		} else if (strcmp(word, "retries") == 0) {
+			if ((annotation.retries = atoi(value)) <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' needs retries >= 1\n", name);
+				return -1;
+			}
+		} else if (strcmp(word, "backoff") == 0) {
+			if ((annotation.retry_backoff_ms = parse_duration_ms(value)) <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' has an invalid backoff '%s'\n", name, value);
+				return -1;
+			}
+		} else if (strcmp(word, "rlimit_as") == 0) {
+			if ((annotation.rlimit_as_kb = parse_mem_kb(value)) <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' has an invalid rlimit_as '%s'\n", name, value);
+				return -1;
+			}
+		} else if (strcmp(word, "rlimit_cpu") == 0) {
+			if ((annotation.rlimit_cpu_s = (parse_duration_ms(value) + 999) / 1000) <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' has an invalid rlimit_cpu '%s'\n", name, value);
+				return -1;
+			}
+		} else if (strcmp(word, "rlimit_nofile") == 0 || strcmp(word, "rlimit_nproc") == 0) {
+			long count = atol(value);
+			if (count <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' needs %s >= 1\n", name, word);
+				return -1;
+			}
+			if (strcmp(word, "rlimit_nofile") == 0) annotation.rlimit_nofile = count;
+			else annotation.rlimit_nproc = count;
+		} else if (strcmp(word, "class") == 0) {
+			if ((annotation.priority_class = parse_priority_class(value)) <= PRIORITY_INHERIT) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' has the unknown class '%s'"
+					" (idle, background, normal or critical)\n", name, value);
+				return -1;
+			}
+			resources->classes_given = 1;
+		} else if (strcmp(word, "timeout") == 0) {
+			if ((annotation.timeout_ms = parse_duration_ms(value)) <= 0) {
+				fprintf(stderr, "ERROR: Resource annotation of '%s' has an invalid timeout '%s'\n", name, value);
+				return -1;
+			}
+		} else {
+			fprintf(stderr, "ERROR: Resource annotation of '%s' has the unknown resource '%s'\n", name, word);
+			return -1;
+		}
+	}
+
+	if (earlier >= 0) {
+		resources->annotations[earlier] = annotation;
+		return 0;
+	}
+
+	if ((annotation.recipe_name = strdup(name)) == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate the resource annotation of '%s'\n", name);
+		return -1;
+	}
+	RESOURCE_ANNOTATION *annotations = realloc(resources->annotations, (resources->annotation_count + 1) * sizeof(RESOURCE_ANNOTATION));
+	if (annotations == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate the resource annotation of '%s'\n", name);
+		free(annotation.recipe_name);
+		return -1;
+	}
+	resources->annotations = annotations;
+	annotations[resources->annotation_count++] = annotation;
+	return 0;
+}
+
+/*
+	Function to take the annotation lines out of a cookbook file before it is parsed
+	*buffer gets the text that is left (the caller frees it once the returned stream is closed)
+	The parser always reads that copy, the file is only read once so it can be a pipe
+
+	Returns a memory stream of the text without the annotations for parse_cookbook(), NULL if an annotation
+	is malformed or the text could not be read
+*/
+FILE *strip_resource_annotations(FILE *file, COOK_RESOURCES *resources, char **buffer) {
+	size_t capacity = 4096, length = 0, line_capacity = 0;
+	char *text = malloc(capacity);
+	char *line = NULL;
+	ssize_t line_length;
+
+	*buffer = NULL;
+	if (text == NULL) return NULL;
+
+	while ((line_length = getline(&line, &line_capacity, file)) != -1) {
+		char *start = line;
+		while (*start == ' ' || *start == '\t') start++;
+
+		if (strncmp(start, RESOURCE_DIRECTIVE, strlen(RESOURCE_DIRECTIVE)) == 0) {
+			if (parse_annotation(resources, start + strlen(RESOURCE_DIRECTIVE)) != 0) {
+				free(line);
+				free(text);
+				return NULL;
+			}
+			continue;
+		}
+
+		if (length + line_length + 1 > capacity) {
+			while (length + line_length + 1 > capacity) capacity *= 2;
+			char *bigger = realloc(text, capacity);
+			if (bigger == NULL) {
+				free(line);
+				free(text);
+				return NULL;
+			}
+			text = bigger;
+		}
+		memcpy(text + length, line, line_length);
+		length += line_length;
+	}
+	free(line);
+	if (ferror(file)) {
+		free(text);
+		return NULL;
+	}
+
+	text[length] = '\0';
+	FILE *stream = fmemopen(text, length, "r");
+	if (stream == NULL) {
+		free(text);
+		return NULL;
+	}
+	*buffer = text;
+	return stream;
+}
+
+/*
+	Function to find the recipe of every annotation in the parsed cookbook and read the memory of the machine
+
+	Returns 0, or -1 if an annotation names a recipe that is not in the cookbook
+*/
+int resolve_resource_annotations(COOK_RESOURCES *resources, COOKBOOK *cookbook) {
+	for (int i = 0; i < resources->annotation_count; i++) {
+		RESOURCE_ANNOTATION *annotation = &resources->annotations[i];
+		annotation->recipe = find_recipe(cookbook, annotation->recipe_name);
+		if (annotation->recipe == NULL || strcmp(annotation->recipe_name, "") == 0) {
+			fprintf(stderr, "ERROR: Resource annotation for unknown recipe '%s'\n", annotation->recipe_name);
+			return -1;
+		}
+	}
+
+	resources->mem_capacity_kb = 0;
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+	if (meminfo != NULL) {
+		char line[256];
+		while (fgets(line, sizeof(line), meminfo) != NULL) {
+			if (sscanf(line, "MemTotal: %ld kB", &resources->mem_capacity_kb) == 1) break;
+		}
+		fclose(meminfo);
+	}
+	return 0;
+}
+
+void free_resources(COOK_RESOURCES *resources) {
+	for (int i = 0; i < resources->annotation_count; i++) free(resources->annotations[i].recipe_name);
+	for (int i = 0; i < resources->pool_count; i++) free(resources->pools[i].name);
+	free(resources->annotations);
+	free(resources->pools);
+	memset(resources, 0, sizeof(COOK_RESOURCES));
+}
+
+/*
+	Function to copy the annotations into the recipe states at the start of a run
+	A recipe asking for more cook units than max_cooks is cut down to max_cooks, so it can run (alone)
+*/
+void apply_resource_annotations(COOK_RESOURCES *resources, int max_cooks) {
+	resources->mem_in_use_kb = 0;
+	for (int i = 0; i < resources->pool_count; i++) resources->pools[i].in_use = 0;
+
+	for (int i = 0; i < resources->annotation_count; i++) {
+		RESOURCE_ANNOTATION *annotation = &resources->annotations[i];
+		RECIPE_STATE *state = RECIPE_STATE_OF(annotation->recipe);
+		state->cpu = annotation->cpu < max_cooks ? annotation->cpu : max_cooks;
+		state->mem_kb = annotation->mem_kb;
+		state->pool = annotation->pool + 1;
+		state->timeout_ms = annotation->timeout_ms;
+		state->idempotent = annotation->idempotent;
+		state->retries = annotation->retries;
+		state->retry_backoff_ms = annotation->retry_backoff_ms;
+		state->priority_class = annotation->priority_class;
+		state->rlimit_as_kb = annotation->rlimit_as_kb;
+		state->rlimit_cpu_s = annotation->rlimit_cpu_s;
+		state->rlimit_nofile = annotation->rlimit_nofile;
+		state->rlimit_nproc = annotation->rlimit_nproc;
+	}
+}
+
+int recipe_units(RECIPE *recipe) {
+	int cpu = RECIPE_STATE_OF(recipe)->cpu;
+	return cpu > 0 ? cpu : 1;
+}
+
+/*
+	Function to check whether the recipe's cook can start now
+	units_in_use and limit are cook units (the sum of recipe_units() of the active cooks and max_cooks)
+	Neither units nor memory stop a cook when nothing else is using them, so a recipe asking for more
+	than there is still runs, alone
+	*blocked_by_pool is set when only the named pool is in the way
+
+	Returns 1 if it can start and 0 otherwise
+*/
+int admits_recipe(COOK_RESOURCES *resources, RECIPE *recipe, int units_in_use, int limit, int *blocked_by_pool) {
+	RECIPE_STATE *state = RECIPE_STATE_OF(recipe);
+
+	*blocked_by_pool = 0;
+	if (units_in_use > 0 && units_in_use + recipe_units(recipe) > limit) return 0; // more than the limit runs alone
+	if (state->mem_kb > 0 && resources->mem_in_use_kb > 0 && resources->mem_capacity_kb > 0 &&
+		resources->mem_in_use_kb + state->mem_kb > resources->mem_capacity_kb) return 0;
+
+	if (state->pool > 0) {
+		RESOURCE_POOL *pool = &resources->pools[state->pool - 1];
+		if (pool->in_use >= pool->limit) {
+			*blocked_by_pool = 1;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void take_resources(COOK_RESOURCES *resources, RECIPE *recipe) {
+	RECIPE_STATE *state = RECIPE_STATE_OF(recipe);
+	resources->mem_in_use_kb += state->mem_kb;
+	if (state->pool > 0) resources->pools[state->pool - 1].in_use++;
+}
+
+void release_resources(COOK_RESOURCES *resources, RECIPE *recipe) {
+	RECIPE_STATE *state = RECIPE_STATE_OF(recipe);
+	resources->mem_in_use_kb -= state->mem_kb;
+	if (state->pool > 0) resources->pools[state->pool - 1].in_use--;
+}
+
+// Returns MemAvailable of the machine in kB, -1 if it can not be read
+long read_mem_available_kb(void) {
+	long available = -1;
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+	if (meminfo != NULL) {
+		char line[256];
+		while (fgets(line, sizeof(line), meminfo) != NULL) {
+			if (sscanf(line, "MemAvailable: %ld kB", &available) == 1) break;
+		}
+		fclose(meminfo);
+	}
+	return available;
+}
+
+/*
+	Function to set both the soft and the hard limit (RLIMIT_CPU keeps a second between them, SIGXCPU comes
+	before SIGKILL), never above the hard limit the cook already has: only a privileged process could raise
+	it, so a cap looser than the current one leaves it as it is
+*/
+static int cap_resource(int resource, rlim_t value, const char *name) {
+	struct rlimit current;
+	if (getrlimit(resource, &current) != 0) {
+		perror(name);
+		return -1;
+	}
+	struct rlimit limit = { value, resource == RLIMIT_CPU ? value + 1 : value };
+	if (limit.rlim_max > current.rlim_max) limit.rlim_max = current.rlim_max;
+	if (limit.rlim_cur > limit.rlim_max) limit.rlim_cur = limit.rlim_max;
+	if (setrlimit(resource, &limit) == 0) return 0;
+	perror(name);
+	return -1;
+}
+
+/*
+	Function to put the rlimit_* caps of the recipe on the calling process (its cook), before the first task
+	The steps inherit them; a cap can only be lowered, one above the hard limit the main cook has is kept
+	at that limit
+
+	Returns 0 on success and -1 if a cap could not be set
+*/
+int apply_recipe_limits(RECIPE *recipe) {
+	RECIPE_STATE *state = RECIPE_STATE_OF(recipe);
+	int ret = 0;
+	if (state->rlimit_as_kb > 0 && cap_resource(RLIMIT_AS, (rlim_t)state->rlimit_as_kb * 1024, "rlimit_as") != 0) ret = -1;
+	if (state->rlimit_cpu_s > 0 && cap_resource(RLIMIT_CPU, state->rlimit_cpu_s, "rlimit_cpu") != 0) ret = -1;
+	if (state->rlimit_nofile > 0 && cap_resource(RLIMIT_NOFILE, state->rlimit_nofile, "rlimit_nofile") != 0) ret = -1;
+	if (state->rlimit_nproc > 0 && cap_resource(RLIMIT_NPROC, state->rlimit_nproc, "rlimit_nproc") != 0) ret = -1;
+	return ret;
+}
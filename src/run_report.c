@@ -0,0 +1,187 @@
+/*
+	This is the c file for the report printed at the end of a run (cook -k)
+	Everything is read back from the recipe states the run left behind, so it can be printed
+	any time after cook_run() returns and until the next run of the context starts
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "run_report.h"
+
+typedef enum recipe_outcome {
+	OUTCOME_COMPLETED,
+	OUTCOME_FAILED,
+	OUTCOME_SKIPPED     // never cooked (a recipe it depends on failed) or killed when the run was abandoned
+} RECIPE_OUTCOME;
+
+static RECIPE_OUTCOME outcome_of(RECIPE *recipe) {
+	if (is_completed(recipe)) return OUTCOME_COMPLETED;
+	if (RECIPE_STATE_OF(recipe)->failed) return OUTCOME_FAILED;
+	return OUTCOME_SKIPPED;
+}
+
+// Function to print one line listing the required recipes with the given outcome (nothing if there are none)
+static void print_outcome_line(COOK_CONTEXT *ctx, FILE *out, const char *label, RECIPE_OUTCOME outcome) {
+	int printed = 0;
+
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE *recipe = ctx->analysis.required[i];
+		if (outcome_of(recipe) != outcome) continue;
+
+		if (printed++ == 0) fprintf(out, "%s:", label);
+		fprintf(out, " %s", recipe->name);
+	}
+	if (printed > 0) fprintf(out, "\n");
+}
+
+// Function to print the recipes of the run by priority class, the most urgent class first
+static void print_priority_classes(COOK_CONTEXT *ctx, FILE *out) {
+	fprintf(out, "PRIORITY CLASSES:");
+	for (int priority_class = PRIORITY_CLASS_COUNT - 1, printed = 0; priority_class > PRIORITY_INHERIT; priority_class--) {
+		int listed = 0;
+		for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+			RECIPE *recipe = ctx->analysis.required[i];
+			if (RECIPE_STATE_OF(recipe)->priority_class != priority_class) continue;
+			if (listed++ == 0) fprintf(out, "%s %s:", printed++ > 0 ? ";" : "", priority_class_name(priority_class));
+			fprintf(out, " %s", recipe->name);
+		}
+	}
+	if (ctx->critical_count > 0 && !can_raise_priority()) fprintf(out, " (critical keeps its nice value, no CAP_SYS_NICE)");
+	fprintf(out, "\n");
+}
+
+/*
+	Function to print the summary of the last run of a context
+	One line with the counts, then one line per outcome listing the recipes
+
+	SUMMARY (cookbook.ckb): 10 completed, 1 failed, 3 skipped of 14 recipes
+	COMPLETED: ...
+	FAILED: ...
+	SKIPPED: ...
+	COOK LIMIT (auto 1-8): 4 at 0.0s (cpus), 5 at 1.0s (cpus), ...     with -c auto, every change of the limit
+	JOBSERVER (pipe, 4 jobs): at most 2 jobs borrowed by steps            with a jobserver cook created
+	THROTTLED (2, less than 2048.0M available): ...                       recipes held back by --mem-floor
+	PRIORITY CLASSES: critical: ...; background: ...                      with classes or --critical-boost
+*/
+void print_run_summary(COOK_CONTEXT *ctx, FILE *out) {
+	int counts[3] = { 0 };
+
+	if (!ctx->analyzed || ctx->analysis.status != 0) {
+		fprintf(out, "SUMMARY (%s): nothing was cooked\n", ctx->cookbook_path != NULL ? ctx->cookbook_path : "no cookbook");
+		return;
+	}
+
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		counts[outcome_of(ctx->analysis.required[i])]++;
+	}
+
+	fprintf(out, "SUMMARY (%s): %d completed, %d failed, %d skipped of %d recipes\n", ctx->cookbook_path,
+		counts[OUTCOME_COMPLETED], counts[OUTCOME_FAILED], counts[OUTCOME_SKIPPED], ctx->analysis.recipe_count);
+	print_outcome_line(ctx, out, "COMPLETED", OUTCOME_COMPLETED);
+	print_outcome_line(ctx, out, "FAILED", OUTCOME_FAILED);
+	print_outcome_line(ctx, out, "SKIPPED", OUTCOME_SKIPPED);
+
+	if (ctx->timed_out_count > 0) {
+		fprintf(out, "TIMED OUT:");
+		for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+			if (RECIPE_STATE_OF(ctx->analysis.required[i])->timed_out) fprintf(out, " %s", ctx->analysis.required[i]->name);
+		}
+		fprintf(out, "\n");
+	}
+	if (ctx->retry_count > 0) {
+		fprintf(out, "RETRIES (%d):", ctx->retry_count);
+		for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+			RECIPE *recipe = ctx->analysis.required[i];
+			int used = RECIPE_STATE_OF(recipe)->retries_used;
+			if (used > 0) fprintf(out, " %s x%d%s", recipe->name, used, is_completed(recipe) ? "" : " (failed)");
+		}
+		fprintf(out, "\n");
+	}
+	if (ctx->speculate) {
+		fprintf(out, "SPECULATION: %d backup cooks started, %d finished first\n", ctx->backup_count, ctx->backup_wins);
+	}
+	if (ctx->throttled_count > 0) {
+		fprintf(out, "THROTTLED (%d, less than %.1fM available):", ctx->throttled_count, ctx->mem_floor_kb / 1024.0);
+		for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+			RECIPE *recipe = ctx->analysis.required[i];
+			if (RECIPE_STATE_OF(recipe)->throttled) fprintf(out, " %s", recipe->name);
+		}
+		fprintf(out, "\n");
+	}
+	if (ctx->critical_count > 0 || ctx->resources.classes_given) print_priority_classes(ctx, out);
+	CPU_PLACEMENT *placement = &ctx->placement;
+	if (placement->mode != PLACEMENT_NONE) {
+		fprintf(out, "PLACEMENT (%s): %d domains over %d cpus, %d cooks placed, %d next to their sub-recipes\n",
+			placement_mode_name(placement->mode), placement->domain_count, placement->cpu_count,
+			placement->placed, placement->placed_near);
+	}
+
+	ADAPTIVE_LIMIT *adaptive = &ctx->adaptive;
+	if (ctx->auto_min_cooks > 0 && adaptive->history_count > 0) {
+		fprintf(out, "COOK LIMIT (auto %d-%d):", adaptive->min_cooks, adaptive->max_cooks);
+		for (int i = 0; i < adaptive->history_count; i++) {
+			ADAPTIVE_CHANGE *change = &adaptive->history[i];
+			fprintf(out, "%s %d at %.1fs (%s)", i > 0 ? "," : "", change->limit, change->at_ms / 1000.0, change->reason);
+		}
+		fprintf(out, "\n");
+	}
+
+	TOKEN_BUDGET *budget = ctx->budget;
+	if (budget != NULL && budget->jobserver != JOBSERVER_NONE) {
+		const char *kind = budget->jobserver == JOBSERVER_FIFO ? "fifo" : "pipe";
+		if (budget->capacity > 0) {
+			fprintf(out, "JOBSERVER (%s, %d jobs): at most %d jobs borrowed by steps\n", kind, budget->capacity, budget->borrowed_max);
+		} else {
+			fprintf(out, "JOBSERVER (%s): joined the jobserver of make\n", kind);
+		}
+	}
+	fflush(out);
+}
+
+/*
+	Function to print the estimated time left for the targets of the current run (cook --eta)
+	Before the cookbook has any duration history there is nothing to estimate with, only the count is printed
+*/
+void print_eta(COOK_CONTEXT *ctx, FILE *out) {
+	const char *target = ctx->target_count == 1 ? ctx->targets[0]->name : "the targets";
+	int done = ctx->completed_count;
+	long left_ms = estimate_remaining_ms(ctx, monotonic_ms());
+
+	if (done == ctx->analysis.recipe_count) {
+		fprintf(out, "ETA: %s done (%d of %d recipes)\n", target, done, ctx->analysis.recipe_count);
+	} else if (left_ms < 0 || !has_durations(&ctx->history)) {
+		fprintf(out, "ETA: %s unknown, no duration history yet (%d of %d recipes done)\n", target, done, ctx->analysis.recipe_count);
+	} else {
+		fprintf(out, "ETA: %s in about %.1fs (%d of %d recipes done)\n", target, left_ms / 1000.0, done, ctx->analysis.recipe_count);
+	}
+}
+
+/*
+	Function to print how long the phases of the last load and run took (cook --timings)
+	The scheduler's cost per recipe is the cpu time the main cook spent in the run (forks included) over
+	the recipes cooked, so with steps that take no time it is what cook adds to every recipe
+*/
+void print_run_timings(COOK_CONTEXT *ctx, FILE *out) {
+	RUN_TIMINGS *timings = &ctx->timings;
+	int recipes = ctx->analysis.recipe_count > 0 ? ctx->analysis.recipe_count : 1;
+
+	fprintf(out, "TIMINGS (%s, %d recipes, %d cooks): parse %.3fms, analysis %.3fms, run %.3fms\n",
+		ctx->cookbook_path != NULL ? ctx->cookbook_path : "-", ctx->analysis.recipe_count, ctx->max_cooks,
+		timings->parse_ms, timings->analysis_ms, timings->run_ms);
+	fprintf(out, "SCHEDULER: %.3fms cpu, %.1fus cpu and %.1fus wall per recipe, peak RSS %ldKB\n", timings->cpu_ms,
+		timings->cpu_ms * 1000.0 / recipes, timings->run_ms * 1000.0 / recipes, timings->peak_rss_kb);
+}
+
+// Function to write the same as one JSON object
+void write_run_timings_json(COOK_CONTEXT *ctx, FILE *out) {
+	RUN_TIMINGS *timings = &ctx->timings;
+	int recipes = ctx->analysis.recipe_count > 0 ? ctx->analysis.recipe_count : 1;
+	char cookbook[PATH_MAX];
+	trace_escape(cookbook, sizeof(cookbook), ctx->cookbook_path != NULL ? ctx->cookbook_path : "");
+
+	fprintf(out, "{\"cookbook\":\"%s\",\"recipes\":%d,\"cooks\":%d,\"parse_ms\":%.3f,\"analysis_ms\":%.3f,\"run_ms\":%.3f,"
+		"\"scheduler_cpu_ms\":%.3f,\"scheduler_cpu_us_per_recipe\":%.3f,\"wall_us_per_recipe\":%.3f,\"peak_rss_kb\":%ld}",
+		cookbook, ctx->analysis.recipe_count, ctx->max_cooks, timings->parse_ms, timings->analysis_ms, timings->run_ms,
+		timings->cpu_ms, timings->cpu_ms * 1000.0 / recipes, timings->run_ms * 1000.0 / recipes, timings->peak_rss_kb);
+}
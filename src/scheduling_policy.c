@@ -0,0 +1,281 @@
+/*
+	This is the c file for the scheduling policies of the work queue
+	Every policy turns what is known about the recipes of a run (the shape of the tree and the duration
+	history of the cookbook) into one priority per recipe
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cook_context.h"
+#include "scheduling_policy.h"
+
+// how much work a recipe is when it was never cooked: its number of steps (at least 1)
+static long count_steps(RECIPE *recipe) {
+	long steps = 0;
+	for (TASK *task = recipe->tasks; task != NULL; task = task->next) {
+		for (STEP *step = task->steps; step != NULL; step = step->next) steps++;
+	}
+	return steps > 0 ? steps : 1;
+}
+
+/*
+	Function to guess how long a recipe will take, from the duration history of the context
+	The guess is in milliseconds once anything of the cookbook has been cooked: the average of the recipe,
+	or the sum of the averages of its tasks, or the mean of the averages of the other recipes
+	Before that it is the number of steps of the recipe, which at least compares recipes with each other
+*/
+long estimate_recipe_ms(COOK_CONTEXT *ctx, RECIPE *recipe) {
+	DURATION_HISTORY *history = &ctx->history;
+	int index = RECIPE_STATE_OF(recipe)->index;
+	if (history->recipes == NULL) return count_steps(recipe);
+	if (history->recipes[index].samples > 0) return (long)history->recipes[index].mean_ms;
+
+	double tasks_total = 0;
+	int tasks_known = 0;
+	for (int t = 0; t < history->task_counts[index]; t++) {
+		if (history->tasks[index][t].samples == 0) continue;
+		tasks_total += history->tasks[index][t].mean_ms;
+		tasks_known++;
+	}
+	if (tasks_known > 0) return (long)tasks_total;
+
+	double known_total = 0;
+	int known = 0;
+	for (int i = 0; i < history->recipe_count; i++) {
+		if (history->recipes[i].samples == 0) continue;
+		known_total += history->recipes[i].mean_ms;
+		known++;
+	}
+	if (known > 0) return (long)(known_total / known);
+	return count_steps(recipe);
+}
+
+// longest chain of unfinished recipes from this one up to a target, path[] is -1 until it is worked out
+static long remaining_chain(RECIPE *recipe, long *left, long *path) {
+	int index = RECIPE_STATE_OF(recipe)->index;
+	if (path[index] >= 0) return path[index];
+
+	long after = 0;
+	for (RECIPE_LINK *dependent = recipe->depend_on_this; dependent != NULL; dependent = dependent->next) {
+		if (!is_required(dependent->recipe)) continue;
+		long chain = remaining_chain(dependent->recipe, left, path);
+		if (chain > after) after = chain;
+	}
+	path[index] = left[index] + after;
+	return path[index];
+}
+
+/*
+	Function to guess how long the rest of the current run will take
+	Every recipe still to cook weighs its estimate (a running one only what is left of it); the run takes
+	at least its longest chain of such recipes and at least all of that work spread over the cooks
+
+	Returns the estimate in the unit of estimate_recipe_ms(), or -1 outside a run
+*/
+long estimate_remaining_ms(COOK_CONTEXT *ctx, long now_ms) {
+	if (ctx->slots == NULL || ctx->history.recipes == NULL) return -1;
+
+	int count = ctx->history.recipe_count;
+	long *left = calloc(count, sizeof(long));
+	long *path = malloc(count * sizeof(long));
+	if (left == NULL || path == NULL) {
+		free(left);
+		free(path);
+		return -1;
+	}
+	for (int i = 0; i < count; i++) {
+		path[i] = -1;
+	}
+
+	long total = 0;
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE *recipe = ctx->analysis.required[i];
+		if (is_completed(recipe) || RECIPE_STATE_OF(recipe)->failed) continue;
+		left[RECIPE_STATE_OF(recipe)->index] = estimate_recipe_ms(ctx, recipe);
+	}
+	for (int i = 0; i < ctx->max_cooks; i++) {
+		COOK_SLOT *slot = &ctx->slots[i];
+		if (slot->pid == 0) continue;
+		long *recipe_left = &left[RECIPE_STATE_OF(slot->recipe)->index];
+		*recipe_left -= now_ms - slot->started_ms;
+		if (*recipe_left < 1) *recipe_left = 1; // over its estimate, but it is not done yet
+	}
+
+	long longest = 0;
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE *recipe = ctx->analysis.required[i];
+		total += left[RECIPE_STATE_OF(recipe)->index];
+		long chain = remaining_chain(recipe, left, path);
+		if (chain > longest) longest = chain;
+	}
+	free(left);
+	free(path);
+
+	long spread = total / (ctx->max_cooks > 0 ? ctx->max_cooks : 1);
+	return longest > spread ? longest : spread;
+}
+
+// longest chain of required sub-recipes down to a leaf from this one (itself included), before[] is -1 until worked out
+static long chain_before(RECIPE *recipe, long *cost, long *before) {
+	int index = RECIPE_STATE_OF(recipe)->index;
+	if (before[index] >= 0) return before[index];
+
+	long longest = 0;
+	for (RECIPE_LINK *dep = recipe->this_depends_on; dep != NULL; dep = dep->next) {
+		if (!is_required(dep->recipe)) continue;
+		long chain = chain_before(dep->recipe, cost, before);
+		if (chain > longest) longest = chain;
+	}
+	before[index] = cost[index] + longest;
+	return before[index];
+}
+
+/*
+	Function to find the critical path of the run: the recipes on its longest chain from a leaf to a target,
+	each recipe weighing its estimated duration (so the step counts until the cookbook has a history)
+	They are marked critical, and the ones without a class of their own get PRIORITY_CRITICAL
+
+	Returns the number of recipes marked, -1 if the estimates could not be allocated
+*/
+int boost_critical_path(COOK_CONTEXT *ctx) {
+	int count = ctx->history.recipe_count;
+	long *cost = calloc(count, sizeof(long));
+	long *before = malloc(count * sizeof(long));
+	long *after = malloc(count * sizeof(long));
+	if (cost == NULL || before == NULL || after == NULL) {
+		free(cost);
+		free(before);
+		free(after);
+		return -1;
+	}
+	for (int i = 0; i < count; i++) {
+		before[i] = after[i] = -1;
+	}
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE *recipe = ctx->analysis.required[i];
+		cost[RECIPE_STATE_OF(recipe)->index] = estimate_recipe_ms(ctx, recipe);
+	}
+
+	long longest = 0;
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE *recipe = ctx->analysis.required[i];
+		int index = RECIPE_STATE_OF(recipe)->index;
+		long through = chain_before(recipe, cost, before) + remaining_chain(recipe, cost, after) - cost[index];
+		if (through > longest) longest = through;
+	}
+
+	int marked = 0;
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE_STATE *state = RECIPE_STATE_OF(ctx->analysis.required[i]);
+		if (before[state->index] + after[state->index] - cost[state->index] != longest) continue;
+		state->critical = 1;
+		if (state->priority_class == PRIORITY_INHERIT) state->priority_class = PRIORITY_CRITICAL;
+		marked++;
+	}
+	free(cost);
+	free(before);
+	free(after);
+	return marked;
+}
+
+/*
+	Function to work out the longest chain of required recipes from this recipe up to a target
+	(the recipe itself included), each recipe on it weighing what cost() says
+	The result is kept as the priority of the recipe and visited marks it as done, so every recipe is only
+	worked out once however many chains it is on; the caller clears the visited marks again
+*/
+static long remaining_path(COOK_CONTEXT *ctx, RECIPE *recipe, long (*cost)(COOK_CONTEXT *, RECIPE *)) {
+	RECIPE_STATE *state = RECIPE_STATE_OF(recipe);
+	if (state->visited) return state->priority;
+
+	long longest = 0;
+	for (RECIPE_LINK *dependent = recipe->depend_on_this; dependent != NULL; dependent = dependent->next) {
+		if (!is_required(dependent->recipe)) continue;
+		long path = remaining_path(ctx, dependent->recipe, cost);
+		if (path > longest) longest = path;
+	}
+
+	state->priority = cost(ctx, recipe) + longest;
+	state->visited = 1;
+	return state->priority;
+}
+
+static long one_recipe(COOK_CONTEXT *ctx, RECIPE *recipe) {
+	return 1;
+}
+
+static void prioritize_critical_path(COOK_CONTEXT *ctx, long (*cost)(COOK_CONTEXT *, RECIPE *)) {
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		remaining_path(ctx, ctx->analysis.required[i], cost);
+	}
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE_STATE_OF(ctx->analysis.required[i])->visited = 0; // update_work_queue uses visited
+	}
+}
+
+// fifo: every recipe the same, so the queue hands them out in the order they became ready
+static void prioritize_fifo(COOK_CONTEXT *ctx) {
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE_STATE_OF(ctx->analysis.required[i])->priority = 0;
+	}
+}
+
+// critical-path: the most recipes still to cook after this one before a target is done
+static void prioritize_critical_path_count(COOK_CONTEXT *ctx) {
+	prioritize_critical_path(ctx, one_recipe);
+}
+
+// critical-path-time: the same with the estimated duration of each recipe instead of a count
+static void prioritize_critical_path_time(COOK_CONTEXT *ctx) {
+	prioritize_critical_path(ctx, estimate_recipe_ms);
+}
+
+// most-dependents: the recipes the most required recipes are waiting on directly
+static void prioritize_most_dependents(COOK_CONTEXT *ctx) {
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE *recipe = ctx->analysis.required[i];
+		long dependents = 0;
+		for (RECIPE_LINK *dependent = recipe->depend_on_this; dependent != NULL; dependent = dependent->next) {
+			if (is_required(dependent->recipe)) dependents++;
+		}
+		RECIPE_STATE_OF(recipe)->priority = dependents;
+	}
+}
+
+// sjf: shortest (estimated) job first
+static void prioritize_shortest_job(COOK_CONTEXT *ctx) {
+	for (int i = 0; i < ctx->analysis.recipe_count; i++) {
+		RECIPE *recipe = ctx->analysis.required[i];
+		RECIPE_STATE_OF(recipe)->priority = -estimate_recipe_ms(ctx, recipe);
+	}
+}
+
+static const SCHEDULING_POLICY policies[] = {
+	{ "fifo", "recipes in the order they became ready (default)", prioritize_fifo },
+	{ "critical-path", "longest chain of recipes left to a target first", prioritize_critical_path_count },
+	{ "critical-path-time", "longest estimated time left to a target first", prioritize_critical_path_time },
+	{ "most-dependents", "recipes the most other recipes wait on first", prioritize_most_dependents },
+	{ "sjf", "shortest estimated recipe first", prioritize_shortest_job },
+};
+
+#define POLICY_COUNT ((int)(sizeof(policies) / sizeof(policies[0])))
+
+// Returns the policy with this name, or NULL if there is none
+const SCHEDULING_POLICY *find_scheduling_policy(const char *name) {
+	for (int i = 0; i < POLICY_COUNT; i++) {
+		if (strcmp(policies[i].name, name) == 0) return &policies[i];
+	}
+	return NULL;
+}
+
+void print_scheduling_policies(FILE *out) {
+	for (int i = 0; i < POLICY_COUNT; i++) {
+		fprintf(out, "  %-20s %s\n", policies[i].name, policies[i].description);
+	}
+}
+
+void prioritize_recipes(COOK_CONTEXT *ctx) {
+	const SCHEDULING_POLICY *policy = ctx->policy != NULL ? ctx->policy : &policies[0];
+	policy->prioritize(ctx);
+}
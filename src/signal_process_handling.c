@@ -1,26 +1,47 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/select.h>
+#include <math.h>
 
 #include "signal_process_handling.h"
+#include "run_report.h"
+#include "async_log.h"
 
 #define UTIL_DIR "util/"
 
-// the following two variables are shared variables so must protect all modifications to prevent race conditions
-volatile sig_atomic_t active_cooks = 0;
-volatile sig_atomic_t completed_count = 0;
+// the only state shared with the signal handler, every other piece of run state lives in the COOK_CONTEXT
+volatile sig_atomic_t sigchld_flag = 0;
+static volatile long long sigchld_at_ns = 0; // first SIGCHLD since the last reap pass (--latency), 0 for none
+static int stamp_sigchld = 0;
 
-RECIPE **completed_recipes;
+// trace of the cook this process is and the track of its slot (set by a cook before its first task, so
+// execute_task() can trace its steps), NULL in the main cook and when the run is not traced
+static TRACE_LOG *cook_trace = NULL;
+static int cook_track = 0;
 
-COOKBOOK *cookbook_pid;
-RECIPE *main_recipe;
+// same for the usage of the steps: where a cook reports it, and for which recipe and task (NULL: not reported)
+static RUN_USAGE *cook_usage = NULL;
+static int cook_recipe = 0;
+static int cook_task = 0;
 
-volatile sig_atomic_t sigchld_flag = 0;
+// and the status page, with the slot of the cook on it (NULL: no status page)
+static STATUS_PAGE *cook_status = NULL;
+static int cook_slot = -1;
+
+// a step of the pipeline execute_task() is running, while tracing or reporting usage
+typedef struct step_run {
+    pid_t pid;
+    long started_us;
+    int index;
+    STEP *step;
+} STEP_RUN;
 
 // Function to set the pid in the recipe's state
 void set_pid_of_recipe(RECIPE *recipe, pid_t pid) {
@@ -29,7 +50,7 @@ void set_pid_of_recipe(RECIPE *recipe, pid_t pid) {
     }
 
     // Store the pid in the state
-    *(pid_t *)(recipe->state) = pid;
+    RECIPE_STATE_OF(recipe)->pid = pid;
 }
 
 // Function to get the pid from the recipe's state
@@ -37,8 +58,8 @@ pid_t get_pid_of_recipe(RECIPE *recipe) {
     if (recipe == NULL || recipe->state == NULL) {
         return -1;  // Return an invalid pid value if recipe or state is NULL
     }
-    // fprintf(stderr, "Accessing recipe (%s) state (%d) to get pid\n", recipe->name, *(pid_t *)recipe->state);
-    return *(pid_t *)(recipe->state);
+    // fprintf(stderr, "Accessing recipe (%s) state (%d) to get pid\n", recipe->name, RECIPE_STATE_OF(recipe)->pid);
+    return RECIPE_STATE_OF(recipe)->pid;
 }
 
 RECIPE *get_recipe_by_pid(COOKBOOK *cookbook, pid_t pid) {
@@ -55,7 +76,7 @@ RECIPE *get_recipe_by_pid(COOKBOOK *cookbook, pid_t pid) {
         /*
         fprintf(stderr, "Recipe (%s)", current->name);
         if(current->state!=NULL)
-            fprintf(stderr, "state (%d)\n", *(pid_t *)current->state);
+            fprintf(stderr, "state (%d)\n", RECIPE_STATE_OF(current)->pid);
         else
             fprintf(stderr, " null\n");
         */
@@ -74,12 +95,140 @@ RECIPE *get_recipe_by_pid(COOKBOOK *cookbook, pid_t pid) {
 // Signal handler for SIGCHLD to handle completed child processes
 void sigchld_handler(int sig) { // for the main cook that is tracking completed recipes
     sigchld_flag++;
+    if (stamp_sigchld && sigchld_at_ns == 0) sigchld_at_ns = latency_now_ns(); // clock_gettime is async-signal-safe
 }
 
 void sigchld_handler_cook(int sig) {
     // prevents program from crashing
 } // for the cooks executing the tasks and steps for recipes
 
+// Function to check whether another cook can be started, taking a token from the shared budget if there is one
+static int acquire_cook(COOK_CONTEXT *ctx) {
+    if (ctx->budget == NULL) return 1;
+    return acquire_token(ctx->budget);
+}
+
+static int weight_of(COOK_CONTEXT *ctx) {
+    return ctx->weight > 0 ? ctx->weight : 1;
+}
+
+/*
+	Function to find the first recipe in the work queue of the context that can start now
+	A recipe held up by cook units or memory holds up the recipes queued behind it too (so a big recipe
+	is not starved by small ones), one held up by its named pool is just passed over
+	Without resource annotations this is simply the front of the queue while units_in_use < limit
+	(the queue is a heap, so it is only put in dequeue order when the front is held up by its pool)
+*/
+static RECIPE *next_admissible_recipe(COOK_CONTEXT *ctx, int units_in_use, int limit) {
+    int blocked_by_pool;
+    RECIPE *front = peek_work_queue(ctx->work_queue);
+    if (front == NULL) return NULL;
+    if (admits_recipe(&ctx->resources, front, units_in_use, limit, &blocked_by_pool)) return front;
+    if (!blocked_by_pool) return NULL;
+
+    RECIPE **queued = malloc(work_queue_size(ctx->work_queue) * sizeof(RECIPE *));
+    if (queued == NULL) return NULL;
+    RECIPE *admitted = NULL;
+    int count = sorted_work_queue(ctx->work_queue, queued);
+    for (int i = 1; i < count; i++) {
+        if (admits_recipe(&ctx->resources, queued[i], units_in_use, limit, &blocked_by_pool)) {
+            admitted = queued[i];
+            break;
+        }
+        if (!blocked_by_pool) break;
+    }
+    free(queued);
+    return admitted;
+}
+
+/*
+	Function to pick the context of a pool that gets the next free cook (weighted fair sharing)
+	Among the contexts with a recipe that can start, the one using the fewest cook units for its weight wins,
+	ties go to the one that has started the fewest cooks for its weight so a job is never starved
+
+	Returns the context and sets *recipe to the recipe it should start, or NULL if no context can start one
+*/
+static COOK_CONTEXT *pick_next_context(COOK_CONTEXT **ctxs, int count, int units_in_use, int limit, RECIPE **recipe) {
+    COOK_CONTEXT *best = NULL;
+
+    for (int i = 0; i < count; i++) {
+        COOK_CONTEXT *ctx = ctxs[i];
+        if (ctx->failed || is_work_queue_empty(ctx->work_queue)) continue;
+
+        RECIPE *candidate = next_admissible_recipe(ctx, units_in_use, limit);
+        if (candidate == NULL) continue;
+        if (best == NULL) {
+            best = ctx;
+            *recipe = candidate;
+            continue;
+        }
+
+        // compare active / weight (then started / weight) without dividing
+        long share = (long)ctx->active_units * weight_of(best);
+        long best_share = (long)best->active_units * weight_of(ctx);
+        if (share == best_share) {
+            share = (long)ctx->started_count * weight_of(best);
+            best_share = (long)best->started_count * weight_of(ctx);
+        }
+        if (share < best_share) {
+            best = ctx;
+            *recipe = candidate;
+        }
+    }
+    return best;
+}
+
+/*
+	Function to hold back the start of a recipe while the machine has less memory available than the floor
+	of the pool (kept by its first context, which also caches MemAvailable for MEM_FLOOR_SAMPLE_MS)
+	Nothing is held while no cook is running, or no cook would ever give memory back
+	A recipe held back is marked throttled (once) in the context it belongs to
+
+	Returns 1 if the recipe has to wait
+*/
+static int held_by_mem_floor(COOK_CONTEXT *pool_ctx, COOK_CONTEXT *ctx, RECIPE *recipe, int active_units) {
+    if (pool_ctx->mem_floor_kb <= 0 || active_units == 0) return 0;
+
+    long now_ms = monotonic_ms();
+    if (pool_ctx->mem_sampled_ms == 0 || now_ms - pool_ctx->mem_sampled_ms >= MEM_FLOOR_SAMPLE_MS) {
+        pool_ctx->mem_available_kb = read_mem_available_kb();
+        pool_ctx->mem_sampled_ms = now_ms;
+    }
+    if (pool_ctx->mem_available_kb < 0 || pool_ctx->mem_available_kb >= pool_ctx->mem_floor_kb) return 0;
+
+    RECIPE_STATE *state = RECIPE_STATE_OF(recipe);
+    if (!state->throttled) {
+        state->throttled = 1;
+        ctx->throttled_count++;
+    }
+    return 1;
+}
+
+/*
+	Function to wait until there is something for the main cook to do
+	Without a shared budget the only event is a cook finishing (SIGCHLD)
+	With a shared budget a token returned by another request can also let a waiting recipe start,
+	so pselect watches the token pipe while atomically unblocking SIGCHLD like sigsuspend does
+	timeout_ms >= 0 also wakes the loop up after that long (the adaptive limit has to sample the system)
+*/
+static void wait_for_cook_event(TOKEN_BUDGET *budget, sigset_t *orig_mask, int waiting_for_token, long timeout_ms) {
+    if ((budget == NULL || !waiting_for_token) && timeout_ms < 0) {
+        sigsuspend(orig_mask);
+        return;
+    }
+
+    fd_set read_set;
+    int nfds = 0;
+    FD_ZERO(&read_set);
+    if (budget != NULL && waiting_for_token) {
+        FD_SET(budget->read_fd, &read_set);
+        nfds = budget->read_fd + 1;
+    }
+
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    pselect(nfds, &read_set, NULL, NULL, timeout_ms < 0 ? NULL : &timeout, orig_mask);
+}
+
 void print_step_words(STEP *step) {
     // fprintf(stderr, "%p\n", step);
     if (step == NULL || step->words == NULL) {
@@ -95,6 +244,28 @@ void print_step_words(STEP *step) {
     fprintf(stderr, "\n"); // Print newline after all words are printed.
 }
 
+// Function to report the usage of the step of the pipeline with this pid and trace it, it just ended with this wait() status
+static void step_ended(STEP_RUN *runs, int count, pid_t pid, int status, struct rusage *rusage) {
+    for (int i = 0; runs != NULL && i < count; i++) {
+        if (runs[i].pid != pid) continue;
+
+        if (cook_usage != NULL) send_usage_report(cook_usage, cook_recipe, cook_task, runs[i].index, rusage);
+        if (cook_trace == NULL) return;
+
+        char argv[TRACE_ARGS_MAX / 2] = "", word[TRACE_ARGS_MAX / 2], exit_status[32], args[TRACE_ARGS_MAX];
+        for (char **words = runs[i].step->words; *words != NULL && strlen(argv) + 2 < sizeof(argv); words++) {
+            trace_escape(word, sizeof(argv) - strlen(argv) - 1, *words);
+            if (argv[0] != '\0') strcat(argv, " ");
+            strcat(argv, word);
+        }
+        trace_status(exit_status, sizeof(exit_status), status);
+        snprintf(args, sizeof(args), "\"argv\":\"%s\",\"pid\":%d,\"slot_track\":%d,\"status\":\"%s\"",
+            argv, (int)pid, cook_track, exit_status);
+        trace_slice(cook_trace, "step", runs[i].step->words[0], TRACE_STEP_TRACKS + pid, runs[i].started_us, trace_now_us(cook_trace), args);
+        return;
+    }
+}
+
 // Function to set up and execute a single task's steps in a pipeline
 int execute_task(TASK *task) {
 
@@ -104,6 +275,15 @@ int execute_task(TASK *task) {
     pid_t pid;
     STEP *step = task->steps;
 
+    // while tracing, every step is timed from its fork to its reaping (and its usage is reported with its position)
+    STEP_RUN *runs = NULL;
+    int run_count = 0, step_count = 0, steps_done = 0;
+    for (STEP *counted = task->steps; counted != NULL; counted = counted->next) step_count++;
+    if (cook_trace != NULL || cook_usage != NULL) {
+        runs = calloc(step_count > 0 ? step_count : 1, sizeof(STEP_RUN));
+    }
+    set_status_step(cook_status, cook_slot, cook_task, 0, step_count);
+
     //fprintf(stderr, "******************************************\n");
     //print_step_words(step);
     //fprintf(stderr, "******************************************\n");
@@ -112,7 +292,10 @@ int execute_task(TASK *task) {
     // If the task specifies an input file, file descriptor is opened with O_RDONLY and later redirected to the standard input of the first process in pipeline using dup2.
     if (task->input_file) {
         input_fd = open(task->input_file, O_RDONLY);
-        if (input_fd < 0) return -1;
+        if (input_fd < 0) {
+            free(runs);
+            return -1;
+        }
     }
 
     // Set up output redirection if specified - later redirected to the standard output of the last process in the pipeline.
@@ -124,7 +307,10 @@ int execute_task(TASK *task) {
     */
     if (task->output_file) {
         output_fd = open(task->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-        if (output_fd < 0) return -1;
+        if (output_fd < 0) {
+            free(runs);
+            return -1;
+        }
     }
 
     // Process each step, creating a pipeline - A pipe is created for each step in the task using pipe()
@@ -160,11 +346,18 @@ int execute_task(TASK *task) {
             execvp(step->words[0], step->words);
 
             fprintf(stderr, "ERROR: execvp failed on program executable for step both from util path and step->words[]\n");
-            exit(EXIT_FAILURE);
+            flush_log();
+            _exit(EXIT_FAILURE);
         } else { // parent process - waits for each child process to complete
             int status;
+            struct rusage rusage;
 
-            waitpid(pid, &status, WNOHANG); // waiting for child process above to finish
+            if (runs != NULL) runs[run_count] = (STEP_RUN){ pid, cook_trace != NULL ? trace_now_us(cook_trace) : 0, run_count, step };
+            run_count++;
+            if (wait4(pid, &status, WNOHANG, &rusage) == pid) { // waiting for child process above to finish
+                step_ended(runs, run_count, pid, status, &rusage);
+                set_status_step(cook_status, cook_slot, cook_task, ++steps_done, step_count);
+            }
         }
 
         if (prev_fd != -1) close(prev_fd); // close read end of the pipe from previous step
@@ -175,10 +368,18 @@ int execute_task(TASK *task) {
 
     // Wait for all child processes in the pipeline - If any process in the pipeline fails (non-zero exit status or abnormal termination), returns -1, causing the program to terminate
     int pipeline_status = 0; // store status information
-    while (wait(&pipeline_status) > 0) { // waits for any child process to terminate and returns child PID (if no child processes left returns -1)
-        if (!WIFEXITED(pipeline_status) || WEXITSTATUS(pipeline_status) != 0) return -1; // checks child process terminate normally
+    pid_t done;
+    struct rusage rusage; // wait4 instead of wait: the usage of the step would be lost otherwise
+    while ((done = wait4(-1, &pipeline_status, 0, &rusage)) > 0) { // waits for any child process to terminate and returns child PID (if no child processes left returns -1)
+        step_ended(runs, run_count, done, pipeline_status, &rusage);
+        set_status_step(cook_status, cook_slot, cook_task, ++steps_done, step_count);
+        if (!WIFEXITED(pipeline_status) || WEXITSTATUS(pipeline_status) != 0) { // checks child process terminate normally
+            free(runs);
+            return -1;
+        }
         // if process terminated normally extracts exit status, else catches pipeline failed
     }
+    free(runs);
     return 0;
 }
 
@@ -192,161 +393,646 @@ void update_work_queue_signal_block(WORK_QUEUE *work_queue) {
 
     sigprocmask(SIG_BLOCK, &block_set, &old_set);
 
-    update_work_queue(work_queue, completed_recipes, completed_count, main_recipe);
+    update_work_queue(work_queue, completed_recipes, completed_count);
 
     sigprocmask(SIG_SETMASK, &old_set, NULL);
 }
 #endif
 
-// Main processing loop
-void main_processing_loop(WORK_QUEUE *work_queue, int max_cooks, COOKBOOK *cookbook_parsed, RECIPE *recipe_selected, RECIPE **completed_list) {
+// Function to trace a task of the recipe of this cook, from started_us to now (nothing if the run is not traced)
+static void trace_task(RECIPE *recipe, int task_index, long started_us, int task_status) {
+    if (cook_trace == NULL) return;
 
-    // fprintf(stderr, "Inside the main processing loops\n");
+    char name[32], recipe_name[TRACE_ARGS_MAX / 2], args[TRACE_ARGS_MAX];
+    snprintf(name, sizeof(name), "task %d", task_index);
+    trace_escape(recipe_name, sizeof(recipe_name), recipe->name);
+    snprintf(args, sizeof(args), "\"recipe\":\"%s\",\"status\":\"%s\"", recipe_name, task_status == 0 ? "completed" : "failed");
+    trace_slice(cook_trace, "task", name, cook_track, started_us, trace_now_us(cook_trace), args);
+}
 
-    cookbook_pid = cookbook_parsed;
-    main_recipe = recipe_selected;
-    completed_recipes = completed_list;
+// Function to trace the recipe a cook slot just finished with this wait() status (nothing if the run is not traced)
+static void trace_recipe(COOK_CONTEXT *ctx, int slot_index, COOK_SLOT *slot, int status) {
+    if (ctx->trace == NULL) return;
+
+    const char *outcomes[] = { "", ",\"killed\":\"timed out\"", ",\"killed\":\"lost race\"" };
+    char exit_status[32], args[TRACE_ARGS_MAX];
+    trace_status(exit_status, sizeof(exit_status), status);
+    snprintf(args, sizeof(args), "\"pid\":%d,\"slot\":%d,\"status\":\"%s\",\"backup\":%s%s",
+        (int)slot->pid, slot_index, exit_status, slot->backup ? "true" : "false", outcomes[slot->killed]);
+    trace_slice(ctx->trace, "recipe", slot->recipe->name, ctx->trace_track + slot_index, slot->started_us,
+        trace_now_us(ctx->trace), args);
+}
 
-    // main cook gets separate handler with the write permissions to the shared resource
-    struct sigaction sa; // structure for signal handling
-    sigemptyset(&sa.sa_mask); // initializes the signal mask set in the sa structure to be empty so no signals are blocked while the handler executes
-    sa.sa_flags = SA_RESTART; // ensures that interuppted system calls will automatically restart instead of failing with error
-    sa.sa_handler = sigchld_handler; // assigns sigchld_handler as the handler for sigchld signal, called when a child process exits for main cook
-    sigaction(SIGCHLD, &sa, NULL); // registers the sigchld_handler to handle the sigchld signals
+// Function to show a recipe in the given state on the status page (nothing without one)
+static void show_recipe_status(COOK_CONTEXT *ctx, RECIPE *recipe, STATUS_STATE state) {
+    STATUS_PAGE *page = &ctx->status;
+    if (page->map == NULL) return;
+
+    STATUS_RECIPE *entry = &page->recipes[RECIPE_STATE_OF(recipe)->index];
+    long now_ms = monotonic_ms();
+    begin_status_update(page);
+    if (state == STATUS_COOKING) {
+        entry->cooks++;
+        if (entry->started_ms == 0) entry->started_ms = now_ms;
+    }
+    if (state == STATUS_COMPLETED || state == STATUS_FAILED) entry->ended_ms = now_ms;
+    entry->state = state;
+    end_status_update(page);
+}
 
-    sigset_t block_mask, orig_mask;
-    sigemptyset(&block_mask); // initializes the block mask to an empty set of signals (so can check multiple signals)
-    sigaddset(&block_mask, SIGCHLD); // adds sigchld to block_mask allowing it to be blocked or unblocked as needed below
+// Function to show what a cook slot is doing on the status page: cooking recipe with the cook pid, or free (recipe NULL)
+static void show_slot_status(COOK_CONTEXT *ctx, int slot, RECIPE *recipe, pid_t pid) {
+    STATUS_PAGE *page = &ctx->status;
+    if (page->map == NULL || slot < 0 || slot >= ctx->max_cooks) return;
+
+    STATUS_SLOT *entry = &page->slots[slot];
+    begin_status_update(page);
+    entry->pid = pid;
+    entry->recipe = recipe != NULL ? RECIPE_STATE_OF(recipe)->index : -1;
+    if (pid == 0) { // before the fork, the cook writes its task and step from then on
+        __atomic_store_n(&entry->task, -1, __ATOMIC_RELAXED);
+        entry->started_ms = monotonic_ms();
+    }
+    end_status_update(page);
+}
 
-    // Strategy: Have signals masked all the time except for when suspending
+// Function to put the counts of a context on its status page (every pass of the main processing loop)
+static void show_run_status(COOK_CONTEXT *ctx, long now_ms) {
+    STATUS_PAGE *page = &ctx->status;
+    if (page->map == NULL) return;
+
+    begin_status_update(page);
+    page->header->queue_depth = work_queue_size(ctx->work_queue);
+    page->header->active_cooks = ctx->active_cooks;
+    page->header->completed = ctx->completed_count;
+    page->header->failed = ctx->failed_count;
+    page->header->updated_ms = now_ms;
+    end_status_update(page);
+}
 
-    // signals are masked all time in main program (except for in suspend - avoid spinning) - deals with races when signals terminating when suspending
-    sigprocmask(SIG_BLOCK, &block_mask, &orig_mask); // blocks sigchld by setting the signal mask to block mask (orig mask stores the previous mask)
+/*
+	Function to fork the cook process for a recipe taken off the work queue
+	The cook carries out the recipe's tasks in sequence and exits with their status
+	A backup is a speculative second cook for a recipe that is already being cooked (not reported as started)
+	When the run can kill cooks (timeouts, speculation) every cook leads its own process group, so
+	killing the group also gets the steps it is waiting for
+	With a placement the cook pins itself to the cpu domain chosen for it here, and it takes the nice value
+	and I/O priority of the class of its recipe; its steps inherit both
+
+	Returns the pid of the cook, or -1 if the fork failed
+*/
+static pid_t start_cook(COOK_CONTEXT *ctx, RECIPE *recipe, sigset_t *orig_mask, int backup) {
+    fflush(NULL); // nothing buffered by the caller may be written twice
 
-    while (1) {
+    int slot = 0;
+    while (slot < ctx->max_cooks && ctx->slots[slot].pid != 0) slot++;
 
-        if (is_work_queue_empty(work_queue) && active_cooks == 0) {
-            break; // ending case to end the main processing loop: when there is nothing left to complete in work queue and no active cooks
+    int domain = place_recipe(&ctx->placement, recipe);
+    show_slot_status(ctx, slot, recipe, 0);
+
+    // dispatch latency of the steps: the recipe could start once it was ready and a cook was free
+    long long eligible_ns = ctx->latency.enabled ? RECIPE_STATE_OF(recipe)->ready_ns : 0;
+    if (slot < ctx->max_cooks && ctx->slots[slot].freed_ns > eligible_ns) eligible_ns = ctx->slots[slot].freed_ns;
+    pid_t pid = fork();
+
+    if (pid == 0) { //  child process (returns 0)
+
+        // the cook waits for its steps with wait(): it needs neither the main cook's handler nor SIGCHLD blocked,
+        // and the steps it runs must start with the signal mask the caller of cook_run had
+        signal(SIGCHLD, SIG_DFL);
+        sigprocmask(SIG_SETMASK, orig_mask, NULL);
+        if (ctx->group_cooks) setpgid(0, 0);
+        if (pin_to_domain(&ctx->placement, domain) != 0) {
+            perror("Failed to pin the cook to its cpus"); // it still cooks, just anywhere
         }
+        apply_priority_class(RECIPE_STATE_OF(recipe)->priority_class); // what it may not get it does without
 
-        if (!is_work_queue_empty(work_queue) && active_cooks < max_cooks) { // the work queue has recipes that need to be execute and there are cooks available
+        if (apply_recipe_limits(recipe) != 0) { // a recipe is never cooked without its caps
+            flush_log();
+            _exit(EXIT_FAILURE);
+        }
+        if (ctx->latency.enabled) {
+            char eligible[32];
+            snprintf(eligible, sizeof(eligible), "%lld", eligible_ns);
+            setenv("COOK_READY_NS", eligible, 1);
+        }
 
-            RECIPE *recipe = dequeue(work_queue);
+        set_pid_of_recipe(recipe, getpid());
+        cook_trace = ctx->trace;
+        cook_track = ctx->trace_track + slot;
+        cook_usage = ctx->usage.steps ? &ctx->usage : NULL;
+        cook_recipe = RECIPE_STATE_OF(recipe)->index;
+        cook_status = &ctx->status;
+        cook_slot = slot;
+
+        // the perf counters are inherited by the steps, so they count the whole recipe
+        PERF_SET counters;
+        if (ctx->usage.counters) open_perf_counters(&counters, ctx->usage.counters_available);
+
+        TASK *task = recipe->tasks;
+        int task_index = 0, exit_status = EXIT_SUCCESS;
+        while (task != NULL) {
+            long task_started_ms = monotonic_ms();
+            long task_started_us = cook_trace != NULL ? trace_now_us(cook_trace) : 0;
+            cook_task = task_index;
+
+            int task_status = execute_task(task);
+            trace_task(recipe, task_index, task_started_us, task_status);
+            if (task_status != 0) {
+                exit_status = EXIT_FAILURE;
+                break;
+            }
 
-            if (recipe != NULL) {
+            send_task_report(&ctx->history, RECIPE_STATE_OF(recipe)->index, task_index++, monotonic_ms() - task_started_ms);
+            task = task->next;
+        }
 
-                // ensure recipe->state has allocated memory
-                if (recipe->state == NULL) {
-                    recipe->state = malloc(sizeof(pid_t));
-                    if (recipe->state == NULL) {
-                        fprintf(stderr, "ERROR: Failed to allocate memory for the recipe state");
-                        exit(EXIT_FAILURE);
-                    }
-                }
+        if (ctx->usage.counters) {
+            PERF_COUNTS counts;
+            close_perf_counters(&counters, &counts);
+            send_counter_report(&ctx->usage, cook_recipe, &counts);
+        }
+        flush_log(); // what the cook logged (make debug), _exit skips the atexit handler that writes it
+        _exit(exit_status); // _exit: the cook must not run the atexit handlers of a program embedding libcook
+
+    } else if (pid > 0) { // parent process (returns pid of child)
+
+        if (ctx->latency.enabled && !backup) {
+            record_latency(&ctx->latency, LATENCY_READY_TO_FORK, latency_now_ns() - RECIPE_STATE_OF(recipe)->ready_ns);
+        }
+        if (ctx->group_cooks) setpgid(pid, pid); // both sides, whichever runs first
+        if (slot < ctx->max_cooks) {
+            ctx->slots[slot].pid = pid;
+            ctx->slots[slot].recipe = recipe;
+            ctx->slots[slot].started_ms = monotonic_ms();
+            ctx->slots[slot].started_us = ctx->trace != NULL ? trace_now_us(ctx->trace) : 0;
+            ctx->slots[slot].backup = backup;
+            ctx->slots[slot].domain = domain;
+            ctx->slots[slot].killed = SLOT_RUNNING;
+        }
+        show_slot_status(ctx, slot, recipe, pid);
+        show_recipe_status(ctx, recipe, STATUS_COOKING);
+        ctx->active_cooks++;
+        ctx->active_units += recipe_units(recipe);
+        take_resources(&ctx->resources, recipe);
+        ctx->started_count++;
+        mark_visited(recipe); // a started recipe must never be queued again by update_work_queue
+        set_pid_of_recipe(recipe, pid);
+        if (!backup) report_progress(ctx, recipe, COOK_RECIPE_STARTED, pid);
+    } else {
+        unplace_recipe(&ctx->placement, domain);
+        show_slot_status(ctx, slot, NULL, 0);
+    }
+    return pid;
+}
+
+// Function to signal a cook, together with its steps when it leads its own process group
+static int kill_cook(COOK_CONTEXT *ctx, COOK_SLOT *slot, int sig) {
+    return kill(ctx->group_cooks ? -slot->pid : slot->pid, sig);
+}
+
+// Function to find the other cook still racing on the recipe of a slot (speculative execution), NULL if there is none
+static COOK_SLOT *twin_of(COOK_CONTEXT *ctx, COOK_SLOT *slot) {
+    for (int i = 0; i < ctx->max_cooks; i++) {
+        COOK_SLOT *other = &ctx->slots[i];
+        if (other != slot && other->pid != 0 && other->recipe == slot->recipe && other->killed == SLOT_RUNNING) return other;
+    }
+    return NULL;
+}
+
+static long timeout_of(COOK_CONTEXT *ctx, RECIPE *recipe) {
+    long timeout_ms = RECIPE_STATE_OF(recipe)->timeout_ms;
+    return timeout_ms > 0 ? timeout_ms : ctx->timeout_ms;
+}
 
-                pid_t pid = fork();
+/*
+	Function to kill every cook of the context that has run past the timeout of its recipe (with its steps)
+	They are reaped like any other cook, reap_cooks() reports them as timed out
 
-                if (pid == 0) { //  child process (returns 0)
+	Returns how long until the next timeout of a running cook in ms, -1 if none of them has one
+*/
+static long enforce_timeouts(COOK_CONTEXT *ctx, long now_ms) {
+    long next_ms = -1;
+
+    for (int i = 0; i < ctx->max_cooks; i++) {
+        COOK_SLOT *slot = &ctx->slots[i];
+        long timeout_ms;
+        if (slot->pid == 0 || slot->killed != SLOT_RUNNING || (timeout_ms = timeout_of(ctx, slot->recipe)) <= 0) continue;
+
+        long left_ms = slot->started_ms + timeout_ms - now_ms;
+        if (left_ms <= 0) {
+            fprintf(stderr, "ERROR: Recipe '%s' timed out after %.1fs, killing its cook %d and its steps\n",
+                    slot->recipe->name, timeout_ms / 1000.0, slot->pid);
+            kill_cook(ctx, slot, SIGKILL);
+            slot->killed = SLOT_TIMED_OUT;
+        } else if (next_ms < 0 || left_ms < next_ms) {
+            next_ms = left_ms;
+        }
+    }
+    return next_ms;
+}
 
-                    // child processes get own handler (for each cook doing each recipe it was assigned)
-                    // no write permissions to shared resource for this handler (really only here so program does not crash)
+/*
+	Function to find a straggler worth a speculative copy: a cook of an idempotent recipe that has no copy
+	yet and has run at least SPECULATE_MIN_MS, SPECULATE_FACTOR times its average duration and
+	SPECULATE_SIGMAS standard deviations past that average (recipes without a duration history never qualify)
+	*wait_ms is lowered to when the next cook would become a straggler
+*/
+static COOK_SLOT *find_straggler(COOK_CONTEXT *ctx, long now_ms, long *wait_ms) {
+    COOK_SLOT *straggler = NULL;
+
+    for (int i = 0; i < ctx->max_cooks; i++) {
+        COOK_SLOT *slot = &ctx->slots[i];
+        if (slot->pid == 0 || slot->killed != SLOT_RUNNING || !RECIPE_STATE_OF(slot->recipe)->idempotent) continue;
+        if (twin_of(ctx, slot) != NULL) continue;
+
+        DURATION_STAT *stat = &ctx->history.recipes[RECIPE_STATE_OF(slot->recipe)->index];
+        if (stat->samples == 0) continue;
+
+        double threshold_ms = SPECULATE_FACTOR * stat->mean_ms;
+        if (stat->mean_ms + SPECULATE_SIGMAS * sqrt(stat->var_ms) > threshold_ms) threshold_ms = stat->mean_ms + SPECULATE_SIGMAS * sqrt(stat->var_ms);
+        if (threshold_ms < SPECULATE_MIN_MS) threshold_ms = SPECULATE_MIN_MS;
+
+        long left_ms = slot->started_ms + (long)threshold_ms - now_ms;
+        if (left_ms <= 0) {
+            if (straggler == NULL || slot->started_ms < straggler->started_ms) straggler = slot;
+        } else if (*wait_ms < 0 || left_ms < *wait_ms) {
+            *wait_ms = left_ms;
+        }
+    }
+    return straggler;
+}
 
-                    set_pid_of_recipe(recipe, getpid());
+/*
+	Function to start a speculative copy of a straggler of the context, if it has one and a cook is free for it
+	The copy and the original race: the first to finish wins and the other is killed (see reap_cooks)
 
-                    TASK *task = recipe->tasks;
-                    while (task != NULL) {
+	Returns 1 if a copy was started and 0 otherwise
+*/
+static int start_backup(COOK_CONTEXT *ctx, int units_in_use, int limit, long now_ms, long *wait_ms, sigset_t *orig_mask) {
+    if (!ctx->speculate || ctx->failed) return 0;
+
+    COOK_SLOT *straggler = find_straggler(ctx, now_ms, wait_ms);
+    if (straggler == NULL) return 0;
+
+    int blocked_by_pool;
+    if (ctx->active_cooks < ctx->max_cooks && admits_recipe(&ctx->resources, straggler->recipe, units_in_use, limit, &blocked_by_pool) &&
+        acquire_cook(ctx)) {
+        if (start_cook(ctx, straggler->recipe, orig_mask, 1) != -1) {
+            ctx->backup_count++;
+            return 1;
+        }
+        if (ctx->budget != NULL) release_token(ctx->budget);
+    }
 
-                        if (execute_task(task) != 0) exit(EXIT_FAILURE);
+    // no free cook for it now, look again a little later (a shared budget does not wake the loop up)
+    if (*wait_ms < 0 || *wait_ms > SPECULATE_SAMPLE_MS) *wait_ms = SPECULATE_SAMPLE_MS;
+    return 0;
+}
 
-                        task = task->next;
-                    }
-                    exit(EXIT_SUCCESS);
+/*
+	Function to give a failed recipe another go if it has retries left
+	The recipe waits in the retrying list of the context for its backoff (doubled for every retry) and is
+	then put back into the work queue by release_due_retries(), so no cook is held up while it waits
 
-                } else if (pid > 0) { // parent process (returns pid of child)
+	Returns 1 if a retry was scheduled and 0 if the recipe has failed for good
+*/
+static int schedule_retry(COOK_CONTEXT *ctx, RECIPE *recipe, pid_t pid) {
+    RECIPE_STATE *state = RECIPE_STATE_OF(recipe);
+    int retries = state->retries > 0 ? state->retries : ctx->retries;
+    if (state->retries_used >= retries) return 0;
+
+    long backoff_ms = state->retry_backoff_ms > 0 ? state->retry_backoff_ms : ctx->retry_backoff_ms;
+    if (backoff_ms <= 0) backoff_ms = RETRY_BACKOFF_MS;
+    for (int i = 0; i < state->retries_used && backoff_ms < RETRY_BACKOFF_MAX_MS; i++) {
+        backoff_ms *= 2;
+    }
+    if (backoff_ms > RETRY_BACKOFF_MAX_MS) backoff_ms = RETRY_BACKOFF_MAX_MS;
+
+    state->retries_used++;
+    state->retry_at_ms = monotonic_ms() + backoff_ms;
+    ctx->retrying[ctx->retrying_count++] = recipe;
+    fprintf(stderr, "ERROR: Recipe process %d failed, recipe '%s' is cooked again in %.1fs (retry %d of %d).\n",
+            pid, recipe->name, backoff_ms / 1000.0, state->retries_used, retries);
+    return 1;
+}
 
-                    active_cooks++;
-                    set_pid_of_recipe(recipe, pid);
+/*
+	Function to put the recipes whose retry backoff is over back into the work queue
 
-                } else { // invalid return for process id - put back stuff into work queue?
-                    fprintf(stderr, "ERRROR: Fork failed\n");
-                    abort();
+	If the work queue can't take a recipe back the run of the context is abandoned
+
+	Returns how long until the next waiting retry is due in ms, -1 if none is waiting
+*/
+static void abandon_run(COOK_CONTEXT *ctx);
+static long release_due_retries(COOK_CONTEXT *ctx) {
+    if (ctx->retrying_count == 0) return -1;
+
+    long now_ms = monotonic_ms(), next_ms = -1;
+    for (int i = 0; i < ctx->retrying_count; ) {
+        RECIPE *recipe = ctx->retrying[i];
+        long left_ms = RECIPE_STATE_OF(recipe)->retry_at_ms - now_ms;
+        if (left_ms <= 0) {
+            if (enqueue(ctx->work_queue, recipe) != 0) {
+                ctx->failed = 1;
+                abandon_run(ctx);
+                return -1;
+            }
+            ctx->retrying[i] = ctx->retrying[--ctx->retrying_count];
+            ctx->retry_count++;
+            continue;
+        }
+        if (next_ms < 0 || left_ms < next_ms) next_ms = left_ms;
+        i++;
+    }
+    return next_ms;
+}
+
+/*
+	Function to reap every cook of this context that has finished
+	Only the pids of this context's cooks are waited for, other children of the process are left alone
+	Once the run has been abandoned the cooks killed by abandon_run() are reaped without being reported
+	A failed recipe is marked failed in its state, so keep going mode can leave its dependents out
+
+	Returns -1 if one of the reaped cooks failed (or the work queue could not take its dependents) and 0 otherwise
+*/
+static int reap_cooks(COOK_CONTEXT *ctx, int abandoned) {
+    int ret = 0;
+
+    for (int i = 0; i < ctx->max_cooks; i++) {
+        COOK_SLOT *slot = &ctx->slots[i];
+        int status;
+        struct rusage rusage;
+
+        if (slot->pid == 0 || wait4(slot->pid, &status, WNOHANG, &rusage) != slot->pid) continue;
+        long long reaped_ns = ctx->latency.enabled ? latency_now_ns() : 0;
+        if (sigchld_at_ns > 0) record_latency(&ctx->latency, LATENCY_SIGCHLD_TO_REAP, reaped_ns - sigchld_at_ns);
+
+        // fprintf(stderr, "Waitpid returns %d and status: %x\n", slot->pid, status);
+
+        trace_recipe(ctx, i, slot, status);
+        pid_t pid = slot->pid;
+        RECIPE *recipe = slot->recipe;
+        long duration_ms = monotonic_ms() - slot->started_ms;
+        read_task_reports(&ctx->history); // the cook sent its task durations before it exited
+        read_usage_reports(&ctx->usage); // and the usage of its steps
+        if (ctx->usage.recipes != NULL) add_rusage(&ctx->usage.recipes[RECIPE_STATE_OF(recipe)->index].total, &rusage);
+        ctx->usage.busy_ms += duration_ms;
+        COOK_SLOT *twin = twin_of(ctx, slot);
+        SLOT_KILL killed = slot->killed;
+        int backup = slot->backup;
+        int domain = slot->domain;
+        slot->pid = 0;
+        slot->recipe = NULL;
+        slot->freed_ns = reaped_ns;
+        unplace_recipe(&ctx->placement, domain);
+        show_slot_status(ctx, i, NULL, 0);
+
+        ctx->active_cooks--;
+        ctx->active_units -= recipe_units(recipe);
+        release_resources(&ctx->resources, recipe);
+        if (ctx->budget != NULL) release_token(ctx->budget);
+
+        if (killed == SLOT_LOST_RACE) continue; // its twin finished first and was reported
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+
+            if (twin != NULL) { // won the race against a speculative copy (or as the copy)
+                kill_cook(ctx, twin, SIGKILL);
+                twin->killed = SLOT_LOST_RACE;
+                if (backup) ctx->backup_wins++;
+            }
+
+            ctx->completed_recipes[ctx->completed_count++] = recipe;
+            RECIPE_STATE_OF(recipe)->completed = 1;
+            RECIPE_STATE_OF(recipe)->domain = domain + 1; // its dependents follow the cook that made it
+            show_recipe_status(ctx, recipe, STATUS_COMPLETED);
+            add_recipe_duration(&ctx->history, RECIPE_STATE_OF(recipe)->index, duration_ms);
+            report_progress(ctx, recipe, COOK_RECIPE_COMPLETED, pid);
+
+            // update for every reaped cook: two cooks finishing together must both release their dependents
+            if (!abandoned) {
+                if (update_work_queue(ctx->work_queue, ctx->completed_recipes, ctx->completed_count) != 0) {
+                    ctx->failed = 1; // its dependents can't be queued, even keep going mode gives up the run
+                    ret = -1;
                 }
-            } else {
-                // This shouldn't happen because there should be something in the work queue
-                abort();
+                if (ctx->latency.enabled) record_latency(&ctx->latency, LATENCY_REAP_TO_QUEUE, latency_now_ns() - reaped_ns);
             }
+            if (ctx->show_eta) print_eta(ctx, stderr);
 
-        } else { // at max capacity of active cooks (equal to max cooks) waits for cook to finish
-            sigsuspend(&orig_mask); // waits for any unblocked signals to arrive allowing the handler to execute
+        } else if (!abandoned && twin != NULL) {
+            fprintf(stderr, "ERROR: Recipe process %d failed, the other cook of recipe '%s' carries on.\n", pid, recipe->name);
 
-            int status;
-            pid_t pid;
+        } else if (!abandoned && schedule_retry(ctx, recipe, pid)) {
+            // not failed yet, it is back in the work queue after its backoff
+            show_recipe_status(ctx, recipe, STATUS_WAITING);
+
+        } else if (!abandoned) {
+            fprintf(stderr, "ERROR: Recipe process %d failed.\n", pid);
+            if (killed == SLOT_TIMED_OUT) {
+                RECIPE_STATE_OF(recipe)->timed_out = 1;
+                ctx->timed_out_count++;
+            }
+            RECIPE_STATE_OF(recipe)->failed = 1; // never completed, so update_work_queue never releases its dependents
+            show_recipe_status(ctx, recipe, STATUS_FAILED);
+            ctx->failed_count++;
+            report_progress(ctx, recipe, COOK_RECIPE_FAILED, pid);
+            ret = -1;
+        } else if (twin == NULL) {
+            show_recipe_status(ctx, recipe, STATUS_WAITING); // killed with its abandoned run, it is skipped
+        }
+    }
+    return ret;
+}
+
+/*
+	Function to give up on the run after a recipe failed
+	Every cook still running is killed (they are reaped by the main processing loop as usual)
+	and the recipes waiting in the work queue are dropped so the loop ends once the cooks are gone
+*/
+static void abandon_run(COOK_CONTEXT *ctx) {
+    for (int i = 0; i < ctx->max_cooks; i++) {
+        if (ctx->slots[i].pid != 0 && kill_cook(ctx, &ctx->slots[i], SIGKILL) == -1) {
+            fprintf(stderr, "Failed to terminate child process\n");
+        }
+    }
 
-            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    while (!is_work_queue_empty(ctx->work_queue)) {
+        dequeue(ctx->work_queue);
+    }
+    ctx->retrying_count = 0;
+}
 
-                // fprintf(stderr, "Waitpid returns %d and status: %x\n", pid, status);
+/*
+	Main processing loop
+	Runs until the work queue is empty and no cooks are active; the work queue, completed list and
+	cook slots of the context must have been set up by cook_run()
 
-                active_cooks--;
+	Returns 0 if every recipe was completed and -1 if a recipe failed (or a cook could not be started)
+*/
+int main_processing_loop(COOK_CONTEXT *ctx) {
+    return pool_processing_loop(&ctx, 1, ctx->max_cooks);
+}
 
-                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+/*
+	Main processing loop for a pool of contexts sharing max_cooks cooks (a single cook_run is a pool of one)
+	Runs until every work queue is empty and no cooks are active
+	A failure only abandons the context it happened in (ctx->failed is set), the other contexts keep cooking
+	In keep going mode a failure abandons nothing: the failed recipe's dependents just never become ready
 
-                    RECIPE *recipe = get_recipe_by_pid(cookbook_pid, pid);
+	Returns 0 if every context completed its targets and -1 otherwise
+*/
+int pool_processing_loop(COOK_CONTEXT **ctxs, int count, int max_cooks) {
 
-                    completed_recipes[completed_count++] = recipe;
+    // fprintf(stderr, "Inside the main processing loops\n");
 
-                } else {
-                    fprintf(stderr, "ERROR: Recipe process %d failed.\n", pid);
-                    // send signal to all child processes cooks
-                    // gets cooks to kill all signals
-                    // Iterate through all recipes in the cookbook and kill their processes
-                    while (recipe_selected != NULL) {
-                        if (recipe_selected->state != NULL) {
-                            pid_t *child_pid = (pid_t *)recipe_selected->state;
+    // main cook gets separate handler with the write permissions to the shared resource
+    struct sigaction sa, old_sa; // structure for signal handling (old_sa keeps the caller's handler to restore)
+    sigemptyset(&sa.sa_mask); // initializes the signal mask set in the sa structure to be empty so no signals are blocked while the handler executes
+    sa.sa_flags = SA_RESTART; // ensures that interuppted system calls will automatically restart instead of failing with error
+    sa.sa_handler = sigchld_handler; // assigns sigchld_handler as the handler for sigchld signal, called when a child process exits for main cook
+    sigaction(SIGCHLD, &sa, &old_sa); // registers the sigchld_handler to handle the sigchld signals
 
-                            if (*child_pid != pid) { // Don't send the signal to the failed process
-                                if (kill(*child_pid, SIGKILL) == -1) {
-                                    fprintf(stderr, "Failed to terminate child process\n");
-                                }
-                            }
-                        }
-                        recipe_selected = recipe_selected->next; // Move to the next recipe in the cookbook
-                    }
+    sigset_t block_mask, orig_mask, caller_mask;
+    sigemptyset(&block_mask); // initializes the block mask to an empty set of signals (so can check multiple signals)
+    sigaddset(&block_mask, SIGCHLD); // adds sigchld to block_mask allowing it to be blocked or unblocked as needed below
 
-                    // free all the resources and then exit failure
-                    // FREE WORK QUEUE STRUCTURE (this is good!)
-                    free(work_queue);
+    // Strategy: Have signals masked all the time except for when suspending
 
-                    // FREE LIST STRUCTURE (this is good!)
-                    free(completed_recipes); // just a list of pointers
+    // signals are masked all time in main program (except for in suspend - avoid spinning) - deals with races when signals terminating when suspending
+    sigprocmask(SIG_BLOCK, &block_mask, &caller_mask); // blocks sigchld by setting the signal mask to block mask (caller mask stores the previous mask)
+    orig_mask = caller_mask;
+    sigdelset(&orig_mask, SIGCHLD); // the waits below must always be woken up by a finished cook, even if the caller blocks SIGCHLD
+
+    stamp_sigchld = 0; // the handler only reads the clock for a context timing its latencies
+    for (int i = 0; i < count; i++) stamp_sigchld |= ctxs[i]->latency.enabled;
+    sigchld_at_ns = 0;
+
+    // -c auto: the limit on active cooks follows the system instead of staying at max_cooks
+    ADAPTIVE_LIMIT *adaptive = ctxs[0]->auto_min_cooks > 0 ? &ctxs[0]->adaptive : NULL;
+    if (adaptive != NULL) {
+        int min_cooks = ctxs[0]->auto_min_cooks < max_cooks ? ctxs[0]->auto_min_cooks : max_cooks;
+        start_adaptive_limit(adaptive, min_cooks, max_cooks, monotonic_ms());
+    }
 
-                    // FREE STACK STRUCTURE (should already be free - i think it is malloc in push and freed in push? and also locally defined in stack)
+    while (1) {
 
-                    // FREE COOKBOOK TREE STRUCTURE
-                    free_cookbook(cookbook_parsed);
+        // cook units: one per active cook, unless the cookbook has resource annotations
+        // (a recipe waiting for its retry counts as queued, the loop wakes up when it is due)
+        int active_units = 0, active_cooks = 0, queued = 0;
+        long retry_wait_ms = -1;
+        for (int i = 0; i < count; i++) {
+            long wait_ms = release_due_retries(ctxs[i]);
+            if (wait_ms >= 0 && (retry_wait_ms < 0 || wait_ms < retry_wait_ms)) retry_wait_ms = wait_ms;
+            active_units += ctxs[i]->active_units;
+            active_cooks += ctxs[i]->active_cooks;
+            if (!is_work_queue_empty(ctxs[i]->work_queue) || ctxs[i]->retrying_count > 0) queued = 1;
+        }
 
-                    exit(EXIT_FAILURE); // program ends with graceful cleaning up of system resources
-                }
+        // the slots stay like this until the next pass: a free one counts as idle while work was ready for
+        // every context with a recipe in its work queue (a recipe waiting for its retry is not ready)
+        long slots_ms = monotonic_ms();
+        for (int i = 0; i < count; i++) {
+            account_slots(&ctxs[i]->usage, max_cooks - active_cooks, !is_work_queue_empty(ctxs[i]->work_queue), slots_ms);
+            show_run_status(ctxs[i], slots_ms);
+        }
 
+        if (!queued && active_units == 0) {
+            break; // ending case to end the main processing loop: when there is nothing left to complete in work queue and no active cooks
+        }
+
+        int limit = adaptive != NULL ? poll_adaptive_limit(adaptive, active_units) : max_cooks;
+        RECIPE *recipe = NULL;
+        COOK_CONTEXT *ctx = pick_next_context(ctxs, count, active_units, limit, &recipe);
+
+        // memory floor: the recipe waits (and the loop looks at the memory again) while the machine is short of it
+        int held_for_memory = ctx != NULL && held_by_mem_floor(ctxs[0], ctx, recipe, active_units);
+        if (held_for_memory) ctx = NULL;
+
+        if (ctx != NULL && acquire_cook(ctx)) { // the work queue has recipes that need to be execute and there are cooks available
+
+            recipe = dequeue_recipe(ctx->work_queue, recipe);
+
+            if (recipe == NULL) {
+                // This shouldn't happen because there should be something in the work queue
+                abort();
             }
 
-            update_work_queue(work_queue, completed_recipes, completed_count, main_recipe); // ensures that all child processes are accounted for
+            if (start_cook(ctx, recipe, &caller_mask, 0) == -1) { // invalid return for process id - the recipe can not be cooked
+                fprintf(stderr, "ERRROR: Fork failed\n");
+                if (ctx->budget != NULL) release_token(ctx->budget);
+                ctx->failed = 1;
+                abandon_run(ctx);
+            }
 
-            sigchld_flag--;
+        } else { // at max capacity of active cooks (equal to max cooks) waits for cook to finish
+            // the adaptive limit and the jobserver count of borrowed tokens want to be woken up now and then
+            long timeout_ms = adaptive != NULL ? adaptive_wait_ms(adaptive) : -1;
+            TOKEN_BUDGET *budget = ctxs[0]->budget;
+            if (budget != NULL && budget->jobserver != JOBSERVER_NONE && budget->capacity > 0 &&
+                (timeout_ms < 0 || timeout_ms > JOBSERVER_SAMPLE_MS)) timeout_ms = JOBSERVER_SAMPLE_MS;
+
+            // so do the waiting retries, the timeouts of the running cooks and the stragglers that could get a speculative copy
+            if (retry_wait_ms >= 0 && (timeout_ms < 0 || retry_wait_ms < timeout_ms)) timeout_ms = retry_wait_ms;
+            if (held_for_memory && (timeout_ms < 0 || timeout_ms > MEM_FLOOR_SAMPLE_MS)) timeout_ms = MEM_FLOOR_SAMPLE_MS;
+            long now_ms = monotonic_ms();
+            int backup_started = 0;
+            for (int i = 0; i < count; i++) {
+                long wait_ms = enforce_timeouts(ctxs[i], now_ms);
+                if (ctx == NULL && !held_for_memory && !backup_started && start_backup(ctxs[i], active_units, limit, now_ms, &wait_ms, &caller_mask)) {
+                    backup_started = 1;
+                }
+                if (wait_ms >= 0 && (timeout_ms < 0 || wait_ms < timeout_ms)) timeout_ms = wait_ms;
+            }
+            if (backup_started) continue; // the limit has to be looked at again before anything else is started
+
+            // waits for any unblocked signals to arrive allowing the handler to execute (or for a token of the shared budget)
+            wait_for_cook_event(ctx != NULL ? ctx->budget : NULL, &orig_mask, ctx != NULL, timeout_ms);
+
+            if (budget != NULL) note_borrowed_tokens(budget);
+
+            for (int i = 0; i < count; i++) {
+                if (reap_cooks(ctxs[i], ctxs[i]->failed) != 0 && (!ctxs[i]->keep_going || ctxs[i]->failed)) {
+                    // send signal to all child processes cooks of this context and stop starting new ones, then wait for them to be reaped
+                    if (count > 1) fprintf(stderr, "ERROR: Cookbook '%s' failed, its other recipes are abandoned\n", ctxs[i]->cookbook_path);
+                    ctxs[i]->failed = 1;
+                    abandon_run(ctxs[i]);
+                }
+            }
+
+            sigchld_flag = 0;
+            sigchld_at_ns = 0;
         }
     }
 
 
     // wrapped while loops with masking and unmasking signals
-    sigprocmask(SIG_SETMASK, &orig_mask, NULL); // unblocks sigchld signals so parent process can handle them
+    sigprocmask(SIG_SETMASK, &caller_mask, NULL); // unblocks sigchld signals so parent process can handle them
+    sigaction(SIGCHLD, &old_sa, NULL); // and gives SIGCHLD back to the caller's handler
+
+    int failed = 0;
+    for (int c = 0; c < count; c++) {
+        COOK_CONTEXT *ctx = ctxs[c];
+        for (int i = 0; !ctx->failed && ctx->failed_count == 0 && i < ctx->analysis.target_count; i++) {
+            RECIPE *target = ctx->analysis.targets[i];
+            if (!is_completed(target)) {
+                fprintf(stderr, "ERROR: Work queue ran dry before the main recipe '%s' was completed\n", target->name);
+                ctx->failed = 1;
+            }
+        }
+        if (ctx->failed_count > 0) ctx->failed = 1; // keep going mode still fails the run
+        if (ctx->failed) failed = 1;
+    }
 
 /*
     fprintf(stderr, "******************************************\n");
-    fprintf(stderr, "Completed count: %d\n", completed_count);
+    fprintf(stderr, "Completed count: %d\n", ctxs[0]->completed_count);
     fprintf(stderr, "Completed recipes: \n");
-    for (int i = 0; i < completed_count; i++) {
-        RECIPE *recipe = completed_recipes[i];
+    for (int i = 0; i < ctxs[0]->completed_count; i++) {
+        RECIPE *recipe = ctxs[0]->completed_recipes[i];
         fprintf(stderr, "Recipe %d: Name = %s\n", i, recipe->name);
     }
     fprintf(stderr, "******************************************\n");
 */
-}
\ No newline at end of file
+    return failed ? -1 : 0;
+}
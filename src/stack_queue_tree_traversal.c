@@ -7,27 +7,100 @@
 #include <string.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "cookbook.h"
 #include "stack_queue_tree_traversal.h"
+#include "token_budget.h"
+#include "resources.h"
+#include "latency_histogram.h"
 
 // Recursive helper function to initialize the state of each recipe and its dependencies.
-void initialize_recipe_states(RECIPE *recipe) {
+// Returns 0, or -1 if a state could not be allocated (the states allocated before it are kept)
+int initialize_recipe_states(RECIPE *recipe) {
     while (recipe != NULL) {
     	// fprintf(stderr, "%s\n", recipe->name);
-        recipe->state = NULL;
+        if (recipe->state == NULL) {
+            recipe->state = malloc(sizeof(RECIPE_STATE));
+            if (recipe->state == NULL) {
+                fprintf(stderr, "ERROR: Failed to allocate memory for the recipe state\n");
+                return -1;
+            }
+        }
+        memset(recipe->state, 0, sizeof(RECIPE_STATE));
         recipe = recipe->next;
     }
+    return 0;
 }
 
 // Function to initialize all states in the cookbook.
-void initialize_cookbook_states(COOKBOOK *cookbook) {
-    if (cookbook == NULL) return;
+int initialize_cookbook_states(COOKBOOK *cookbook) {
+    if (cookbook == NULL) return 0;
 
     cookbook->state = NULL;
 
     // Initialize all recipes in the cookbook.
-    initialize_recipe_states(cookbook->recipes);
+    return initialize_recipe_states(cookbook->recipes);
+}
+
+/*
+	Function to split a -f argument into its job: cookbook[:recipe,recipe...][@weight]
+	The argument string is cut up in place, recipe_names must have room for every recipe in it
+
+	return 0 if the job is valid and -1 otherwise
+*/
+static int parse_job(COOK_JOB_OPTIONS *job, char *arg) {
+	job->cookbook = arg;
+	job->weight = 1;
+
+	char *weight = strrchr(arg, '@');
+	if (weight != NULL) {
+		*weight++ = '\0';
+		char *end;
+		long value = strtol(weight, &end, 10);
+		if (*weight == '\0' || *end != '\0' || value <= 0 || value > 1000) {
+			fprintf(stderr, "ERROR: Invalid weight '%s' for cookbook '%s' (expected 1 to 1000). \n", weight, arg);
+			return -1;
+		}
+		job->weight = (int)value;
+	}
+
+	char *recipes = strrchr(arg, ':');
+	if (recipes != NULL) {
+		*recipes++ = '\0';
+		char *name = strtok(recipes, ",");
+		while (name != NULL) {
+			job->recipe_names[job->recipe_count++] = name;
+			name = strtok(NULL, ",");
+		}
+	}
+
+	if (*job->cookbook == '\0') {
+		fprintf(stderr, "ERROR: -f flag was passed but the cookbook name was not given. \n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	Function to parse -c auto[:min:max], without bounds the limit goes from 1 to the number of online cpus
+
+	return 0 if the bounds are valid and -1 otherwise
+*/
+static int parse_auto_cooks(COOK_OPTIONS *options, const char *arg) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	options->auto_cooks = 1;
+	options->min_cooks = 1;
+	options->max_cooks = cpus > 0 ? (int)cpus : 1;
+
+	if (strcmp(arg, "auto") == 0) return 0;
+	if (sscanf(arg, "auto:%d:%d", &options->min_cooks, &options->max_cooks) != 2 ||
+		options->min_cooks <= 0 || options->max_cooks < options->min_cooks) {
+		fprintf(stderr, "ERROR: Invalid -c %s (expected auto or auto:min:max with 0 < min <= max). \n", arg);
+		return -1;
+	}
+	return 0;
 }
 
 /*
@@ -35,49 +108,286 @@ void initialize_cookbook_states(COOKBOOK *cookbook) {
 	From the README.md assignment description, all of the parseable flags are optional
 	If argument is missing then default values are used as defined
 
-	char *cookbook = "/cookbook.ckb";
-    char *recipe_name = "";
-
-    return the number of max cooks
+	cook [-f cookbook] [-c max_cooks] [main_recipe_name ...]   several main recipes are cooked in one run
+	cook [-k] ...                                        keep going: cook everything a failed recipe is not needed for
+	cook -c auto[:min:max] ...                           the cook limit follows the cpus, load and memory of the system
+	cook -J pipe|fifo ...                                be a GNU make jobserver for the steps (MAKEFLAGS)
+	cook --policy name ...                               order of the ready recipes: fifo, critical-path,
+	                                                     critical-path-time, most-dependents or sjf
+	cook --history file [--eta] ...                      keep the recipe and task durations in file between runs
+	                                                     (default $COOK_HISTORY), --eta prints the time left
+	cook --timeout duration [--speculate] ...            kill cooks running longer (with their steps), and give
+	                                                     idempotent stragglers a backup cook (needs the history)
+	cook --retries n [--retry-backoff duration] ...      cook a failed recipe again up to n times, waiting the
+	                                                     backoff (1s) and twice as long before every next retry
+	cook --trace[=]file.json ...                         write the recipes, tasks and steps of the run as Chrome
+	                                                     trace events (Perfetto, chrome://tracing)
+	cook --mem-floor size ...                            start no new cook while less memory (like 2G) is
+	                                                     available, unless none is running
+	cook --critical-boost ...                            raise the nice value and I/O priority of the cooks on
+	                                                     the critical path (automatic with #@ recipe: class=...)
+	cook --placement socket|numa|llc ...                 pin every cook and its steps to the cpus of one socket,
+	                                                     NUMA node or L3 cache, next to the cooks of its sub-recipes
+	cook --usage [--usage-json file.json] ...            print (and write as JSON) the cpu time, max RSS, context
+	                                                     switches and block I/O of every recipe, task and step,
+	                                                     and how busy the cook slots were
+	cook --perf ...                                      the same with the cycles, instructions, cache and branch
+	                                                     misses of every recipe (software counters without a PMU)
+	cook --timings[=file.json] ...                       print (or write as JSON) how long parsing, analysis and the
+	                                                     run took, the main cook's cpu per recipe and its peak RSS
+	cook --latency ...                                   print p50/p99/max of the scheduler latencies (SIGCHLD to
+	                                                     reap, reap to queue updated, recipe ready to fork)
+	cook --status[=file] ...                             keep a live status page in /dev/shm/cook.<pid> (or file)
+	                                                     for cook-top, job N > 0 of a pool gets file.N
+	cook -f cookbook[:recipe,...][@weight] -f ... [-c max_cooks]
+	                                                     several cookbooks (jobs) cooked on one pool of max_cooks cooks,
+	                                                     shared by weight, a failed recipe only stops its own job
+	cook -D socket [-f cookbook] [-c max_cooks]          run as a daemon serving cook requests
+	cook -S socket [-c max_cooks] [main_recipe_name]     send a cook request to a running daemon
+
+	options->jobs = one job per -f (malloc'd, free with free_options), "cookbook.ckb" if there was none
+	options->jobs[0].recipe_names also gets every main_recipe_name given, which needs a single job
+
+	return 0 if the arguments are valid and -1 otherwise
 */
-int validargs(char **cookbook, char **recipe_name, int argc, char **argv) {
-	int max_cooks = 1;
-	int recipe_name_parsed = 0;
+int validargs(COOK_OPTIONS *options, int argc, char **argv) {
+	options->max_cooks = 1;
+	options->job_count = 0;
+	options->jobs = calloc(argc + 1, sizeof(COOK_JOB_OPTIONS)); // never more jobs than arguments, ends with an empty job
+	if (options->jobs == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate memory for the cookbook jobs. \n");
+		return -1;
+	}
+	for (int i = 0; i < argc; i++) {
+		options->jobs[i].recipe_names = calloc(argc, sizeof(char *));
+		if (options->jobs[i].recipe_names == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate memory for the recipe names. \n");
+			return -1;
+		}
+	}
+
+	char **recipe_names = calloc(argc, sizeof(char *));
+	int recipe_count = 0;
+	if (recipe_names == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate memory for the recipe names. \n");
+		return -1;
+	}
 
 	for (int i = 1; i < argc; i++) { // argument 0 is the name of the executable
 		if (strcmp(argv[i], "-f") == 0) {
 			if (i + 1 < argc) {
-				*cookbook = argv[i + 1];
+				if (parse_job(&options->jobs[options->job_count++], argv[i + 1]) != 0) {
+					free(recipe_names);
+					return -1;
+				}
 				i++;
 			} else {
 				fprintf(stderr, "ERROR: -f flag was passed but the cookbook name was not given. \n");
+				free(recipe_names);
 				return -1;
 			}
 		} else if (strcmp(argv[i], "-c") == 0) {
-			if (i + 1 < argc) {
-				max_cooks = atoi(argv[i + 1]);
+			options->cooks_given = 1;
+			if (i + 1 < argc && strncmp(argv[i + 1], "auto", 4) == 0) {
+				if (parse_auto_cooks(options, argv[i + 1]) != 0) {
+					free(recipe_names);
+					return -1;
+				}
+				i++;
+			} else if (i + 1 < argc) {
+				options->max_cooks = atoi(argv[i + 1]);
+				options->auto_cooks = 0;
 				i++;
 			} else {
 				fprintf(stderr, "ERROR: -c flag was passed but max_cooks number was not given. \n");
+				free(recipe_names);
 				return -1; // the -f flag was passed but the cookbook name was not given
 			}
-		} else {
-			if (recipe_name_parsed) {
-				fprintf(stderr, "ERROR: There was already a recipe name provided. \n");
+		} else if (strcmp(argv[i], "-J") == 0) {
+			if (i + 1 < argc && (strcmp(argv[i + 1], "pipe") == 0 || strcmp(argv[i + 1], "fifo") == 0)) {
+				options->jobserver = strcmp(argv[i + 1], "fifo") == 0 ? JOBSERVER_FIFO : JOBSERVER_PIPE;
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: -J flag was passed but not followed by pipe or fifo. \n");
+				free(recipe_names);
 				return -1;
 			}
-			*recipe_name = argv[i];
-			recipe_name_parsed = 1;
+		} else if (strcmp(argv[i], "--policy") == 0) {
+			if (i + 1 < argc) {
+				options->policy = argv[i + 1]; // the name is checked against the policies by cook_set_policy()
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --policy flag was passed but the policy name was not given. \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--placement") == 0) {
+			if (i + 1 < argc) {
+				options->placement = argv[i + 1]; // checked by cook_set_placement()
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --placement flag was passed but not followed by socket, numa or llc. \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--history") == 0) {
+			if (i + 1 < argc) {
+				options->history = argv[i + 1];
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --history flag was passed but the history file was not given. \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--timeout") == 0) {
+			if (i + 1 < argc && (options->timeout_ms = parse_duration_ms(argv[i + 1])) > 0) {
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --timeout flag was passed without a duration (like 90, 30s, 10m or 2h). \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--retries") == 0) {
+			if (i + 1 < argc && (options->retries = atoi(argv[i + 1])) > 0) {
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --retries flag was passed without a number of retries (1 or more). \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--retry-backoff") == 0) {
+			if (i + 1 < argc && (options->retry_backoff_ms = parse_duration_ms(argv[i + 1])) > 0) {
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --retry-backoff flag was passed without a duration (like 500ms or 2s). \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--speculate") == 0) {
+			options->speculate = 1;
+		} else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0') {
+			options->trace = argv[i] + 8;
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			if (i + 1 < argc) {
+				options->trace = argv[i + 1];
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --trace flag was passed but the trace file was not given. \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--usage") == 0) {
+			options->usage = 1;
+		} else if (strcmp(argv[i], "--timings") == 0) {
+			options->timings = "";
+		} else if (strncmp(argv[i], "--timings=", 10) == 0 && argv[i][10] != '\0') {
+			options->timings = argv[i] + 10;
+		} else if (strcmp(argv[i], "--latency") == 0) {
+			options->latency = 1;
+		} else if (strcmp(argv[i], "--perf") == 0) {
+			options->perf = 1;
+		} else if (strcmp(argv[i], "--status") == 0) {
+			options->status = "";
+		} else if (strncmp(argv[i], "--status=", 9) == 0 && argv[i][9] != '\0') {
+			options->status = argv[i] + 9;
+		} else if (strcmp(argv[i], "--usage-json") == 0) {
+			if (i + 1 < argc) {
+				options->usage_json = argv[i + 1];
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --usage-json flag was passed but the JSON file was not given. \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--mem-floor") == 0) {
+			if (i + 1 < argc && (options->mem_floor_kb = parse_mem_kb(argv[i + 1])) > 0) {
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: --mem-floor flag was passed without a memory size (like 512M or 2G). \n");
+				free(recipe_names);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--critical-boost") == 0) {
+			options->critical_boost = 1;
+		} else if (strcmp(argv[i], "--eta") == 0) {
+			options->show_eta = 1;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			options->keep_going = 1;
+		} else if (strcmp(argv[i], "-D") == 0 || strcmp(argv[i], "-S") == 0) {
+			if (i + 1 < argc) {
+				if (argv[i][1] == 'D') options->daemon_socket = argv[i + 1];
+				else options->request_socket = argv[i + 1];
+				i++;
+			} else {
+				fprintf(stderr, "ERROR: %s flag was passed but the socket path was not given. \n", argv[i]);
+				free(recipe_names);
+				return -1;
+			}
+		} else {
+			recipe_names[recipe_count++] = argv[i];
 		}
 	}
 
+	if (options->job_count == 0) {
+		options->jobs[0].cookbook = "cookbook.ckb";
+		options->jobs[0].weight = 1;
+		options->job_count = 1;
+	}
+
+	// the plain main_recipe_name arguments belong to the one cookbook given
+	if (recipe_count > 0 && options->job_count > 1) {
+		fprintf(stderr, "ERROR: With several cookbooks the recipes are given as -f cookbook:recipe. \n");
+		free(recipe_names);
+		return -1;
+	}
+	COOK_JOB_OPTIONS *first = &options->jobs[0];
+	for (int i = 0; i < recipe_count; i++) {
+		first->recipe_names[first->recipe_count++] = recipe_names[i];
+	}
+	free(recipe_names);
 
-	if (max_cooks <= 0) {
+	if (options->max_cooks <= 0) {
 		fprintf(stderr, "ERROR: Invalid number of cooks specified. \n");
 		return -1;
 	}
 
-	return max_cooks;
+	if ((options->auto_cooks || options->jobserver) && (options->daemon_socket != NULL || options->request_socket != NULL)) {
+		fprintf(stderr, "ERROR: -c auto and -J cannot be combined with -D or -S. \n");
+		return -1;
+	}
+
+	if (options->daemon_socket != NULL && (options->request_socket != NULL || first->recipe_count > 0 || options->job_count > 1)) {
+		fprintf(stderr, "ERROR: -D runs a daemon and cannot be combined with -S, a recipe name or several cookbooks. \n");
+		return -1;
+	}
+
+	if (options->history == NULL) options->history = getenv("COOK_HISTORY");
+	if (options->history != NULL && *options->history == '\0') options->history = NULL;
+
+	if (options->request_socket != NULL && (options->policy != NULL || options->show_eta || options->trace != NULL ||
+		options->mem_floor_kb || options->critical_boost || options->placement != NULL || options->usage ||
+		options->usage_json != NULL || options->perf || options->status != NULL || options->latency ||
+		options->timings != NULL)) {
+		fprintf(stderr, "ERROR: --policy, --eta, --trace, --mem-floor, --critical-boost, --placement, --usage, --perf, --status, --latency and --timings are settings of the daemon (-D), not of a cook request. \n");
+		return -1;
+	}
+
+	if (options->request_socket != NULL && (first->recipe_count > 1 || options->job_count > 1)) {
+		fprintf(stderr, "ERROR: A cook request to a daemon takes one recipe name. \n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// Function to free what validargs allocated (the strings themselves belong to argv)
+void free_options(COOK_OPTIONS *options) {
+	if (options->jobs == NULL) return;
+	for (int i = 0; options->jobs[i].recipe_names != NULL; i++) {
+		free(options->jobs[i].recipe_names);
+	}
+	free(options->jobs);
+	options->jobs = NULL;
 }
 
 /*
@@ -132,10 +442,16 @@ int is_stack_empty(STACK *stack) {
 	return stack->top == NULL;
 }
 void mark_visited(RECIPE *recipe) {
-	recipe->state = (void *)1;
+	RECIPE_STATE_OF(recipe)->visited = 1;
 }
 int is_visited(RECIPE *recipe) {
-	return recipe->state != NULL;
+	return RECIPE_STATE_OF(recipe)->visited;
+}
+int is_required(RECIPE *recipe) {
+	return RECIPE_STATE_OF(recipe)->required;
+}
+int is_completed(RECIPE *recipe) {
+	return RECIPE_STATE_OF(recipe)->completed;
 }
 
 /*
@@ -152,10 +468,23 @@ int is_visited(RECIPE *recipe) {
 	recipes meet the outlined criteria (1) required by main recipe (2) reach for task processing since no pending dependencies (3) not yet processed
 */
 int stack_analysis_traversal(RECIPE *recipe_selected, WORK_QUEUE *work_queue) {
+	return stack_analysis_traversal_targets(&recipe_selected, 1, work_queue, NULL);
+}
+
+/*
+	Same traversal for several main recipes ("targets") at once: the result is the union of their trees,
+	so a sub-recipe shared by several targets is counted and queued only once
+	If required is not NULL every recipe in the union is also stored there (it needs room for all of them)
+
+	Returns the number of recipes in the union, -1 if the work queue could not grow
+*/
+int stack_analysis_traversal_targets(RECIPE **targets, int target_count, WORK_QUEUE *work_queue, RECIPE **required) {
 	STACK stack = { NULL }; // initialize the stack for recursive tree traversal
 
-	push(&stack, recipe_selected);
-	int recipe_count = 1;
+	for (int i = target_count - 1; i >= 0; i--) {
+		push(&stack, targets[i]);
+	}
+	int recipe_count = 0;
 
 	while (!is_stack_empty(&stack)) {
 		RECIPE *current = pop(&stack);
@@ -163,9 +492,15 @@ int stack_analysis_traversal(RECIPE *recipe_selected, WORK_QUEUE *work_queue) {
 		if (is_visited(current)) continue;
 		mark_visited(current);
 
+		// counted when visited: a recipe can be pushed again before its first copy is popped
+		if (required != NULL) required[recipe_count] = current;
+		recipe_count++;
+
 		// check if the current recipe is a leaf node, there are no dependencies
-		if (current->this_depends_on == NULL) {
-			enqueue(work_queue, current);
+		if (current->this_depends_on == NULL && enqueue(work_queue, current) != 0) {
+			while (!is_stack_empty(&stack)) pop(&stack);
+			recipe_count = -1;
+			break;
 		}
 
 		// traverse dependencies
@@ -173,14 +508,15 @@ int stack_analysis_traversal(RECIPE *recipe_selected, WORK_QUEUE *work_queue) {
 		while (dep != NULL) {
 			if (!is_visited(dep->recipe)) {
 				push(&stack, dep->recipe);
-				recipe_count++;
 			}
 			dep = dep->next;
 		}
 	}
 
 	// after traversal reset visited status in all nodes of the tree
-	initialize_recipe_states(recipe_selected);
+	for (int i = 0; i < target_count; i++) {
+		initialize_recipe_states(targets[i]);
+	}
 
 	// Just checking the contents of the stack
     // print_stack(&stack);
@@ -222,7 +558,9 @@ int detect_cycle_dfs(RECIPE *recipe, STACK *stack) {
     		fprintf(stderr, "ERROR: Missing recipe dependency in recipe\n");
     		return -1;
     	}
-        detect_cycle_dfs(dep->recipe, stack);
+        if (detect_cycle_dfs(dep->recipe, stack) != 0) {
+            return -1; // propagate the cycle found further down the tree
+        }
         dep = dep->next;
     }
 
@@ -236,6 +574,9 @@ int detect_cycle_dfs(RECIPE *recipe, STACK *stack) {
 int check_circular_tree_cycle(RECIPE *recipe_root) {
     STACK visiting_stack = { NULL }; // Initialize an empty stack
     int ret = detect_cycle_dfs(recipe_root, &visiting_stack);
+    while (!is_stack_empty(&visiting_stack)) {
+        pop(&visiting_stack); // a cycle stops the search with recipes still on the visiting stack
+    }
     initialize_recipe_states(recipe_root);
     return ret;
 }
@@ -253,30 +594,6 @@ int is_in_completed_recipes(RECIPE *recipe, RECIPE **completed_recipes, int comp
     return 0;
 }
 
-int is_reaches_main(RECIPE *recipe_completed, RECIPE *main_recipe) {
-    // Base case: if recipe_completed is NULL, return false
-    if (recipe_completed == NULL) {
-        return 0;
-    }
-
-    if (recipe_completed == main_recipe) return 1;
-
-    // Traverse the 'depend_on_this' list
-    RECIPE_LINK *current = recipe_completed->depend_on_this;
-    while (current != NULL) {
-        // Check if the current recipe matches main_recipe
-        if (current->recipe == main_recipe ||
-            is_reaches_main(current->recipe, main_recipe)) {
-            return 1;
-        }
-        current = current->next; // Move to the next dependency
-    }
-
-    // fprintf(stderr, "no match found return false\n");
-    // If no match is found, return false
-    return 0;
-}
-
 /*
 	Function that updates the work queue
 	It inputs a list of completed recipes []
@@ -284,8 +601,13 @@ int is_reaches_main(RECIPE *recipe_completed, RECIPE *main_recipe) {
 	It looks at depend_on_this  attribute to see which subrecipes can be completed now that the passed in subrecipe has completed
 	It then adds the subrecipes that can be completed now to the work queue
 	The work queue should have now updated sub recipes that can be completed because of the completed recipes
+
+	Only recipes marked required by the analysis are queued, and the completed mark in the recipe state
+	stands in for a search of the completed list, so each update only costs the edges it looks at
+
+	Returns 0, or -1 if the work queue could not grow (the recipes that did not fit are not queued)
 */
-void update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int completed_count, RECIPE *main_recipe) {
+int update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int completed_count) {
 /*
 	fprintf(stderr, "UPDATING THE WORK QUEUE AFTER COMPLETETION (%d) \n", completed_count);
 	print_queue(work_queue);
@@ -305,6 +627,7 @@ void update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int c
 
     // below should only look at most recently finished recipe
     RECIPE *completed_recipe = completed_recipes[completed_count-1];
+    RECIPE_STATE_OF(completed_recipe)->completed = 1;
     dequeue_recipe(work_queue, completed_recipe);
 
     // if (completed_recipe == main_recipe) return;
@@ -314,8 +637,7 @@ void update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int c
     while (dependent != NULL) {
     	// fprintf(stderr, "MEEP\n");
         // push each dependent recipe onto the stack to expand and explore further
-        if (!is_in_completed_recipes(dependent->recipe, completed_recipes, completed_count) &&
-        	is_reaches_main(dependent->recipe, main_recipe)) {
+        if (!is_completed(dependent->recipe) && is_required(dependent->recipe)) {
         	// fprintf(stderr, "RETURNS HERE\n");
         	push(&stack, dependent->recipe);
         }
@@ -350,7 +672,7 @@ void update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int c
 
         while (dep != NULL) {
         	// fprintf(stderr, "merp\n");
-            if (!is_in_completed_recipes(dep->recipe, completed_recipes, completed_count)) {
+            if (!is_completed(dep->recipe)) {
             	// fprintf(stderr, "whelp\n");
                 can_be_completed = 0;
                 break;
@@ -361,7 +683,10 @@ void update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int c
 
         if (can_be_completed) {
         	// fprintf(stderr, "hello hello hello\n");
-            enqueue(work_queue, recipe);
+            if (enqueue(work_queue, recipe) != 0) {
+                while (!is_stack_empty(&stack)) pop(&stack);
+                return -1;
+            }
 
             // Also, check if any recipes dependent on this one can now be completed
             RECIPE_LINK *next_dependent = recipe->depend_on_this;
@@ -385,91 +710,143 @@ void update_work_queue(WORK_QUEUE *work_queue, RECIPE **completed_recipes, int c
     print_queue(work_queue);
     fprintf(stderr, "******************************************\n");
 */
+    return 0;
 }
 
 /*
-	Functions to use the work queue
+	Functions to use the work queue (binary heap, see stack_queue_tree_traversal.h)
+	Every entry keeps queue_index in the state of its recipe up to date so dequeue_recipe does not have to search
+	init_work_queue returns NULL and enqueue -1 when there is no memory for the queue, the caller gives up its run
 */
 WORK_QUEUE *init_work_queue() {
-	WORK_QUEUE *queue = malloc(sizeof(WORK_QUEUE));
-	queue->front = NULL;
-	queue->back = NULL;
+	WORK_QUEUE *queue = calloc(1, sizeof(WORK_QUEUE));
+	if (queue == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate memory for the work queue\n");
+	}
 	return queue;
 }
-void enqueue(WORK_QUEUE *queue, RECIPE *recipe) {
-	QUEUE_NODE *new_node = malloc(sizeof(QUEUE_NODE));
-	new_node->recipe = recipe;
-	new_node->next = NULL;
+void free_work_queue(WORK_QUEUE *queue) {
+	if (queue == NULL) return;
+	free(queue->entries);
+	free(queue);
+}
 
-	if (queue->back == NULL) {
-		queue->front = new_node;
-		queue->back = new_node;
-	} else {
-		queue->back->next = new_node;
-		queue->back = new_node;
+// entry a comes out before entry b: higher priority, then queued earlier
+static int comes_before(QUEUE_ENTRY *a, QUEUE_ENTRY *b) {
+	if (a->priority != b->priority) return a->priority > b->priority;
+	return a->order < b->order;
+}
+static void place_entry(WORK_QUEUE *queue, int i, QUEUE_ENTRY entry) {
+	queue->entries[i] = entry;
+	if (entry.recipe->state != NULL) RECIPE_STATE_OF(entry.recipe)->queue_index = i + 1;
+}
+static void sift_up(WORK_QUEUE *queue, int i) {
+	QUEUE_ENTRY entry = queue->entries[i];
+	while (i > 0 && comes_before(&entry, &queue->entries[(i - 1) / 2])) {
+		place_entry(queue, i, queue->entries[(i - 1) / 2]);
+		i = (i - 1) / 2;
 	}
+	place_entry(queue, i, entry);
+}
+static void sift_down(WORK_QUEUE *queue, int i) {
+	QUEUE_ENTRY entry = queue->entries[i];
+	while (1) {
+		int child = 2 * i + 1;
+		if (child >= queue->size) break;
+		if (child + 1 < queue->size && comes_before(&queue->entries[child + 1], &queue->entries[child])) child++;
+		if (!comes_before(&queue->entries[child], &entry)) break;
+		place_entry(queue, i, queue->entries[child]);
+		i = child;
+	}
+	place_entry(queue, i, entry);
+}
+// takes entry i out of the heap and puts the last entry in its place
+static RECIPE *remove_entry(WORK_QUEUE *queue, int i) {
+	RECIPE *recipe = queue->entries[i].recipe;
+	if (recipe->state != NULL) RECIPE_STATE_OF(recipe)->queue_index = 0;
+
+	queue->size--;
+	if (i < queue->size) {
+		place_entry(queue, i, queue->entries[queue->size]);
+		if (i > 0 && comes_before(&queue->entries[i], &queue->entries[(i - 1) / 2])) sift_up(queue, i);
+		else sift_down(queue, i);
+	}
+	return recipe;
 }
-RECIPE *dequeue_recipe(WORK_QUEUE *queue, RECIPE *target_recipe) {
-	// fprintf(stderr, "REMOVING A SPECIFIC RECIPE FROM WORK QUEUE\n");
-	if (queue->front == NULL) return NULL;
-
-	QUEUE_NODE *current = queue->front;
-	QUEUE_NODE *previous = NULL;
-
-	while (current != NULL) {
-		if (current->recipe == target_recipe) {
-			// Found the target recipe to remove
-			if (previous == NULL) {
-				// fprintf(stderr, "meep\n");
-				// Removing the front of the queue
-				queue->front = current->next;
-			} else {
-				// fprintf(stderr, "merp\n");
-				// Removing a recipe in the middle or end
-				previous->next = current->next;
-			}
-
-			// If the target recipe is at the back, update the back pointer
-			if (current->next == NULL) {
-				queue->back = previous;
-			}
 
-			RECIPE *recipe = current->recipe;
-			free(current);
-			return recipe;
+int enqueue(WORK_QUEUE *queue, RECIPE *recipe) {
+	if (queue->size == queue->capacity) {
+		int capacity = queue->capacity > 0 ? 2 * queue->capacity : 16;
+		QUEUE_ENTRY *entries = realloc(queue->entries, capacity * sizeof(QUEUE_ENTRY));
+		if (entries == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate memory for the work queue\n");
+			return -1;
 		}
-
-		// Move to the next node
-		previous = current;
-		current = current->next;
+		queue->entries = entries;
+		queue->capacity = capacity;
 	}
 
-	// If we reach here, the recipe was not found in the queue
-	return NULL;
+	QUEUE_ENTRY entry = { recipe, 0, queue->next_order++ };
+	if (recipe->state != NULL) entry.priority = RECIPE_STATE_OF(recipe)->priority;
+	if (queue->stamp_ready && recipe->state != NULL) RECIPE_STATE_OF(recipe)->ready_ns = latency_now_ns();
+	queue->entries[queue->size++] = entry;
+	sift_up(queue, queue->size - 1);
+	return 0;
 }
-RECIPE *dequeue(WORK_QUEUE *queue) {
-	if (queue->front == NULL) return NULL;
-	QUEUE_NODE *node = queue->front;
-	RECIPE *recipe = node->recipe;
-	queue->front = node->next;
+RECIPE *dequeue_recipe(WORK_QUEUE *queue, RECIPE *target_recipe) {
+	// fprintf(stderr, "REMOVING A SPECIFIC RECIPE FROM WORK QUEUE\n");
+	if (queue->size == 0 || target_recipe->state == NULL) return NULL;
 
-	if (queue->front == NULL) {
-		queue->back = NULL;
+	int i = RECIPE_STATE_OF(target_recipe)->queue_index - 1;
+	if (i < 0 || i >= queue->size || queue->entries[i].recipe != target_recipe) {
+		return NULL; // not queued (a completed recipe was dequeued when its cook started)
 	}
+	return remove_entry(queue, i);
+}
+RECIPE *dequeue(WORK_QUEUE *queue) {
+	if (queue->size == 0) return NULL;
+	return remove_entry(queue, 0);
+}
+RECIPE *peek_work_queue(WORK_QUEUE *queue) {
+	return queue->size > 0 ? queue->entries[0].recipe : NULL;
+}
+int work_queue_size(WORK_QUEUE *queue) {
+	return queue->size;
+}
 
-	free(node);
+static int compare_entries(const void *a, const void *b) {
+	return comes_before((QUEUE_ENTRY *)a, (QUEUE_ENTRY *)b) ? -1 : 1;
+}
+/*
+	Function to list the queued recipes in the order they would be dequeued, without dequeuing them
+	recipes needs room for work_queue_size() recipes
 
-	return recipe;
+	Returns the number of recipes listed, -1 if there is no memory to sort them
+*/
+int sorted_work_queue(WORK_QUEUE *queue, RECIPE **recipes) {
+	if (queue->size == 0) return 0;
+	QUEUE_ENTRY *entries = malloc(queue->size * sizeof(QUEUE_ENTRY));
+	if (entries == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate memory for the work queue\n");
+		return -1;
+	}
+	memcpy(entries, queue->entries, queue->size * sizeof(QUEUE_ENTRY));
+	qsort(entries, queue->size, sizeof(QUEUE_ENTRY), compare_entries);
+	for (int i = 0; i < queue->size; i++) {
+		recipes[i] = entries[i].recipe;
+	}
+	free(entries);
+	return queue->size;
 }
 int is_work_queue_empty(WORK_QUEUE *queue) {
-	return queue->front == NULL;
+	return queue->size == 0;
 }
 int is_ready_for_work_queue(RECIPE *recipe) {
-	return (long)recipe->state == 0;
+	return RECIPE_STATE_OF(recipe)->dependency_count == 0;
 }
 
 /*
-	Set a recipe's initial dependency count, using state as counter
+	Set a recipe's initial dependency count, using the state's counter
 */
 void initialize_dependency_count(RECIPE *recipe) {
 	int count = 0;
@@ -478,7 +855,7 @@ void initialize_dependency_count(RECIPE *recipe) {
 		count++;
 		dep = dep->next;
 	}
-	recipe->state = (void *)(long)count;
+	RECIPE_STATE_OF(recipe)->dependency_count = count;
 }
 
 // Helper function print the stack
@@ -492,11 +869,9 @@ void print_stack(STACK *stack) {
 }
 // Helper function print the queue
 void print_queue(WORK_QUEUE *queue) {
-	QUEUE_NODE *current = queue->front;
 	fprintf(stderr, "PRINTING the CONTENTS of the WORK QUEUE!\n");
-	while (current != NULL) {
-		fprintf(stderr, "Recipe: %s\n", current->recipe->name);
-		current = current->next;
+	for (int i = 0; i < queue->size; i++) { // heap order, not dequeue order
+		fprintf(stderr, "Recipe: %s (priority %ld)\n", queue->entries[i].recipe->name, queue->entries[i].priority);
 	}
 }
 
@@ -0,0 +1,184 @@
+/*
+	This is the c file for the live status page of a run (see status_page.h)
+	The page is remapped by every run (the recipes and slots of a run decide its size) and removed when the
+	context is freed, so a cook-top looking at it sees the build end and then the page go away
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "status_page.h"
+
+#define READ_ATTEMPTS 1000          // copies tried while the main cook keeps writing
+
+void init_status_page(STATUS_PAGE *page) {
+	memset(page, 0, sizeof(STATUS_PAGE));
+}
+
+/*
+	Function to choose the file of the status page, /dev/shm/cook.<pid> for a NULL path
+
+	Returns 0 on success and -1 if the path could not be copied
+*/
+int set_status_path(STATUS_PAGE *page, const char *path) {
+	char default_path[64];
+	if (path == NULL) {
+		snprintf(default_path, sizeof(default_path), STATUS_DIR "cook.%d", (int)getpid());
+		path = default_path;
+	}
+	close_status_page(page);
+	if ((page->path = strdup(path)) == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate the status page path\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void unmap_status_page(STATUS_PAGE *page) {
+	if (page->map != NULL) munmap(page->map, page->size);
+	page->map = NULL;
+	page->header = NULL;
+	page->slots = NULL;
+	page->recipes = NULL;
+}
+
+/*
+	Function to (re)write the status page for a run with the given recipes (every recipe of the cookbook,
+	by position) and cook slots, as one update of the page
+	The file is created by the first run and only ever grows: a cook-top that mapped it before must not find
+	its end cut off
+
+	Returns 0 on success and -1 if the page can not be written (the run goes on without one)
+*/
+int map_status_page(STATUS_PAGE *page, const char *cookbook, char **names, int recipe_count, int slot_count) {
+	unmap_status_page(page);
+	if (page->path == NULL) return 0;
+
+	size_t needed = sizeof(STATUS_HEADER) + slot_count * sizeof(STATUS_SLOT) + recipe_count * sizeof(STATUS_RECIPE);
+	struct stat st;
+	int fd;
+	if (!page->owned) {
+		// the first run creates the page: a file (or link) already there is somebody else's and is never touched
+		fd = open(page->path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+		if (fd < 0 && errno == EEXIST) {
+			fprintf(stderr, "ERROR: The status page '%s' already exists, the run goes on without one\n", page->path);
+			return -1;
+		}
+		if (fd >= 0) page->owned = 1;
+	} else {
+		fd = open(page->path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+	}
+	page->size = fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size > needed ? (size_t)st.st_size : needed;
+	if (fd < 0 || ftruncate(fd, page->size) != 0) {
+		fprintf(stderr, "ERROR: Can't write the status page '%s': %s\n", page->path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, page->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Can't map the status page '%s': %s\n", page->path, strerror(errno));
+		return -1;
+	}
+
+	page->map = map;
+	page->header = map;
+	page->slots = (STATUS_SLOT *)(page->header + 1);
+	page->recipes = (STATUS_RECIPE *)(page->slots + slot_count);
+
+	STATUS_HEADER *header = page->header;
+	begin_status_update(page);
+	memset(page->slots, 0, page->size - sizeof(STATUS_HEADER));
+	header->version = STATUS_VERSION;
+	header->pid = getpid();
+	header->slot_count = slot_count;
+	header->recipe_count = recipe_count;
+	snprintf(header->cookbook, sizeof(header->cookbook), "%s", cookbook != NULL ? cookbook : "");
+	for (int i = 0; i < slot_count; i++) {
+		page->slots[i].recipe = page->slots[i].task = -1;
+	}
+	for (int i = 0; i < recipe_count; i++) {
+		snprintf(page->recipes[i].name, STATUS_NAME_MAX, "%s", names[i]);
+	}
+	header->magic = STATUS_MAGIC;
+	header->running = 0;
+	end_status_update(page);
+	return 0;
+}
+
+// Function to unmap the page and remove its file (only if this process created it)
+void close_status_page(STATUS_PAGE *page) {
+	unmap_status_page(page);
+	if (page->path != NULL && page->owned) unlink(page->path);
+	free(page->path);
+	init_status_page(page);
+}
+
+// Function to start writing the header, slots and recipes (a reader retries until end_status_update)
+void begin_status_update(STATUS_PAGE *page) {
+	if (page->map == NULL) return;
+	__atomic_add_fetch(&page->header->sequence, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void end_status_update(STATUS_PAGE *page) {
+	if (page->map == NULL) return;
+	__atomic_add_fetch(&page->header->sequence, 1, __ATOMIC_RELEASE);
+}
+
+// Function for a cook to show the task it is at and how many of its steps are done in its slot (one atomic store each)
+void set_status_step(STATUS_PAGE *page, int slot, int task, int step, int step_count) {
+	if (page == NULL || page->map == NULL || slot < 0 || slot >= page->header->slot_count) return;
+	__atomic_store_n(&page->slots[slot].step_count, step_count, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->slots[slot].step, step, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->slots[slot].task, task, __ATOMIC_RELAXED);
+}
+
+/*
+	Function to copy the status page at path, at a moment the main cook was not writing it
+	(the task and step of a slot may be a moment newer than the rest, the cooks write them on their own)
+
+	Returns the copy (malloc'd, size bytes) or NULL if there is no page there or it kept changing
+*/
+void *read_status_page(const char *path, size_t *size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(STATUS_HEADER)) {
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	void *map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+
+	STATUS_HEADER *header = map;
+	char *copy = malloc(*size);
+	int copied = 0;
+	for (int attempt = 0; copy != NULL && !copied && attempt < READ_ATTEMPTS; attempt++) {
+		uint32_t before = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+		if (before & 1) continue;
+		memcpy(copy, map, *size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		copied = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED) == before;
+	}
+	munmap(map, *size);
+
+	header = (STATUS_HEADER *)copy;
+	if (copied && (header->magic != STATUS_MAGIC || header->version != STATUS_VERSION || header->slot_count < 0 ||
+		header->recipe_count < 0 || *size < sizeof(STATUS_HEADER) + header->slot_count * sizeof(STATUS_SLOT) +
+		header->recipe_count * sizeof(STATUS_RECIPE))) {
+		copied = 0;
+	}
+	if (!copied) {
+		free(copy);
+		return NULL;
+	}
+	return copy;
+}
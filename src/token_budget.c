@@ -0,0 +1,316 @@
+/*
+	Token budget shared between the processes of a cook daemon
+	Every process that wants to start a cook first takes a token (one byte) out of the pipe
+	and writes it back once the cook has been reaped, so the total number of cooks running
+	across all of the processes sharing the pipe never exceeds the capacity
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#include "token_budget.h"
+
+#define TOKEN_BYTE '+'
+
+// sets the given flag on a file descriptor, returns -1 on failure
+static int add_fd_flags(int fd, int cmd_get, int cmd_set, int flag) {
+	int flags = fcntl(fd, cmd_get);
+	if (flags == -1) return -1;
+	return fcntl(fd, cmd_set, flags | flag);
+}
+
+/*
+	Function to create the token pipe and load it with capacity tokens
+	Both ends are close-on-exec so the steps of a recipe never see the budget
+
+	Returns 0 on success and -1 if the pipe could not be created or filled
+*/
+int init_token_budget(TOKEN_BUDGET *budget, int capacity) {
+	int fds[2];
+
+	if (pipe(fds) == -1) {
+		fprintf(stderr, "ERROR: Failed to create the token budget pipe: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(budget, 0, sizeof(TOKEN_BUDGET));
+	budget->read_fd = fds[0];
+	budget->write_fd = fds[1];
+	budget->capacity = capacity;
+	budget->shared_read_fd = -1;
+	budget->shared_write_fd = -1;
+
+	if (add_fd_flags(budget->read_fd, F_GETFL, F_SETFL, O_NONBLOCK) == -1 ||
+		add_fd_flags(budget->read_fd, F_GETFD, F_SETFD, FD_CLOEXEC) == -1 ||
+		add_fd_flags(budget->write_fd, F_GETFD, F_SETFD, FD_CLOEXEC) == -1) {
+		fprintf(stderr, "ERROR: Failed to configure the token budget pipe: %s\n", strerror(errno));
+		close_token_budget(budget);
+		return -1;
+	}
+
+	for (int i = 0; i < capacity; i++) {
+		char token = TOKEN_BYTE;
+		if (write(budget->write_fd, &token, 1) != 1) {
+			fprintf(stderr, "ERROR: Failed to load the token budget: %s\n", strerror(errno));
+			close_token_budget(budget);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+	Function to take one token out of the budget without blocking
+
+	Returns 1 if a token was taken and 0 if the budget is currently exhausted
+*/
+int acquire_token(TOKEN_BUDGET *budget) {
+	char token;
+	ssize_t n;
+
+	// a jobserver client always has one job for free (the one make started it with)
+	if (budget->implicit_token) {
+		budget->implicit_token = 0;
+		return 1;
+	}
+
+	while ((n = read(budget->read_fd, &token, 1)) == -1 && errno == EINTR)
+		;
+	if (n != 1) return 0; // EAGAIN: every token is in use by some process
+
+	if (budget->tokens_held < TOKEN_HELD_MAX) budget->held[budget->tokens_held] = token;
+	budget->tokens_held++;
+	return 1;
+}
+
+// Function to return one token to the budget so that another cook can start
+void release_token(TOKEN_BUDGET *budget) {
+	char token = TOKEN_BYTE;
+
+	if (budget->tokens_held <= 0) {
+		if (budget->jobserver != JOBSERVER_NONE) budget->implicit_token = 1;
+		return;
+	}
+
+	budget->tokens_held--;
+	if (budget->jobserver != JOBSERVER_NONE && budget->tokens_held < TOKEN_HELD_MAX) token = budget->held[budget->tokens_held];
+
+	while (write(budget->write_fd, &token, 1) == -1 && errno == EINTR)
+		;
+}
+
+// Function to return every token this process is holding (used on the failure path)
+void release_all_tokens(TOKEN_BUDGET *budget) {
+	while (budget->tokens_held > 0) {
+		release_token(budget);
+	}
+}
+
+/*
+	Function to reset the budget to exactly capacity tokens
+	Only safe to call while no other process is holding tokens: it recovers the tokens
+	that were lost when a process holding them was killed before it could return them
+*/
+void refill_token_budget(TOKEN_BUDGET *budget) {
+	char token;
+
+	while (read(budget->read_fd, &token, 1) == 1)
+		;
+
+	budget->tokens_held = budget->capacity;
+	release_all_tokens(budget);
+}
+
+void close_token_budget(TOKEN_BUDGET *budget) {
+	if (budget->read_fd != -1) close(budget->read_fd);
+	if (budget->write_fd != -1 && budget->write_fd != budget->shared_write_fd) close(budget->write_fd);
+	if (budget->jobserver != JOBSERVER_NONE && budget->capacity > 0) {
+		// a jobserver cook created: nobody else can be using it any more
+		if (budget->shared_read_fd != -1) close(budget->shared_read_fd);
+		if (budget->shared_write_fd != -1) close(budget->shared_write_fd);
+		if (budget->fifo_path[0] != '\0') unlink(budget->fifo_path);
+	}
+	budget->read_fd = -1;
+	budget->write_fd = -1;
+	budget->shared_read_fd = -1;
+	budget->shared_write_fd = -1;
+	budget->fifo_path[0] = '\0';
+	budget->tokens_held = 0;
+	budget->jobserver = JOBSERVER_NONE;
+}
+
+/*
+	Function to open a private non-blocking read end of a jobserver pipe or FIFO
+	The ends make hands down are shared with every other job, so O_NONBLOCK must not be set on them:
+	opening the pipe again through /proc (or the FIFO by name) gives cook a file description of its own
+
+	Returns the fd, or -1 if it can't be opened
+*/
+static int open_private_read_end(const char *path) {
+	return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+/*
+	Function to append the flags of an outer make to makeflags, without its -j and jobserver words
+	(make uses the last --jobserver-auth it finds, so the old ones would send the steps to the outer jobserver)
+	Like make, a first word without a dash is a group of single letter flags and gets one
+*/
+static void append_outer_flags(char *makeflags, size_t size, const char *old_flags) {
+	size_t length = strlen(makeflags);
+	int first = 1, variables = 0;
+
+	while (old_flags != NULL && *old_flags != '\0') {
+		while (*old_flags == ' ') old_flags++;
+		size_t word_length = strcspn(old_flags, " ");
+		if (word_length == 0) break;
+
+		if (word_length == 2 && strncmp(old_flags, "--", 2) == 0) variables = 1; // VAR=value from here on
+		int dropped = !variables && (strncmp(old_flags, "-j", 2) == 0 || strncmp(old_flags, "--jobserver-auth=", 17) == 0 ||
+			strncmp(old_flags, "--jobserver-fds=", 16) == 0);
+		if (!dropped && length + word_length + 3 < size) {
+			const char *dash = first && old_flags[0] != '-' && memchr(old_flags, '=', word_length) == NULL ? "-" : "";
+			length += snprintf(makeflags + length, size - length, " %s%.*s", dash, (int)word_length, old_flags);
+		}
+		first = 0;
+		old_flags += word_length;
+	}
+}
+
+/*
+	Function to make the budget a jobserver for max_cooks jobs and advertise it to the steps in MAKEFLAGS
+	Like make, cook keeps one job for itself (the implicit token) and puts max_cooks - 1 tokens in the pipe,
+	so cooks and the jobs the steps borrow together never go over max_cooks
+
+	Returns 0 on success and -1 if the pipe or FIFO could not be set up
+*/
+int init_jobserver(TOKEN_BUDGET *budget, int max_cooks, JOBSERVER_MODE mode) {
+	char path[128];
+	char makeflags[512];
+
+	memset(budget, 0, sizeof(TOKEN_BUDGET));
+	budget->read_fd = budget->write_fd = budget->shared_read_fd = budget->shared_write_fd = -1;
+	budget->capacity = max_cooks;
+	budget->implicit_token = 1;
+	budget->jobserver = mode;
+
+	if (mode == JOBSERVER_FIFO) {
+		snprintf(budget->fifo_path, sizeof(budget->fifo_path), "/tmp/cook-jobserver-%d", (int)getpid());
+		unlink(budget->fifo_path);
+		if (mkfifo(budget->fifo_path, 0600) == -1 ||
+			(budget->write_fd = open(budget->fifo_path, O_RDWR | O_CLOEXEC)) == -1) { // O_RDWR: never blocks, never sees EOF
+			fprintf(stderr, "ERROR: Failed to create the jobserver FIFO '%s': %s\n", budget->fifo_path, strerror(errno));
+			close_token_budget(budget);
+			return -1;
+		}
+		snprintf(path, sizeof(path), "%s", budget->fifo_path);
+	} else {
+		int fds[2];
+		if (pipe(fds) == -1) {
+			fprintf(stderr, "ERROR: Failed to create the jobserver pipe: %s\n", strerror(errno));
+			budget->jobserver = JOBSERVER_NONE;
+			return -1;
+		}
+		budget->shared_read_fd = fds[0]; // inherited by the steps (no close-on-exec)
+		budget->shared_write_fd = budget->write_fd = fds[1];
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fds[0]);
+	}
+
+	if ((budget->read_fd = open_private_read_end(path)) == -1) {
+		fprintf(stderr, "ERROR: Failed to open the jobserver: %s\n", strerror(errno));
+		close_token_budget(budget);
+		return -1;
+	}
+
+	for (int i = 0; i < max_cooks - 1; i++) {
+		char token = TOKEN_BYTE;
+		if (write(budget->write_fd, &token, 1) != 1) {
+			fprintf(stderr, "ERROR: Failed to load the jobserver: %s\n", strerror(errno));
+			close_token_budget(budget);
+			return -1;
+		}
+	}
+
+	// the steps find the jobserver the same way the jobs of make do
+	if (mode == JOBSERVER_FIFO) {
+		snprintf(makeflags, sizeof(makeflags), " -j%d --jobserver-auth=fifo:%s", max_cooks, budget->fifo_path);
+	} else {
+		snprintf(makeflags, sizeof(makeflags), " -j%d --jobserver-auth=%d,%d", max_cooks, budget->shared_read_fd,
+			budget->shared_write_fd);
+	}
+	append_outer_flags(makeflags, sizeof(makeflags), getenv("MAKEFLAGS"));
+	setenv("MAKEFLAGS", makeflags, 1);
+	return 0;
+}
+
+/*
+	Function to join the jobserver of the make that started cook, if MAKEFLAGS names one that is usable
+	(make only hands the pipe down to recipe lines it knows run make: "+" lines and $(MAKE))
+
+	Returns 1 if the budget now uses the jobserver and 0 otherwise
+*/
+int join_jobserver(TOKEN_BUDGET *budget, const char *makeflags) {
+	const char *auth = NULL, *found;
+	char path[128];
+	int read_fd = -1, write_fd = -1;
+
+	if (makeflags == NULL) return 0;
+
+	// the last one counts, like in make
+	for (found = makeflags; (found = strstr(found, "--jobserver-")) != NULL; found++) auth = found;
+	if (auth == NULL) return 0;
+
+	memset(budget, 0, sizeof(TOKEN_BUDGET));
+	budget->read_fd = budget->write_fd = budget->shared_read_fd = budget->shared_write_fd = -1;
+
+	if (strncmp(auth, "--jobserver-auth=fifo:", 22) == 0) {
+		size_t length = strcspn(auth + 22, " ");
+		if (length == 0 || length >= sizeof(path)) return 0;
+		memcpy(path, auth + 22, length);
+		path[length] = '\0';
+		if ((budget->write_fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1) return 0;
+		budget->jobserver = JOBSERVER_FIFO;
+	} else if (sscanf(auth, "--jobserver-auth=%d,%d", &read_fd, &write_fd) == 2 ||
+		sscanf(auth, "--jobserver-fds=%d,%d", &read_fd, &write_fd) == 2) {
+		// make closes the fds for jobs it doesn't think run make: then the numbers are stale
+		if (read_fd < 0 || write_fd < 0 || fcntl(read_fd, F_GETFD) == -1 || fcntl(write_fd, F_GETFD) == -1) return 0;
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", read_fd);
+		budget->write_fd = budget->shared_write_fd = write_fd;
+		budget->shared_read_fd = read_fd;
+		budget->jobserver = JOBSERVER_PIPE;
+	} else {
+		return 0;
+	}
+
+	if ((budget->read_fd = open_private_read_end(path)) == -1) {
+		close_token_budget(budget);
+		return 0;
+	}
+	budget->implicit_token = 1;
+	return 1;
+}
+
+// Function to count the tokens sitting in the pipe right now, -1 if it can't be told
+int tokens_available(TOKEN_BUDGET *budget) {
+	int available;
+	if (ioctl(budget->read_fd, FIONREAD, &available) == -1) return -1;
+	return available;
+}
+
+/*
+	Function to record how many tokens of a jobserver cook created are out with the steps
+	Whatever is neither in the pipe nor held by cook was borrowed by a make or compiler a step started
+*/
+void note_borrowed_tokens(TOKEN_BUDGET *budget) {
+	if (budget->jobserver == JOBSERVER_NONE || budget->capacity <= 0) return;
+
+	int available = tokens_available(budget);
+	if (available < 0) return;
+
+	int borrowed = budget->capacity - 1 - available - budget->tokens_held;
+	if (borrowed > budget->borrowed_max) budget->borrowed_max = borrowed;
+}
@@ -0,0 +1,134 @@
+/*
+	This is the c file for the Chrome trace of a run (see trace_events.h)
+	The file is one JSON object: the header is written when it is opened, every event is appended with the
+	comma before it, and closing it writes the end, so it is only valid JSON once the context is freed
+	(Perfetto and chrome://tracing also load a trace that was cut short)
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "trace_events.h"
+
+static long monotonic_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+void init_trace(TRACE_LOG *trace) {
+	memset(trace, 0, sizeof(TRACE_LOG));
+	trace->fd = -1;
+}
+
+// writes a whole event in one write(), so events of different processes never mix
+static void write_event(TRACE_LOG *trace, const char *event, int length) {
+	if (length >= TRACE_EVENT_MAX) length = TRACE_EVENT_MAX - 1;
+	if (write(trace->fd, event, length) != length) {
+		// a full disk loses the event, the run goes on
+	}
+}
+
+/*
+	Function to start a trace file (it is truncated) for the main cook calling it
+
+	Returns 0 on success and -1 if the file can not be written
+*/
+int open_trace(TRACE_LOG *trace, const char *path) {
+	close_trace(trace);
+	trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (trace->fd < 0 || (trace->path = strdup(path)) == NULL) {
+		fprintf(stderr, "ERROR: Can't write the trace '%s': %s\n", path, strerror(errno));
+		close_trace(trace);
+		return -1;
+	}
+	trace->pid = getpid();
+	trace->origin_us = monotonic_us();
+	trace->next_track = 1;
+
+	char event[TRACE_EVENT_MAX];
+	int length = snprintf(event, sizeof(event),
+		"{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"cook\"}}",
+		(int)trace->pid);
+	write_event(trace, event, length);
+	return 0;
+}
+
+void close_trace(TRACE_LOG *trace) {
+	if (trace->fd >= 0) {
+		const char *end = "\n],\"displayTimeUnit\":\"ms\"}\n";
+		write_event(trace, end, strlen(end));
+		close(trace->fd);
+	}
+	free(trace->path);
+	init_trace(trace);
+}
+
+long trace_now_us(TRACE_LOG *trace) {
+	return monotonic_us() - trace->origin_us;
+}
+
+/*
+	Function to set aside count tracks (one per cook slot of a run) and name them "label slot N"
+
+	Returns the first of them
+*/
+int add_trace_tracks(TRACE_LOG *trace, int count, const char *label) {
+	int first = trace->next_track;
+	char escaped[TRACE_EVENT_MAX / 2];
+	trace_escape(escaped, sizeof(escaped), label);
+
+	for (int i = 0; i < count; i++) {
+		char event[TRACE_EVENT_MAX];
+		int length = snprintf(event, sizeof(event),
+			",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s slot %d\"}}"
+			",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+			(int)trace->pid, first + i, escaped, i, (int)trace->pid, first + i, first + i);
+		write_event(trace, event, length);
+	}
+	trace->next_track += count;
+	return first;
+}
+
+// Function to append one slice (a "complete" event) from start_us to end_us on a track, args fit in TRACE_ARGS_MAX
+void trace_slice(TRACE_LOG *trace, const char *category, const char *name, int track,
+	long start_us, long end_us, const char *args) {
+	if (trace == NULL || trace->fd < 0) return;
+
+	char escaped[TRACE_EVENT_MAX / 4];
+	trace_escape(escaped, sizeof(escaped), name);
+	char event[TRACE_EVENT_MAX];
+	int length = snprintf(event, sizeof(event),
+		",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%ld,\"dur\":%ld,\"args\":{%s}}",
+		escaped, category, (int)trace->pid, track, start_us, end_us > start_us ? end_us - start_us : 0,
+		args != NULL ? args : "");
+	write_event(trace, event, length);
+}
+
+// Function to describe a wait() status as "exit N" or "signal N"
+void trace_status(char *buffer, int size, int status) {
+	if (WIFSIGNALED(status)) snprintf(buffer, size, "signal %d", WTERMSIG(status));
+	else snprintf(buffer, size, "exit %d", WEXITSTATUS(status));
+}
+
+// Function to copy text into buffer as the inside of a JSON string (cut short if it does not fit)
+void trace_escape(char *buffer, int size, const char *text) {
+	int length = 0;
+	for (; *text != '\0' && length < size - 7; text++) {
+		unsigned char c = *text;
+		if (c == '"' || c == '\\') {
+			buffer[length++] = '\\';
+			buffer[length++] = c;
+		} else if (c < 0x20) {
+			length += snprintf(buffer + length, size - length, "\\u%04x", c);
+		} else {
+			buffer[length++] = c;
+		}
+	}
+	buffer[length] = '\0';
+}
@@ -1,8 +1,14 @@
 #include <errno.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <criterion/criterion.h>
 
+#include "libcook.h"
+#include "adaptive_limit.h"
+#include "async_log.h"
+
 void assert_success(int code) {
     cr_assert_eq(code, EXIT_SUCCESS,
                  "Program exited with %d instead of EXIT_SUCCESS",
@@ -37,3 +43,463 @@ Test(basecode_suite, hello_world_test, .timeout=20) {
     return_code = WEXITSTATUS(system(cmp));
     assert_output_matches(return_code);
 }
+
+Test(daemon_suite, daemon_request_test, .timeout=20) {
+    // a client that connects and never sends its request must not hold up the next one
+    char *cmd = "ulimit -t 10; rm -f tmp/cook_test.sock;"
+                " bin/cook -D tmp/cook_test.sock -c 2 -f rsrc/hello_world.ckb > /dev/null 2>&1 & daemon=$!;"
+                " sleep 0.5; python3 -c 'import socket, time; s = socket.socket(socket.AF_UNIX);"
+                " s.connect(\"tmp/cook_test.sock\"); time.sleep(4)' & idle=$!; sleep 0.2; start=$(date +%s%N);"
+                " bin/cook -S tmp/cook_test.sock -c 2 say_hello > tmp/daemon_request.out;"
+                " status=$?; elapsed=$(( ($(date +%s%N) - start) / 1000000 ));"
+                " kill $idle; kill -TERM $daemon; wait $daemon; test $elapsed -lt 3000 && exit $status";
+    char *cmp = "grep -q '^ok say_hello$' tmp/daemon_request.out";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+static void count_completed(COOK_CONTEXT *ctx, const char *recipe_name, COOK_EVENT event,
+                            int pid, int completed, int total, void *user_data) {
+    if (event == COOK_RECIPE_COMPLETED) (*(int *)user_data)++;
+}
+
+Test(libcook_suite, embedded_run_test, .timeout=20) {
+    int completed = 0;
+    COOK_CONTEXT *ctx = cook_context_new();
+
+    cr_assert_eq(cook_load_cookbook(ctx, "rsrc/hello_world.ckb"), COOK_SUCCESS);
+    cr_assert_eq(cook_select_target(ctx, "hello_world"), COOK_SUCCESS);
+    cook_set_progress_callback(ctx, count_completed, &completed);
+
+    cr_assert_eq(cook_run(ctx, 2), COOK_SUCCESS);
+    cr_assert_eq(completed, 5, "Expected 5 completed recipes, got %d", completed);
+
+    // a second run reuses the parsed cookbook and the analysis of the first
+    cr_assert_eq(cook_run(ctx, 2), COOK_SUCCESS);
+    cr_assert_eq(completed, 10, "Expected 10 completed recipes, got %d", completed);
+
+    cr_assert_eq(cook_select_target(ctx, "no_such_recipe"), COOK_FAILURE);
+    cook_context_free(ctx);
+}
+
+Test(basecode_suite, multiple_targets_test, .timeout=20) {
+    char *cmd = "ulimit -t 10; rm -f tmp/main.o tmp/print.o;"
+                " bin/cook -c 2 -f rsrc/hello_world.ckb main.o print.o main.o > /dev/null";
+    char *cmp = "test -f tmp/main.o && test -f tmp/print.o";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(libcook_suite, shared_sub_recipe_test, .timeout=20) {
+    int completed = 0;
+    COOK_CONTEXT *ctx = cook_context_new();
+
+    cr_assert_eq(cook_load_cookbook(ctx, "rsrc/hello_world.ckb"), COOK_SUCCESS);
+    cr_assert_eq(cook_select_target(ctx, "hello_world"), COOK_SUCCESS);
+    cr_assert_eq(cook_add_target(ctx, "main.o"), COOK_SUCCESS);
+    cook_set_progress_callback(ctx, count_completed, &completed);
+
+    // main.o is a target and a sub-recipe of hello_world, it is still only cooked once
+    cr_assert_eq(cook_run(ctx, 3), COOK_SUCCESS);
+    cr_assert_eq(completed, 5, "Expected 5 completed recipes, got %d", completed);
+
+    cr_assert_eq(cook_add_target(ctx, "no_such_recipe"), COOK_FAILURE);
+    cook_context_free(ctx);
+}
+
+Test(basecode_suite, shared_pool_test, .timeout=20) {
+    // the failing cookbook must not stop the other job sharing the pool
+    char *cmd = "ulimit -t 10; rm -f tmp/main.o tmp/print.o;"
+                " bin/cook -c 2 -f tests/rsrc/burnt_toast.ckb -f rsrc/hello_world.ckb:main.o,print.o@2 > /dev/null 2>&1";
+    char *cmp = "test -f tmp/main.o && test -f tmp/print.o";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_failure(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, keep_going_test, .timeout=20) {
+    char *cmd = "ulimit -t 10; bin/cook -k -c 1 -f tests/rsrc/keep_going.ckb > /dev/null 2> tmp/keep_going.err";
+    char *cmp = "grep -q '^SUMMARY (tests/rsrc/keep_going.ckb): 3 completed, 1 failed, 1 skipped of 5 recipes$' tmp/keep_going.err"
+                " && grep -q '^FAILED: burnt_toast$' tmp/keep_going.err && grep -q '^SKIPPED: dinner$' tmp/keep_going.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_failure(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, auto_cooks_test, .timeout=20) {
+    char *cmd = "ulimit -t 10; bin/cook -c auto:1:4 -f rsrc/eggs_benedict.ckb > /dev/null 2> tmp/auto_cooks.err";
+    char *cmp = "grep -q '^SUMMARY (rsrc/eggs_benedict.ckb): 13 completed, 0 failed, 0 skipped of 13 recipes$' tmp/auto_cooks.err"
+                " && grep -q '^COOK LIMIT (auto 1-4): [1-4] at 0.0s' tmp/auto_cooks.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(adaptive_suite, hysteresis_test) {
+    ADAPTIVE_LIMIT adaptive = { 0 };
+    ADAPTIVE_INPUTS idle = { .online_cpus = 8, .mem_available_kb = 8000000, .mem_total_kb = 16000000 };
+    ADAPTIVE_INPUTS busy = idle, swapping = idle;
+    swapping.mem_pressure = 30;
+
+    start_adaptive_limit(&adaptive, 2, 6, 0);
+    adaptive.limit = 3;
+
+    // going up needs ADAPTIVE_HYSTERESIS samples in a row and then goes one cook at a time
+    cr_assert_eq(adapt_limit(&adaptive, &idle, 3, 500), 3);
+    cr_assert_eq(adapt_limit(&adaptive, &idle, 3, 1000), 4);
+
+    // load that isn't ours brings it down to what is left (never below min_cooks), again after two samples
+    busy.load_1min = 11;             // 8 cpus - (11 - 4 ours) = 1 cook
+    cr_assert_eq(adapt_limit(&adaptive, &busy, 4, 1500), 4);
+    cr_assert_eq(adapt_limit(&adaptive, &busy, 4, 2000), 2);
+
+    // memory pressure halves it at once
+    adaptive.limit = 6;
+    cr_assert_eq(adapt_limit(&adaptive, &swapping, 6, 3500), 3);
+
+    free_adaptive_limit(&adaptive);
+}
+
+Test(basecode_suite, resource_annotations_test, .timeout=20) {
+    // both fetches share the one place of the pool "well" (fetch_more_water keeps it from its first annotation
+    // line) and light_fire takes all 4 cook units, so nothing overlaps even with 4 cooks: three one second recipes take three seconds
+    char *cmd = "ulimit -t 10; start=$(date +%s%N);"
+                " bin/cook -c 4 -f tests/rsrc/resources.ckb > /dev/null || exit 1;"
+                " test $(( ($(date +%s%N) - start) / 1000000 )) -ge 2900";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+}
+
+Test(basecode_suite, jobserver_test, .timeout=20) {
+    // the -j and jobserver of an outer make are dropped, its other flags are passed on
+    char *cmd = "ulimit -t 10; MAKEFLAGS='k -j8 --jobserver-auth=fifo:tmp/outer_jobserver'"
+                " bin/cook -J pipe -c 3 -f tests/rsrc/jobserver.ckb > /dev/null 2> tmp/jobserver.err";
+    char *cmp = "grep -q -- '^ -j3 --jobserver-auth=[0-9]*,[0-9]* -k$' tmp/makeflags.out"
+                " && grep -q '^JOBSERVER (pipe, 3 jobs): at most 0 jobs borrowed by steps$' tmp/jobserver.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, join_jobserver_test, .timeout=20) {
+    // a jobserver with no tokens to spare: cook only has the job make started it with, so bread and soup
+    // take turns even though -c allows 3 cooks
+    char *cmd = "ulimit -t 10; rm -f tmp/empty_jobserver; mkfifo tmp/empty_jobserver; exec 3<>tmp/empty_jobserver;"
+                " start=$(date +%s%N);"
+                " MAKEFLAGS=' -j2 --jobserver-auth=fifo:tmp/empty_jobserver' bin/cook -c 3 -f tests/rsrc/jobserver.ckb > /dev/null || exit 1;"
+                " elapsed=$(( ($(date +%s%N) - start) / 1000000 )); rm -f tmp/empty_jobserver;"
+                " test $elapsed -ge 1900 && grep -q -- '--jobserver-auth=fifo:tmp/empty_jobserver' tmp/makeflags.out";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+}
+
+Test(basecode_suite, critical_path_policy_test, .timeout=20) {
+    // with one cook the order of the echoes is the order the recipes were dequeued in
+    char *cmd = "ulimit -t 10; bin/cook -c 1 -f tests/rsrc/critical_path.ckb > tmp/fifo_policy.out"
+                " && bin/cook -c 1 --policy critical-path -f tests/rsrc/critical_path.ckb > tmp/critical_path_policy.out";
+    char *cmp = "printf 'salad\\nshop\\nmarinate\\nroast\\ndinner\\n' | cmp - tmp/fifo_policy.out"
+                " && printf 'shop\\nmarinate\\nsalad\\nroast\\ndinner\\n' | cmp - tmp/critical_path_policy.out";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, duration_history_test, .timeout=20) {
+    // the second run folds its durations into the ones the first run left in the history file
+    char *cmd = "ulimit -t 10; rm -f tmp/cook_history;"
+                " bin/cook -c 2 --history tmp/cook_history -f rsrc/hello_world.ckb > /dev/null"
+                " && bin/cook -c 2 --history tmp/cook_history --eta -f rsrc/hello_world.ckb > /dev/null 2> tmp/duration_history.err";
+    char *cmp = "grep -q \"rsrc/hello_world.ckb\tsay_hello\t-\t2\t\" tmp/cook_history"
+                " && grep -q '^ETA: say_hello in about [0-9.]*s (1 of 6 recipes done)$' tmp/duration_history.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, shared_history_test, .timeout=20) {
+    // two cooks read the history before either of them writes it, the second save still keeps the first one's samples
+    char *cmd = "ulimit -t 10; rm -f tmp/shared_history;"
+                " bin/cook -c 2 --history tmp/shared_history -f tests/rsrc/status.ckb > /dev/null &"
+                " bin/cook -c 2 --history tmp/shared_history -f tests/rsrc/status.ckb > /dev/null; wait";
+    char *cmp = "grep -q \"tests/rsrc/status.ckb\tsimmer\t-\t2\t\" tmp/shared_history";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, recipe_timeout_test, .timeout=20) {
+    // hang sleeps for 30s, its timeout annotation kills it (and its sleep) after a second, and the summary says so
+    char *cmd = "ulimit -t 10; bin/cook -c 1 -f tests/rsrc/timeouts.ckb > /dev/null 2> tmp/timeouts.err";
+    char *cmp = "grep -q \"^ERROR: Recipe 'hang' timed out after 1.0s\" tmp/timeouts.err && grep -q '^TIMED OUT: hang$' tmp/timeouts.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_failure(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, speculation_test, .timeout=20) {
+    // slow usually takes 100ms (history), the first cook hangs so a backup cook is started and wins
+    char *cmd = "ulimit -t 10; rm -rf tmp/straggler.lock;"
+                " printf \"$(realpath tests/rsrc/timeouts.ckb)\\tslow\\t-\\t3\\t100.0\\t0.0\\n\" > tmp/speculation_history;"
+                " bin/cook -c 2 --speculate --history tmp/speculation_history -f tests/rsrc/timeouts.ckb slow > /dev/null 2> tmp/speculation.err";
+    char *cmp = "grep -q '^SPECULATION: 1 backup cooks started, 1 finished first$' tmp/speculation.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, retry_test, .timeout=20) {
+    // buy_eggs fails the first time and is retried after its 100ms backoff, the annotation alone is enough for
+    // the summary
+    char *cmd = "ulimit -t 10; rm -rf tmp/flaky.lock; bin/cook -c 1 -f tests/rsrc/flaky.ckb > /dev/null 2> tmp/flaky.err";
+    char *cmp = "grep -q '^SUMMARY (tests/rsrc/flaky.ckb): 2 completed, 0 failed, 0 skipped of 2 recipes$' tmp/flaky.err"
+                " && grep -q '^RETRIES (1): buy_eggs x1$' tmp/flaky.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, cpu_placement_test, .timeout=20) {
+    // every cook is pinned to a cpu domain, and with one cook at a time every recipe with sub-recipes follows them
+    char *cmd = "ulimit -t 10; bin/cook --placement llc -c 1 -f tests/rsrc/critical_path.ckb > /dev/null 2> tmp/placement.err";
+    char *cmp = "grep -q '^PLACEMENT (llc): [0-9]* domains over [0-9]* cpus, 5 cooks placed, 3 next to their sub-recipes$'"
+                " tmp/placement.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, priority_class_test, .timeout=20) {
+    // bulk and compress have their classes, shop -> roast -> dinner is the critical path and is raised
+    // (the nice value only where cook may lower it, the I/O priority always)
+    char *cmd = "ulimit -t 10; bin/cook --critical-boost -c 1 -f tests/rsrc/priorities.ckb > tmp/priorities.out 2> tmp/priorities.err";
+    char *cmp = "grep -q '^bulk nice=19 io=idle$' tmp/priorities.out"
+                " && grep -q '^compress nice=10 io=best-effort: prio 7$' tmp/priorities.out"
+                " && grep -Eq '^shop nice=(-5|0) io=best-effort: prio 0$' tmp/priorities.out"
+                " && grep -Eq '^dinner nice=(-5|0) io=best-effort: prio 0$' tmp/priorities.out"
+                " && grep -q '^PRIORITY CLASSES: critical: dinner roast shop; background: compress; idle: bulk' tmp/priorities.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, recipe_limits_test, .timeout=20) {
+    // capped runs under its setrlimit caps (within the ulimit -t of the test), and no machine has 1000T
+    // available, so with one recipe already cooking the other one has to wait for it; under a lower hard
+    // limit its files cap stays at that limit
+    char *cmd = "ulimit -t 10; bin/cook --mem-floor 1000T -c 2 -f tests/rsrc/limits.ckb > tmp/limits.out 2> tmp/limits.err"
+                " && (ulimit -n 48; bin/cook -c 1 -f tests/rsrc/limits.ckb capped > tmp/limits_hard.out)";
+    char *cmp = "grep -q '^capped as=1048576 cpu=5 files=64 procs=4096$' tmp/limits.out"
+                " && grep -q '^capped as=1048576 cpu=5 files=48 procs=4096$' tmp/limits_hard.out"
+                " && grep -q '^uncapped ' tmp/limits.out && ! grep -q '^uncapped .*files=64 ' tmp/limits.out"
+                " && grep -Eq '^THROTTLED \\(1, less than [0-9.]*M available\\): (capped|uncapped)$' tmp/limits.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, trace_test, .timeout=20) {
+    // the trace is valid JSON with one slice per recipe, task and step (one each for the 5 recipes),
+    // and no step is on the track of a slot
+    char *cmd = "ulimit -t 10; rm -f tmp/trace.json; bin/cook --trace=tmp/trace.json -c 2 -f tests/rsrc/critical_path.ckb > /dev/null";
+    char *cmp = "python3 -c \"import json, collections; events = json.load(open('tmp/trace.json'))['traceEvents'];"
+                " count = collections.Counter(e.get('cat') for e in events if e['ph'] == 'X');"
+                " slots = set(e['tid'] for e in events if e['ph'] == 'X' and e['cat'] == 'recipe');"
+                " exit(count != {'recipe': 5, 'task': 5, 'step': 5} or any(e['tid'] in slots for e in events if e.get('cat') == 'step'))\"";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, usage_test, .timeout=20) {
+    // every recipe has the usage of its cook (which includes its step) and of its step, and held back by the
+    // memory floor one of the 2 slots idles with work ready (no report was lost on the way)
+    char *cmd = "ulimit -t 10; rm -f tmp/usage.json; bin/cook --usage-json tmp/usage.json --mem-floor 1000T -c 2 -f tests/rsrc/critical_path.ckb > /dev/null 2>&1";
+    char *cmp = "python3 -c \"import json; job = json.load(open('tmp/usage.json'))['jobs'][0];"
+                " steps = [s for r in job['recipes'] for t in r['tasks'] for s in t['steps']];"
+                " exit(len(job['recipes']) != 5 or any(r['usage']['processes'] != 1 for r in job['recipes']) or"
+                " len(steps) != 5 or any(s['usage']['processes'] != 1 for s in steps) or job['slots']['idle_work_ready'] <= 0 or"
+                " job['lost_reports'] != 0)\"";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, perf_counters_test, .timeout=20) {
+    // every recipe has its 6 counters, null where the machine could not count them (no PMU in a VM)
+    char *cmd = "ulimit -t 10; rm -f tmp/perf.json; bin/cook --perf --usage-json tmp/perf.json -c 2 -f tests/rsrc/critical_path.ckb > /dev/null";
+    char *cmp = "python3 -c \"import json; recipes = json.load(open('tmp/perf.json'))['jobs'][0]['recipes'];"
+                " exit(len(recipes) != 5 or any(len(r['counters']) != 6 or"
+                " any(v is not None and v < 0 for v in r['counters'].values()) for r in recipes))\"";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, latency_test, .timeout=20) {
+    // all 5 recipes are forked and release their dependents once, a SIGCHLD only times the reap it woke up
+    char *cmd = "ulimit -t 10; bin/cook --latency -c 2 -f tests/rsrc/critical_path.ckb 2> tmp/latency.err > /dev/null";
+    char *cmp = "awk '/^sigchld to reap/ { s = $4 } /^reap to queue updated/ { q = $5 } /^ready to fork/ { f = $4 }"
+                " END { exit !(s >= 1 && s <= 5 && q == 5 && f == 5) }' tmp/latency.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, timings_test, .timeout=20) {
+    // the JSON has the 5 recipes of the run with every phase timed and the main cook's memory
+    char *cmd = "ulimit -t 10; rm -f tmp/timings.json; bin/cook --timings=tmp/timings.json -c 2 -f tests/rsrc/critical_path.ckb > /dev/null";
+    char *cmp = "python3 -c \"import json; job = json.load(open('tmp/timings.json'))['jobs'][0];"
+                " exit(job['recipes'] != 5 or job['cooks'] != 2 or job['run_ms'] <= 0 or job['peak_rss_kb'] <= 0 or"
+                " any(job[k] < 0 for k in ('parse_ms', 'analysis_ms', 'scheduler_cpu_us_per_recipe')))\"";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, status_page_test, .timeout=20) {
+    // while simmer cooks, cook-top finds it on its slot at task 1 of 2 and quick already completed, the page goes with the cook;
+    // a file that is already there is never used as the page
+    char *cmd = "ulimit -t 10; rm -f tmp/status.page; (bin/cook --status=tmp/status.page -c 2 -f tests/rsrc/status.ckb > /dev/null &);"
+                " sleep 1; bin/cook-top -n tmp/status.page > tmp/status.out; sleep 2; test ! -e tmp/status.page || exit 1;"
+                " echo keep > tmp/status.keep; bin/cook --status=tmp/status.keep -f tests/rsrc/critical_path.ckb > /dev/null 2>&1;"
+                " test \"$(cat tmp/status.keep)\" = keep";
+    char *cmp = "grep -q 'recipes: 1/3 completed, 0 failed   queue: 0   cooks: 1/2' tmp/status.out &&"
+                " grep -q '^   [01] *[0-9][0-9]*  simmer  *1     0/2' tmp/status.out &&"
+                " grep -q '^quick  *completed  *1' tmp/status.out";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+Test(basecode_suite, workload_modes_test, .timeout=20) {
+    // the burn uses its 100ms of cpu, the memory recipe its 16MB, the pipe and files carry their MBs and the seeded
+    // delay is the same every time
+    char *cmd = "ulimit -t 10; rm -f tmp/workload.data tmp/workload.out tmp/workloads.json;"
+                " bin/cook --usage-json tmp/workloads.json -c 4 -f tests/rsrc/workloads.ckb > /dev/null 2> tmp/workloads.err";
+    char *cmp = "python3 -c \"import json; usage = {r['name']: r['usage'] for r in json.load(open('tmp/workloads.json'))['jobs'][0]['recipes']};"
+                " exit(usage['burn']['user_s'] + usage['burn']['sys_s'] < 0.09 or usage['memory']['max_rss_kb'] < 16384)\""
+                " && test $(wc -c < tmp/workload.data) -eq 2097152 && test $(wc -c < tmp/workload.out) -eq 1048576"
+                " && grep -q '^START.*, 3\\] generic_step -s 1 -m seeded' tmp/workloads.err";
+
+    int return_code = WEXITSTATUS(system(cmd));
+    assert_success(return_code);
+    return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
+
+/*
+    Dispatch latency SLOs: cookbooks of zero-delay steps that time their own dispatch (bench/dispatch_step), from
+    their recipe being ready with a free cook to the step running. A cook only gets a cpu after the cooks ahead
+    of it, so the budget grows with the cooks sharing one
+*/
+#define DISPATCH_RECIPES 400
+#define DISPATCH_P99_MS_PER_COOK 5.0    // p99 budget for every cook sharing a cpu
+#define DISPATCH_MAX_FACTOR 4           // max budget, as a multiple of the p99 one
+
+static int compare_latencies(const void *a, const void *b) {
+    long long first = *(const long long *)a, second = *(const long long *)b;
+    return first < second ? -1 : first > second;
+}
+
+static void assert_dispatch_slo(const char *shape, int cooks) {
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "ulimit -t 30; rm -f tmp/dispatch.lat;"
+             " bin/gen_cookbook %s %d 32 1 'bin/dispatch_step tmp/dispatch.lat' > tmp/dispatch.ckb"
+             " && bin/cook --latency -c %d -f tmp/dispatch.ckb > /dev/null 2>&1", shape, DISPATCH_RECIPES, cooks);
+    assert_success(WEXITSTATUS(system(cmd)));
+
+    long long latencies[DISPATCH_RECIPES + 1];
+    int count = 0;
+    FILE *in = fopen("tmp/dispatch.lat", "r");
+    cr_assert_not_null(in, "No dispatch latencies were written");
+    while (count <= DISPATCH_RECIPES && fscanf(in, "%lld", &latencies[count]) == 1) count++;
+    fclose(in);
+    cr_assert_eq(count, DISPATCH_RECIPES + 1, "%s -c %d: %d of %d steps timed", shape, cooks, count, DISPATCH_RECIPES + 1);
+
+    qsort(latencies, count, sizeof(long long), compare_latencies);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    double budget_ms = DISPATCH_P99_MS_PER_COOK * ((cooks + cpus - 1) / cpus);
+    double p99_ms = latencies[(count * 99 + 99) / 100 - 1] / 1e6, max_ms = latencies[count - 1] / 1e6;
+    cr_assert_leq(p99_ms, budget_ms, "%s -c %d: p99 dispatch latency %.3fms over %.1fms", shape, cooks, p99_ms, budget_ms);
+    cr_assert_leq(max_ms, budget_ms * DISPATCH_MAX_FACTOR, "%s -c %d: max dispatch latency %.3fms over %.1fms",
+                  shape, cooks, max_ms, budget_ms * DISPATCH_MAX_FACTOR);
+}
+
+Test(dispatch_suite, dispatch_latency_test, .timeout=120) {
+    const char *shapes[] = { "fanout", "lattice", "chain" };
+    int cooks[] = { 1, 4, 16 };
+    for (int s = 0; s < 3; s++) {
+        for (int c = 0; c < 3; c++) assert_dispatch_slo(shapes[s], cooks[c]);
+    }
+}
+
+Test(log_suite, async_log_test) {
+    // messages below the level are left out, the others come out of the ring in order once flushed
+    mkdir("tmp", 0777);
+    int saved = dup(STDERR_FILENO), fd = open("tmp/async_log.err", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    cr_assert(saved >= 0 && fd >= 0);
+    fflush(stderr);
+    dup2(fd, STDERR_FILENO);
+
+    set_log_level(LOG_INFO);
+    for (int i = 0; i < 3; i++) {
+        log_message(LOG_DEBUG, "base_tests.c", "async_log_test", 1, "hidden %d", i);
+        log_message(LOG_WARN, "base_tests.c", "async_log_test", 2, "shown %d", i);
+    }
+    flush_log();
+    set_log_level(LOG_OFF);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    close(fd);
+
+    char *cmp = "test \"$(grep -o 'WARN: base_tests.c:async_log_test:2 .*' tmp/async_log.err | sed 's/.*shown/shown/' | tr '\\n' ' ')\""
+                " = 'shown 0 shown 1 shown 2 ' && ! grep -q hidden tmp/async_log.err";
+    int return_code = WEXITSTATUS(system(cmp));
+    assert_output_matches(return_code);
+}
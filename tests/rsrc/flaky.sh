@@ -0,0 +1,6 @@
+#!/bin/sh
+# fails the first time it is run (the store was out of eggs), works from then on
+if mkdir tmp/flaky.lock 2> /dev/null; then
+    exit 1
+fi
+echo eggs
@@ -0,0 +1,3 @@
+#!/bin/bash
+# prints the resource limits the step was started with
+echo "$1 as=$(ulimit -v) cpu=$(ulimit -t) files=$(ulimit -n) procs=$(ulimit -u)"
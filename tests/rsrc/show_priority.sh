@@ -0,0 +1,3 @@
+#!/bin/sh
+# prints the nice value and I/O priority the step was started with
+echo "$1 nice=$(nice) io=$(ionice -p $$)"
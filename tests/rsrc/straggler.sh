@@ -0,0 +1,6 @@
+#!/bin/sh
+# the first cook of a recipe takes the lock and hangs, a second (speculative) cook finishes at once
+if mkdir tmp/straggler.lock 2> /dev/null; then
+    sleep 30
+fi
+echo done
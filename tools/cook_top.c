@@ -0,0 +1,130 @@
+/*
+	cook-top: live view of a running cook (cook --status), like top
+	It only reads the status page the main cook keeps in /dev/shm, so watching a build never slows it down,
+	signals it or makes it wait: no syscall ever goes to the cook, the page is copied lock-free (see status_page.h)
+	Shows the counts of the run, what every cook slot is cooking (task and steps done) and the recipes that
+	took longest so far; it ends when the page goes away (the cook is done)
+
+	usage: cook-top [-n] [-d milliseconds] pid|file
+		-n    print the page once and exit (1 if there is none)
+		-d    refresh interval (1000)
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "status_page.h"
+
+#define LONGEST_SHOWN 10
+
+static const char *state_names[] = { "waiting", "cooking", "completed", "failed" };
+
+static long now_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+// how long a recipe took, or has been cooking so far (0 if it never started)
+static long recipe_ms(STATUS_RECIPE *recipe, long now) {
+	if (recipe->started_ms == 0) return 0;
+	return (recipe->ended_ms > 0 ? recipe->ended_ms : now) - recipe->started_ms;
+}
+
+static long compare_now;
+
+static int compare_longest(const void *a, const void *b) {
+	long first = recipe_ms(*(STATUS_RECIPE **)a, compare_now), second = recipe_ms(*(STATUS_RECIPE **)b, compare_now);
+	return first < second ? 1 : first > second ? -1 : 0;
+}
+
+// Function to print one copy of the status page
+static void render(char *page, FILE *out) {
+	STATUS_HEADER *header = (STATUS_HEADER *)page;
+	STATUS_SLOT *slots = (STATUS_SLOT *)(header + 1);
+	STATUS_RECIPE *recipes = (STATUS_RECIPE *)(slots + header->slot_count);
+	long now = now_ms();
+
+	fprintf(out, "cook %d  %s  %s %.1fs\n", header->pid, header->cookbook, header->running ? "running" : "done after",
+		((header->running ? now : header->updated_ms) - header->started_ms) / 1000.0);
+	fprintf(out, "recipes: %d/%d completed, %d failed   queue: %d   cooks: %d/%d\n\n", header->completed, header->total,
+		header->failed, header->queue_depth, header->active_cooks, header->slot_count);
+
+	fprintf(out, "%4s %7s  %-32s %5s %7s %8s\n", "SLOT", "PID", "RECIPE", "TASK", "STEPS", "TIME");
+	for (int i = 0; i < header->slot_count; i++) {
+		STATUS_SLOT *slot = &slots[i];
+		if (slot->pid == 0 || slot->recipe < 0 || slot->recipe >= header->recipe_count) {
+			fprintf(out, "%4d %7s  %s\n", i, "-", "-");
+			continue;
+		}
+		char task[16] = "-", steps[32] = "-";
+		if (slot->task >= 0) {
+			snprintf(task, sizeof(task), "%d", slot->task);
+			snprintf(steps, sizeof(steps), "%d/%d", slot->step, slot->step_count);
+		}
+		fprintf(out, "%4d %7d  %-32.32s %5s %7s %7.1fs\n", i, slot->pid, recipes[slot->recipe].name, task, steps,
+			(now - slot->started_ms) / 1000.0);
+	}
+
+	STATUS_RECIPE **longest = malloc((header->recipe_count + 1) * sizeof(STATUS_RECIPE *));
+	if (longest == NULL) return;
+	int count = 0;
+	for (int i = 0; i < header->recipe_count; i++) {
+		if (recipes[i].started_ms > 0) longest[count++] = &recipes[i];
+	}
+	compare_now = now;
+	qsort(longest, count, sizeof(STATUS_RECIPE *), compare_longest);
+
+	fprintf(out, "\n%-32s %-10s %6s %8s\n", "LONGEST RECIPES", "STATE", "COOKS", "TIME");
+	for (int i = 0; i < count && i < LONGEST_SHOWN; i++) {
+		int state = longest[i]->state >= 0 && longest[i]->state <= STATUS_FAILED ? longest[i]->state : STATUS_WAITING;
+		fprintf(out, "%-32.32s %-10s %6d %7.1fs\n", longest[i]->name, state_names[state], longest[i]->cooks,
+			recipe_ms(longest[i], now) / 1000.0);
+	}
+	free(longest);
+	fflush(out);
+}
+
+int main(int argc, char *argv[]) {
+	int once = 0, opt;
+	long interval_ms = 1000;
+
+	while ((opt = getopt(argc, argv, "nd:")) != -1) {
+		if (opt == 'n') once = 1;
+		else if (opt == 'd' && atol(optarg) > 0) interval_ms = atol(optarg);
+		else {
+			fprintf(stderr, "usage: cook-top [-n] [-d milliseconds] pid|file\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: cook-top [-n] [-d milliseconds] pid|file\n");
+		return EXIT_FAILURE;
+	}
+
+	// a pid names the default page of that cook
+	char path[256];
+	const char *target = argv[optind];
+	if (strspn(target, "0123456789") == strlen(target)) snprintf(path, sizeof(path), STATUS_DIR "cook.%s", target);
+	else snprintf(path, sizeof(path), "%s", target);
+
+	int shown = 0;
+	while (1) {
+		size_t size;
+		char *page = read_status_page(path, &size);
+		if (page == NULL) {
+			if (!shown) fprintf(stderr, "ERROR: No cook status page at '%s' (is cook running with --status?)\n", path);
+			return shown ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+		if (!once) printf("\033[H\033[J"); // clear the terminal
+		render(page, stdout);
+		free(page);
+		shown = 1;
+		if (once) return EXIT_SUCCESS;
+
+		struct timespec interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000 };
+		nanosleep(&interval, NULL);
+	}
+}
@@ -3,6 +3,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 
 /*
@@ -16,6 +17,16 @@
  *     a command to be run in a child process.
  *   If the argument '-c' is not given, then any arguments starting from the first
  *     non-option argument are are simply ignored.
+ *
+ * Workload modes, so a recipe can load the machine like a real one instead of sleeping
+ * (sizes are in MB, times in ms; they run in this order, after the delay):
+ *   '-s seed'   the delay is drawn from seed instead of the clock: the same seed, the same delay
+ *   '-b ms'     burn ms of cpu time in a busy loop (takes longer when the cpu is shared)
+ *   '-a mb'     allocate mb of memory and write to every page of it
+ *   '-W mb'     write mb to the file given with '-F file' (created or truncated)
+ *   '-R mb'     read up to mb from the file given with '-F file'
+ *   '-o mb'     write mb to stdout (the producer end of a pipeline)
+ *   '-i mb'     read up to mb from stdin and drop it (the consumer end), 0 reads until EOF
  */
 
 /*
@@ -25,8 +36,53 @@
  * should be just a convenience.
  */
 #define BASE_SECONDS (0)
+#define MB (1024L * 1024L)
+#define CHUNK (64 * 1024)
 int get_ms(struct timespec *);
 
+// spins until the process has used ms of cpu time
+static void burn_cpu(long ms) {
+    struct timespec used;
+    volatile unsigned long spin = 0;
+    do {
+        for (int i = 0; i < 10000; i++) spin += i;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &used);
+    } while (used.tv_sec * 1000L + used.tv_nsec / 1000000 < ms);
+}
+
+// allocates mb and writes a byte to every page, so all of it is resident until the step exits
+static int touch_memory(long mb) {
+    char *memory = malloc(mb * MB);
+    if (memory == NULL) return -1;
+    long page = sysconf(_SC_PAGESIZE) > 0 ? sysconf(_SC_PAGESIZE) : 4096;
+    for (long i = 0; i < mb * MB; i += page) memory[i] = (char)i;
+    return 0;
+}
+
+// writes mb of data to fd
+static int write_data(int fd, long mb) {
+    char chunk[CHUNK];
+    memset(chunk, 'x', sizeof(chunk));
+    for (long left = mb * MB; left > 0; ) {
+        ssize_t done = write(fd, chunk, left < CHUNK ? left : CHUNK);
+        if (done <= 0) return -1;
+        left -= done;
+    }
+    return 0;
+}
+
+// reads up to mb of data from fd (until EOF if mb is 0)
+static int read_data(int fd, long mb) {
+    char chunk[CHUNK];
+    for (long left = mb > 0 ? mb * MB : -1; left != 0; ) {
+        ssize_t done = read(fd, chunk, left > 0 && left < CHUNK ? left : CHUNK);
+        if (done < 0) return -1;
+        if (done == 0) break;
+        if (left > 0) left -= done;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     int c;
     struct timespec ts;
@@ -37,6 +93,9 @@ int main(int argc, char *argv[]) {
     int options = 0;
     int cmd = 0;
     char *message = 0;
+    int no_delay = 0;
+    long burn_ms = 0, memory_mb = 0, write_mb = 0, read_mb = 0, out_mb = 0, in_mb = -1;
+    char *file = NULL;
 
     for(options = 1; options < argc; options++) {
         if (argv[options][0] == '-') {
@@ -47,7 +106,33 @@ int main(int argc, char *argv[]) {
                     break;
                 case 'd':
                     delay = 0;
+                    no_delay = 1;
 		    break;
+                case 's':
+                    if (++options < argc) srandom((unsigned int)atol(argv[options]));
+                    if (!no_delay) delay = random() % 10;
+                    break;
+                case 'b':
+                    if (++options < argc) burn_ms = atol(argv[options]);
+                    break;
+                case 'a':
+                    if (++options < argc) memory_mb = atol(argv[options]);
+                    break;
+                case 'W':
+                    if (++options < argc) write_mb = atol(argv[options]);
+                    break;
+                case 'R':
+                    if (++options < argc) read_mb = atol(argv[options]);
+                    break;
+                case 'F':
+                    if (++options < argc) file = argv[options];
+                    break;
+                case 'o':
+                    if (++options < argc) out_mb = atol(argv[options]);
+                    break;
+                case 'i':
+                    if (++options < argc) in_mb = atol(argv[options]);
+                    break;
 	        case 'c':
 		    cmd = 1;
 		    break;
@@ -82,6 +167,41 @@ int main(int argc, char *argv[]) {
         printf("%s\n", message);
     }
     usleep(delay * 100000);
+    if(burn_ms > 0)
+        burn_cpu(burn_ms);
+    if(memory_mb > 0 && touch_memory(memory_mb) != 0) {
+        fprintf(stderr, "%s: could not allocate %ld MB\n", argv[0], memory_mb);
+        exit(1);
+    }
+    if((write_mb > 0 || read_mb > 0) && file == NULL) {
+        fprintf(stderr, "%s: -W and -R need the file given with -F\n", argv[0]);
+        exit(1);
+    }
+    if(write_mb > 0) {
+        int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || write_data(fd, write_mb) != 0 || close(fd) != 0) {
+            fprintf(stderr, "%s: writing %ld MB to '%s' failed\n", argv[0], write_mb, file);
+            exit(1);
+        }
+    }
+    if(read_mb > 0) {
+        int fd = open(file, O_RDONLY);
+        if(fd < 0 || read_data(fd, read_mb) != 0 || close(fd) != 0) {
+            fprintf(stderr, "%s: reading '%s' failed\n", argv[0], file);
+            exit(1);
+        }
+    }
+    if(out_mb > 0) {
+        fflush(stdout); // the message comes first
+        if(write_data(STDOUT_FILENO, out_mb) != 0) {
+            fprintf(stderr, "%s: writing %ld MB to stdout failed\n", argv[0], out_mb);
+            exit(1);
+        }
+    }
+    if(in_mb >= 0 && read_data(STDIN_FILENO, in_mb) != 0) {
+        fprintf(stderr, "%s: reading stdin failed\n", argv[0]);
+        exit(1);
+    }
     if(copy) {
 	// Copy stdin to stdout.
 	while((c = getchar()) != EOF)